@@ -0,0 +1,44 @@
+#include "Animation.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+bool endsBefore(int time_ms, const AnimationClip::Frame& frame) {
+	return time_ms < frame.end_ms;
+}
+
+} // namespace
+
+void Animation::play(const AnimationClip* clip_, bool loop) {
+	clip = clip_;
+	time_ms = 0.0f;
+	looping = loop;
+}
+
+void Animation::advance(float ms) {
+	if (clip == nullptr || clip->empty())
+		return;
+	time_ms += ms;
+	float duration = static_cast<float>(clip->duration());
+	if (looping)
+		time_ms = std::fmod(time_ms, duration);
+	else
+		time_ms = std::min(time_ms, duration);
+}
+
+bool Animation::finished() const {
+	return !looping && (clip == nullptr || time_ms >= clip->duration());
+}
+
+void Animation::apply(Sprite& spr) const {
+	if (clip == nullptr || clip->empty())
+		return;
+	// The first frame that hasn't ended yet, or the last one once they all have.
+	std::vector<AnimationClip::Frame>::const_iterator frame =
+		std::upper_bound(clip->frames.begin(), clip->frames.end(), static_cast<int>(time_ms), endsBefore);
+	if (frame == clip->frames.end())
+		--frame;
+	spr.setImg(frame->img_x, frame->img_y, clip->width, clip->height);
+}
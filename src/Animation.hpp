@@ -0,0 +1,49 @@
+#pragma once
+
+#include "SpriteBuffer.hpp"
+#include <vector>
+
+/** The frames of an animated sprite, as placed in a texture. */
+struct AnimationClip {
+	struct Frame {
+		int img_x, img_y;
+		// Time from the start of the clip at which the frame ends.
+		int end_ms;
+	};
+
+	// Of every frame.
+	int width, height;
+	std::vector<Frame> frames;
+
+	AnimationClip() : width(0), height(0) { }
+
+	bool empty() const { return frames.empty(); }
+	int duration() const { return frames.empty() ? 0 : frames.back().end_ms; }
+};
+
+/**
+ * Plays an AnimationClip on a sprite.
+ *
+ * The frames are already decoded and packed into the texture, so playing
+ * one is only a clock and a lookup of the frame it's at; any number of
+ * sprites can play the same clip. Without a clip, or with an empty one,
+ * apply() leaves the sprite's image alone.
+ */
+class Animation {
+public:
+	Animation() : clip(nullptr), time_ms(0.0f), looping(false) { }
+
+	// Starts the clip from its first frame. A looping animation never
+	// finishes; otherwise it holds the last frame once it's done.
+	void play(const AnimationClip* clip, bool loop);
+	void advance(float ms);
+	bool finished() const;
+
+	// Points the sprite at the current frame.
+	void apply(Sprite& spr) const;
+
+private:
+	const AnimationClip* clip;
+	float time_ms;
+	bool looping;
+};
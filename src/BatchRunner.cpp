@@ -0,0 +1,207 @@
+#include "BatchRunner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include "Game.hpp"
+#include "Hash.hpp"
+#include "ThreadPool.hpp"
+
+namespace {
+
+// Stand-in for a player: works out where each falling gem will reach the
+// paddle and when, and moves under the first one it can still get to. How
+// well it plays varies from game to game: it aims off by up to a per-game
+// amount that changes every so often, and now and then looks away for a
+// while. Uses its own stream so it doesn't disturb the game's.
+struct ScriptedInput {
+	RandomGenerator rng;
+	int max_aim_error; // Pixels
+	int idle_chance;   // Out of 100, each time the aim changes
+	int aim_error;
+	int frames_until_change;
+	int idle_frames;
+
+	static const uint64_t INPUT_STREAM = 0x5EED5EED;
+	// Closer than this counts as under the target.
+	static const int DEAD_ZONE = 3;
+	// Frames the paddle takes to level out after moving at full tilt; gems
+	// landing on a tilted paddle bounce off sideways.
+	static const int LEVEL_FRAMES = 15;
+
+	explicit ScriptedInput(uint32_t seed)
+		: rng(seed, INPUT_STREAM), aim_error(0), frames_until_change(0), idle_frames(0)
+	{
+		max_aim_error = randRange(rng, 0, 20);
+		idle_chance = randRange(rng, 0, 20);
+	}
+
+	InputState next(const GameState& game_state) {
+		if (frames_until_change == 0) {
+			aim_error = randRange(rng, -max_aim_error, max_aim_error);
+			frames_until_change = randRange(rng, 30, 120);
+			if (randRange(rng, 0, 99) < idle_chance)
+				idle_frames = randRange(rng, 10, 60);
+		}
+		--frames_until_change;
+		if (idle_frames > 0) {
+			--idle_frames;
+			return 0;
+		}
+
+		// Gems already on the paddle are left alone, and with nothing to
+		// catch the paddle stays still, since moving tilts it.
+		const Paddle& paddle = game_state.paddle;
+		float paddle_x = paddle.pos_x.toFloat();
+		float gravity = GEM_GRAVITY.toFloat();
+		float speed = PADDLE_MOVEMENT_SPEED.toFloat();
+		bool have_target = false;
+		float target_frames = 0.0f, target_x = 0.0f;
+		for (const Gem& gem : game_state.gems) {
+			if (gem.pos_y >= paddle.pos_y || gem.isAsleep() || paddleContact(gem, paddle) != PADDLE_APART)
+				continue;
+
+			// Frames until it falls to the paddle's height, and the x it's at
+			// then, bouncing off the sides.
+			float radius = gem.radius.toFloat();
+			float drop = (paddle.pos_y - gem.pos_y).toFloat() - radius;
+			float vel_y = gem.vel_y.toFloat();
+			float frames = (-vel_y + std::sqrt(vel_y*vel_y + 2.0f*gravity*drop)) / gravity;
+
+			float span = WINDOW_WIDTH - 2.0f*radius;
+			float x = std::fmod(std::fabs(gem.pos_x.toFloat() + gem.vel_x.toFloat()*frames - radius), 2.0f*span);
+			x = radius + (x > span ? 2.0f*span - x : x);
+
+			// Gems it can't get under and level out for in time are given
+			// up, unless there's nothing else.
+			float move_frames = std::max(std::fabs(x - paddle_x) - DEAD_ZONE, 0.0f) / speed;
+			bool reachable = move_frames == 0.0f || move_frames + LEVEL_FRAMES <= frames;
+			if (have_target && !reachable)
+				continue;
+			if (!have_target || frames < target_frames) {
+				have_target = true;
+				target_frames = frames;
+				target_x = x;
+			}
+		}
+		if (!have_target)
+			return 0;
+
+		int dx = static_cast<int>(target_x) + aim_error - paddle.pos_x.integer();
+		if (dx < -DEAD_ZONE)
+			return INPUT_LEFT;
+		if (dx > DEAD_ZONE)
+			return INPUT_RIGHT;
+		return 0;
+	}
+};
+
+BatchGameResult runGame(uint32_t seed, unsigned int frames, BroadphaseType broadphase) {
+	GameState game_state;
+	initGameState(game_state, seed);
+	StepContext context;
+	context.broadphase.setType(broadphase);
+	ScriptedInput input(seed);
+
+	BatchGameResult result;
+	result.seed = seed;
+	result.peak_gems = 0;
+
+	// The game is over once the last life is lost.
+	auto start_time = std::chrono::high_resolution_clock::now();
+	unsigned int frame = 0;
+	while (frame < frames && game_state.lives > 0) {
+		stepGame(game_state, input.next(game_state), context);
+		result.peak_gems = std::max(result.peak_gems, static_cast<unsigned int>(game_state.gems.size()));
+		++frame;
+	}
+	auto end_time = std::chrono::high_resolution_clock::now();
+
+	result.frames = frame;
+	result.score = game_state.score;
+	result.lives = game_state.lives;
+	result.final_gems = static_cast<unsigned int>(game_state.gems.size());
+	result.final_hash = hashGameState(game_state);
+	result.step_time_ns = frame == 0 ? 0.0 :
+		std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count() / double(frame);
+
+	return result;
+}
+
+template <typename T>
+void printDistribution(const char* name, std::vector<T> values) {
+	if (values.empty())
+		return;
+	std::sort(values.begin(), values.end());
+
+	double sum = 0.0;
+	for (T v : values) {
+		sum += v;
+	}
+
+	size_t last = values.size() - 1;
+	std::cout << name << ": min " << values[0]
+		<< ", p10 " << values[last / 10]
+		<< ", p50 " << values[last / 2]
+		<< ", p90 " << values[last * 9 / 10]
+		<< ", max " << values[last]
+		<< ", mean " << sum / values.size() << "\n";
+}
+
+} // namespace
+
+void runBatch(const BatchConfig& config, std::vector<BatchGameResult>* results) {
+	results->resize(config.game_count);
+
+	ThreadPool pool(config.thread_count);
+	pool.parallelFor(config.game_count, [&](size_t i) {
+		(*results)[i] = runGame(config.first_seed + static_cast<uint32_t>(i), config.frames_per_game, config.broadphase);
+	});
+}
+
+int runBatchCommand(const BatchConfig& config) {
+	std::vector<BatchGameResult> results;
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+	runBatch(config, &results);
+	auto end_time = std::chrono::high_resolution_clock::now();
+
+	double elapsed_s = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count() / 1000000.0;
+	double total_steps = 0.0;
+	for (const BatchGameResult& r : results) {
+		total_steps += r.frames;
+	}
+	unsigned int threads = config.thread_count != 0 ? config.thread_count : std::max(1u, std::thread::hardware_concurrency());
+
+	std::cout << "Ran " << config.game_count << " games of up to " << config.frames_per_game << " frames on "
+		<< threads << " threads in " << elapsed_s << " s";
+	if (elapsed_s > 0.0)
+		std::cout << " (" << total_steps / elapsed_s << " steps/s)";
+	std::cout << "\n";
+
+	std::vector<int> scores, lives;
+	std::vector<unsigned int> final_gems, peak_gems;
+	std::vector<double> lengths, step_times;
+	Hasher batch_hash;
+	for (const BatchGameResult& r : results) {
+		lengths.push_back(r.frames / 60.0);
+		scores.push_back(r.score);
+		lives.push_back(r.lives);
+		final_gems.push_back(r.final_gems);
+		peak_gems.push_back(r.peak_gems);
+		step_times.push_back(r.step_time_ns);
+		batch_hash.add(r.final_hash);
+	}
+
+	printDistribution("Game length (s)", lengths);
+	printDistribution("Score", scores);
+	printDistribution("Lives", lives);
+	printDistribution("Final gems", final_gems);
+	printDistribution("Peak gems", peak_gems);
+	printDistribution("Step time (ns)", step_times);
+	// Independent of thread count; compare between runs to catch behaviour changes.
+	std::cout << "Batch hash: " << std::hex << batch_hash.result() << std::dec << "\n";
+
+	return 0;
+}
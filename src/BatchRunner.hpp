@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "Broadphase.hpp"
+
+struct BatchConfig {
+	unsigned int game_count;
+	unsigned int frames_per_game; // Fewer if the game runs out of lives first
+	uint32_t first_seed; // Game i uses seed first_seed + i
+	unsigned int thread_count; // 0 uses all hardware threads
+	BroadphaseType broadphase;
+
+	BatchConfig()
+		: game_count(1000), frames_per_game(60*60*5), first_seed(1), thread_count(0),
+		broadphase(BROADPHASE_GRID)
+	{ }
+};
+
+struct BatchGameResult {
+	uint32_t seed;
+	unsigned int frames; // Steps until out of lives, or frames_per_game
+	int score;
+	int lives;
+	unsigned int final_gems;
+	unsigned int peak_gems;
+	uint64_t final_hash;
+	double step_time_ns; // Average time per stepGame() call
+};
+
+// Simulates config.game_count independent games headlessly, spread over a
+// thread pool. Each game gets its own seed and a scripted player seeded from
+// it, so results are reproducible regardless of thread count. A game ends
+// when it runs out of lives or frames.
+void runBatch(const BatchConfig& config, std::vector<BatchGameResult>* results);
+// Runs a batch and prints aggregate statistics to stdout.
+int runBatchCommand(const BatchConfig& config);
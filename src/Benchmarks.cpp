@@ -0,0 +1,1515 @@
+#include "Benchmarks.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include "util.hpp"
+#include "Game.hpp"
+#include "Broadphase.hpp"
+#include "Hash.hpp"
+#include "ThreadPool.hpp"
+#include "stb_image.h"
+
+namespace {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+double elapsedNs(Clock::time_point start, Clock::time_point end) {
+	return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// Compares the game's generator against the std::mt19937 +
+// uniform_int_distribution path it replaced.
+int benchmarkRng() {
+	static const int ITERATIONS = 20000000;
+	// Sum the results so the loops can't be optimized out.
+	uint64_t sum_mt = 0, sum_pcg = 0;
+
+	std::mt19937 mt(123);
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < ITERATIONS; ++i) {
+		sum_mt += std::uniform_int_distribution<>(40, 200)(mt);
+	}
+	double mt_ns = elapsedNs(start, Clock::now());
+
+	RandomGenerator pcg(123);
+	start = Clock::now();
+	for (int i = 0; i < ITERATIONS; ++i) {
+		sum_pcg += randRange(pcg, 40, 200);
+	}
+	double pcg_ns = elapsedNs(start, Clock::now());
+
+	// Copies go round a ring of generators that are all read afterwards, so
+	// every copy has to be made. The source steps once per copy, so no two
+	// copies are the same; that step is part of the time.
+	static const int COPIES = ITERATIONS / 100;
+	static const size_t RING_SIZE = 256;
+	std::vector<std::mt19937> mt_ring(RING_SIZE);
+	start = Clock::now();
+	for (int i = 0; i < COPIES; ++i) {
+		mt_ring[i % RING_SIZE] = mt;
+		mt.discard(1);
+	}
+	double mt_copy_ns = elapsedNs(start, Clock::now());
+	for (std::mt19937& copy : mt_ring) {
+		sum_mt += copy();
+	}
+
+	std::vector<RandomGenerator> pcg_ring(RING_SIZE);
+	start = Clock::now();
+	for (int i = 0; i < COPIES; ++i) {
+		pcg_ring[i % RING_SIZE] = pcg;
+		pcg();
+	}
+	double pcg_copy_ns = elapsedNs(start, Clock::now());
+	for (RandomGenerator& copy : pcg_ring) {
+		sum_pcg += copy();
+	}
+
+	std::cout << "std::mt19937 + uniform_int_distribution: " << mt_ns / ITERATIONS << " ns/call, "
+		<< sizeof(std::mt19937) << " bytes of state, " << mt_copy_ns / COPIES << " ns/copy\n";
+	std::cout << "Pcg32::bounded:                          " << pcg_ns / ITERATIONS << " ns/call, "
+		<< sizeof(RandomGenerator) << " bytes of state, " << pcg_copy_ns / COPIES << " ns/copy\n";
+	std::cout << "(checksums " << sum_mt << " " << sum_pcg << ")\n";
+
+	bool ok = true;
+	// advance(n) has to land where n calls would.
+	static const uint64_t ADVANCE_COUNTS[] = {0, 1, 2, 3, 63, 64, 1000, 65537};
+	for (uint64_t count : ADVANCE_COUNTS) {
+		RandomGenerator stepped(123), skipped(123);
+		for (uint64_t i = 0; i < count; ++i) {
+			stepped();
+		}
+		skipped.advance(count);
+		if (stepped != skipped) {
+			std::cout << "MISMATCH: advance(" << count << ") differs from " << count << " calls\n";
+			ok = false;
+		}
+	}
+
+	// split() takes the state and then the stream from the next four
+	// outputs, high half first; for seed 123 those are 151389e3 9230d53f
+	// 0879145c 3a108949. Fixed values, so a compiler that reorders the calls
+	// shows up here.
+	RandomGenerator parent(123);
+	RandomGenerator child = parent.split();
+	RandomGenerator after_four(123);
+	after_four.advance(4);
+	if (child != RandomGenerator(0x151389E39230D53Full, 0x0879145C3A108949ull) || parent != after_four) {
+		std::cout << "MISMATCH: split() doesn't give the known state and stream\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 2;
+}
+
+// Scatters gems over the playfield width at about the density of a settled
+// pile, moving slowly in random directions. With mixed_sizes the gems range
+// from new ones to ones big enough to reach Gem::MAX_RADIUS.
+void makeBenchmarkGems(unsigned int count, RandomGenerator& rng, std::vector<Gem>* gems, bool mixed_sizes = false) {
+	int height = std::max(WINDOW_HEIGHT, static_cast<int>(count * (2*Gem::RADIUS) * (2*Gem::RADIUS) * 3 / 2 / WINDOW_WIDTH));
+
+	gems->resize(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		Gem& gem = (*gems)[i];
+		gem.pos_x = randRange(rng, Gem::RADIUS, WINDOW_WIDTH - Gem::RADIUS);
+		gem.pos_y = randRange(rng, 0, height);
+		gem.vel_x = fixed16_16::raw(randRange(rng, -0x10000, 0x10000));
+		gem.vel_y = fixed16_16::raw(randRange(rng, -0x10000, 0x10000));
+		gem.setScoreValue(mixed_sizes ? randRange(rng, Gem::INITIAL_VALUE, 9 * Gem::INITIAL_VALUE) : Gem::INITIAL_VALUE);
+		gem.rest_frames = 0;
+		gem.id = i;
+	}
+}
+
+void moveBenchmarkGems(std::vector<Gem>* gems) {
+	for (Gem& gem : *gems) {
+		gem.pos_x += fixed24_8(gem.vel_x);
+		gem.pos_y += fixed24_8(gem.vel_y);
+		collideBallWithBoundary(gem);
+	}
+}
+
+int benchmarkBroadphase() {
+	static const unsigned int GEM_COUNTS[] = {100, 1000, 10000, 100000};
+	static const BroadphaseType TYPES[] = {BROADPHASE_BRUTE_FORCE, BROADPHASE_GRID, BROADPHASE_SWEEP_AND_PRUNE};
+	static const unsigned int FRAMES = 20;
+	// Brute force is quadratic; above this it would take minutes.
+	static const unsigned int BRUTE_FORCE_LIMIT = 10000;
+
+	int result = 0;
+	for (int mixed_sizes = 0; mixed_sizes < 2; ++mixed_sizes)
+	for (unsigned int count : GEM_COUNTS) {
+		const char* sizes = mixed_sizes ? " mixed size" : "";
+		RandomGenerator rng(count);
+		std::vector<Gem> initial_gems;
+		makeBenchmarkGems(count, rng, &initial_gems, mixed_sizes != 0);
+
+		std::vector<GemPair> reference_pairs;
+		const char* reference_name = nullptr;
+
+		for (BroadphaseType type : TYPES) {
+			if (type == BROADPHASE_BRUTE_FORCE && count > BRUTE_FORCE_LIMIT) {
+				std::cout << count << sizes << " gems, " << broadphaseTypeName(type) << ": skipped\n";
+				continue;
+			}
+
+			std::vector<Gem> gems = initial_gems;
+			std::vector<GemPair> pairs;
+			Broadphase broadphase(type);
+
+			// The first frame doesn't benefit from temporal coherence.
+			Clock::time_point start = Clock::now();
+			broadphase.findPairs(gems, &pairs);
+			double first_ns = elapsedNs(start, Clock::now());
+
+			double total_ns = 0.0;
+			size_t total_pairs = 0;
+			for (unsigned int frame = 0; frame < FRAMES; ++frame) {
+				moveBenchmarkGems(&gems);
+				start = Clock::now();
+				broadphase.findPairs(gems, &pairs);
+				total_ns += elapsedNs(start, Clock::now());
+				total_pairs += pairs.size();
+			}
+
+			std::cout << count << sizes << " gems, " << broadphaseTypeName(type) << ": "
+				<< total_ns / FRAMES / 1000000.0 << " ms/frame (first frame " << first_ns / 1000000.0 << " ms), "
+				<< total_pairs / FRAMES << " pairs/frame\n";
+
+			if (!reference_name) {
+				reference_pairs = pairs;
+				reference_name = broadphaseTypeName(type);
+			} else if (pairs != reference_pairs) {
+				std::cout << "  MISMATCH: pairs differ from " << reference_name << "\n";
+				result = 2;
+			}
+		}
+	}
+
+	return result;
+}
+
+// Times contact solving in a 10K gem arena, serially and on the thread pool,
+// and checks that both give bit-identical gems.
+int benchmarkNarrowphase() {
+	static const unsigned int GEM_COUNT = 10000;
+	static const unsigned int FRAMES = 20;
+
+	RandomGenerator rng(GEM_COUNT);
+	std::vector<Gem> initial_gems;
+	makeBenchmarkGems(GEM_COUNT, rng, &initial_gems);
+
+	ThreadPool pool;
+	uint64_t hashes[2];
+	for (int parallel = 0; parallel < 2; ++parallel) {
+		std::vector<Gem> gems = initial_gems;
+		StepContext context;
+		if (parallel)
+			context.thread_pool = &pool;
+
+		double total_ns = 0.0;
+		size_t total_pairs = 0, total_batches = 0;
+		for (unsigned int frame = 0; frame < FRAMES; ++frame) {
+			moveBenchmarkGems(&gems);
+			Clock::time_point start = Clock::now();
+			solveGemContacts(gems, context);
+			total_ns += elapsedNs(start, Clock::now());
+			total_pairs += context.pairs.size();
+			total_batches += context.contact_batches.batchCount();
+		}
+		hashes[parallel] = hashBytes(gems.data(), gems.size() * sizeof(Gem), 0);
+
+		std::cout << GEM_COUNT << " gems, " << (parallel ? pool.threadCount() : 1) << " threads: "
+			<< total_ns / FRAMES / 1000000.0 << " ms/frame, " << total_pairs / FRAMES << " pairs in "
+			<< total_batches / FRAMES << " batches/frame\n";
+	}
+
+	if (hashes[0] != hashes[1]) {
+		std::cout << "MISMATCH: parallel result differs from serial\n";
+		return 2;
+	}
+	return 0;
+}
+
+// Times scheduling, cancelling and firing a full wheel of timers spread over
+// the first three levels, cancelling every other one, and checks that only
+// the others fire, each on its own frame. Then checks that cancelling a
+// handle whose node has since been reused for another timer does nothing.
+int benchmarkTimers() {
+	static const int ROUNDS = 2000;
+	static const uint16_t TIMER_TYPE = 1;
+	bool ok = true;
+
+	RandomGenerator rng(ROUNDS);
+	TimerWheel wheel;
+	TimerWheel::Handle handles[TimerWheel::MAX_TIMERS];
+	uint32_t frames[TimerWheel::MAX_TIMERS];
+	double schedule_ns = 0.0, cancel_ns = 0.0, fire_ns = 0.0;
+	uint64_t advanced_frames = 0;
+
+	for (int round = 0; round < ROUNDS && ok; ++round) {
+		wheel.reset(0);
+		for (int i = 0; i < TimerWheel::MAX_TIMERS; ++i) {
+			frames[i] = 1 + rng.bounded(5000);
+		}
+
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < TimerWheel::MAX_TIMERS; ++i) {
+			handles[i] = wheel.schedule(frames[i], TIMER_TYPE, i);
+		}
+		schedule_ns += elapsedNs(start, Clock::now());
+
+		start = Clock::now();
+		for (int i = 1; i < TimerWheel::MAX_TIMERS; i += 2) {
+			ok &= wheel.cancel(handles[i]);
+		}
+		cancel_ns += elapsedNs(start, Clock::now());
+
+		int fired = 0;
+		start = Clock::now();
+		while (wheel.activeCount() > 0) {
+			wheel.advance();
+			TimerEvent timer;
+			while (wheel.popExpired(&timer)) {
+				ok &= timer.param % 2 == 0 && timer.frame == frames[timer.param] && timer.frame == wheel.nextFrame() - 1;
+				++fired;
+			}
+		}
+		fire_ns += elapsedNs(start, Clock::now());
+		advanced_frames += wheel.nextFrame();
+		ok &= fired == TimerWheel::MAX_TIMERS / 2;
+	}
+	if (!ok)
+		std::cout << "MISMATCH: a cancelled timer fired, or a timer fired on the wrong frame\n";
+
+	// A freed node goes to the back of the free list, so it's the last one
+	// handed out again when the wheel fills up.
+	wheel.reset(0);
+	TimerWheel::Handle stale = wheel.schedule(10, TIMER_TYPE, -1);
+	bool stale_ok = wheel.cancel(stale) && !wheel.cancel(stale);
+	TimerWheel::Handle reused = TimerWheel::INVALID_HANDLE;
+	for (int i = 0; i < TimerWheel::MAX_TIMERS; ++i) {
+		reused = wheel.schedule(10, TIMER_TYPE, i);
+	}
+	stale_ok &= (reused & 0xFFFF) == (stale & 0xFFFF) && reused != stale;
+	stale_ok &= !wheel.cancel(stale) && wheel.activeCount() == TimerWheel::MAX_TIMERS;
+
+	// Also once the timer has come due but before it's popped.
+	wheel.reset(0);
+	stale = wheel.schedule(1, TIMER_TYPE, -1);
+	wheel.advance();
+	wheel.advance();
+	TimerEvent timer;
+	stale_ok &= wheel.cancel(stale) && !wheel.popExpired(&timer);
+	if (!stale_ok)
+		std::cout << "MISMATCH: cancelling a stale handle changed the wheel\n";
+
+	static const int TIMERS = ROUNDS * TimerWheel::MAX_TIMERS;
+	std::cout << TimerWheel::MAX_TIMERS << " timers over 5000 frames: " << schedule_ns / TIMERS << " ns/schedule, "
+		<< cancel_ns / (TIMERS / 2) << " ns/cancel, " << fire_ns / (TIMERS / 2) << " ns per timer fired ("
+		<< fire_ns / advanced_frames << " ns/frame advanced)\n";
+
+	return ok && stale_ok ? 0 : 2;
+}
+
+// Times filling the event buffer, and checks that events past its capacity
+// are dropped and counted without disturbing the ones that fit.
+int benchmarkEvents() {
+	static const int ROUNDS = 20000;
+	static const size_t EXTRA = 100;
+	bool ok = true;
+
+	// Sum the results so the loops can't be optimized out.
+	uint64_t sum = 0;
+	GameEventBuffer events;
+	Clock::time_point start = Clock::now();
+	for (int round = 0; round < ROUNDS; ++round) {
+		events.clear();
+		for (size_t i = 0; i < GameEventBuffer::CAPACITY; ++i) {
+			events.add(GameEvent::PADDLE_HIT, static_cast<uint32_t>(i), fixed24_8(0), fixed24_8(0), round);
+		}
+		sum += events[round % GameEventBuffer::CAPACITY].value;
+	}
+	double add_ns = elapsedNs(start, Clock::now());
+
+	events.clear();
+	for (size_t i = 0; i < GameEventBuffer::CAPACITY + EXTRA; ++i) {
+		events.add(GameEvent::GEM_SPAWNED, static_cast<uint32_t>(i), fixed24_8(0), fixed24_8(0), 1);
+	}
+	ok &= events.size() == GameEventBuffer::CAPACITY && events.dropped() == EXTRA;
+	uint32_t expected_id = 0;
+	for (const GameEvent& e : events) {
+		ok &= e.gem_id == expected_id++;
+	}
+	events.clear();
+	ok &= events.empty() && events.dropped() == 0;
+	if (!ok)
+		std::cout << "MISMATCH: overflowing the event buffer kept " << events.size() << " events and dropped "
+			<< events.dropped() << "\n";
+
+	std::cout << GameEventBuffer::CAPACITY << " events per step: " << add_ns / (double(ROUNDS) * GameEventBuffer::CAPACITY)
+		<< " ns/event (checksum " << sum << ")\n";
+
+	return ok ? 0 : 2;
+}
+
+// Runs the wave script alone for a few waves, checking that every gem spawns
+// on its frame and at its x position, and times the steps.
+int benchmarkScripts() {
+	static const int WAVES = 4;
+	static const int WAVE_FRAMES = (WAVE_SIZE - 1) * WAVE_SPACING + WAVE_PAUSE;
+	bool ok = true;
+
+	GameState game_state;
+	StepContext context;
+	initGameState(game_state, 1);
+	// Only the wave script, so every spawn is one of its gems.
+	game_state.timers.reset(0);
+	game_state.timers.schedule(0, TIMER_START_SCRIPT, SCRIPT_GEM_WAVES);
+
+	int spawned = 0;
+	double total_ns = 0.0;
+	for (int frame = 0; frame < WAVES * WAVE_FRAMES; ++frame) {
+		Clock::time_point start = Clock::now();
+		stepGame(game_state, 0, context);
+		total_ns += elapsedNs(start, Clock::now());
+
+		for (const GameEvent& e : context.events) {
+			if (e.type != GameEvent::GEM_SPAWNED)
+				continue;
+			int wave = spawned / WAVE_SIZE, gem = spawned % WAVE_SIZE;
+			int expected_frame = wave * WAVE_FRAMES + gem * WAVE_SPACING;
+			int expected_x = WINDOW_WIDTH * (gem + 1) / (WAVE_SIZE + 1);
+			if (frame != expected_frame || e.pos_x != fixed24_8(expected_x)) {
+				std::cout << "MISMATCH: gem " << spawned << " spawned on frame " << frame << " at x " << e.pos_x.toFloat()
+					<< ", expected frame " << expected_frame << " at x " << expected_x << "\n";
+				ok = false;
+			}
+			++spawned;
+		}
+	}
+	if (spawned != WAVES * WAVE_SIZE) {
+		std::cout << "MISMATCH: " << spawned << " gems spawned, expected " << WAVES * WAVE_SIZE << "\n";
+		ok = false;
+	}
+
+	std::cout << WAVES << " waves of " << WAVE_SIZE << " gems: " << total_ns / (WAVES * WAVE_FRAMES) / 1000.0
+		<< " us/step\n";
+
+	return ok ? 0 : 2;
+}
+
+void appendU32BE(std::vector<uint8_t>& buf, uint32_t v) {
+	buf.push_back(v >> 24);
+	buf.push_back((v >> 16) & 0xFF);
+	buf.push_back((v >> 8) & 0xFF);
+	buf.push_back(v & 0xFF);
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc) {
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+void appendPngChunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data) {
+	appendU32BE(png, static_cast<uint32_t>(data.size()));
+	size_t start = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), data.begin(), data.end());
+	appendU32BE(png, crc32(&png[start], png.size() - start, 0));
+}
+
+int paethPredictor(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+// Filters the rows of 8-bit pixels as in a PNG, using each of the five
+// filters in turn, and prefixes each row with its filter type.
+std::vector<uint8_t> filterBenchmarkImage(const std::vector<uint8_t>& pixels, int width, int height, int channels) {
+	size_t row_size = size_t(width) * channels;
+	std::vector<uint8_t> filtered;
+	filtered.reserve((row_size + 1) * height);
+	for (int y = 0; y < height; ++y) {
+		const uint8_t* row = &pixels[row_size * y];
+		const uint8_t* prior = y > 0 ? row - row_size : nullptr;
+		int filter = y % 5;
+		filtered.push_back(static_cast<uint8_t>(filter));
+		for (size_t k = 0; k < row_size; ++k) {
+			int a = k >= size_t(channels) ? row[k - channels] : 0;
+			int b = prior ? prior[k] : 0;
+			int c = prior && k >= size_t(channels) ? prior[k - channels] : 0;
+			int predicted = 0;
+			switch (filter) {
+			case 1: predicted = a; break;
+			case 2: predicted = b; break;
+			case 3: predicted = (a + b) >> 1; break;
+			case 4: predicted = paethPredictor(a, b, c); break;
+			}
+			filtered.push_back(static_cast<uint8_t>(row[k] - predicted));
+		}
+	}
+	return filtered;
+}
+
+void appendAdler32(std::vector<uint8_t>& zlib, const std::vector<uint8_t>& data) {
+	uint32_t s1 = 1, s2 = 0;
+	for (uint8_t byte : data) {
+		s1 = (s1 + byte) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+	appendU32BE(zlib, (s2 << 16) | s1);
+}
+
+// Wraps data in a zlib stream of uncompressed blocks.
+std::vector<uint8_t> storeZlib(const std::vector<uint8_t>& data) {
+	std::vector<uint8_t> zlib;
+	zlib.push_back(0x78);
+	zlib.push_back(0x01);
+	static const size_t MAX_STORED = 0xFFFF;
+	for (size_t pos = 0; pos < data.size(); pos += MAX_STORED) {
+		size_t len = std::min(MAX_STORED, data.size() - pos);
+		zlib.push_back(pos + len == data.size() ? 1 : 0);
+		zlib.push_back(len & 0xFF);
+		zlib.push_back(uint8_t(len >> 8));
+		zlib.push_back(~len & 0xFF);
+		zlib.push_back(uint8_t(~len >> 8));
+		zlib.insert(zlib.end(), data.begin() + pos, data.begin() + pos + len);
+	}
+	appendAdler32(zlib, data);
+	return zlib;
+}
+
+/** Packs bits into bytes least significant bit first, as DEFLATE does. */
+class BitWriter {
+public:
+	explicit BitWriter(std::vector<uint8_t>* out) : out(out), bits(0), count(0) { }
+
+	void write(uint32_t value, int length) {
+		bits |= uint64_t(value) << count;
+		count += length;
+		while (count >= 8) {
+			out->push_back(static_cast<uint8_t>(bits));
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+
+	// Huffman codes go most significant bit first.
+	void writeCode(uint32_t code, int length) {
+		uint32_t reversed = 0;
+		for (int i = 0; i < length; ++i) {
+			reversed |= ((code >> i) & 1) << (length - 1 - i);
+		}
+		write(reversed, length);
+	}
+
+	void flush() {
+		if (count > 0)
+			out->push_back(static_cast<uint8_t>(bits));
+		bits = 0;
+		count = 0;
+	}
+
+private:
+	std::vector<uint8_t>* out;
+	uint64_t bits;
+	int count;
+};
+
+// Huffman code lengths of at most max_length bits for the given symbol
+// frequencies, 0 for unused symbols. Trees that come out too deep are rebuilt
+// from flattened frequencies until they fit.
+std::vector<uint8_t> huffmanLengths(std::vector<uint32_t> freqs, int max_length) {
+	typedef std::pair<uint64_t, int> Node; // Weight, index
+	std::vector<uint8_t> lengths(freqs.size(), 0);
+	for (;;) {
+		std::priority_queue<Node, std::vector<Node>, std::greater<Node> > queue;
+		std::vector<int> parent(freqs.size(), -1);
+		for (size_t i = 0; i < freqs.size(); ++i) {
+			if (freqs[i])
+				queue.push(Node(freqs[i], static_cast<int>(i)));
+		}
+		if (queue.size() == 1) {
+			lengths[queue.top().second] = 1;
+			return lengths;
+		}
+		while (queue.size() > 1) {
+			Node a = queue.top();
+			queue.pop();
+			Node b = queue.top();
+			queue.pop();
+			int node = static_cast<int>(parent.size());
+			parent.push_back(-1);
+			parent[a.second] = parent[b.second] = node;
+			queue.push(Node(a.first + b.first, node));
+		}
+
+		int longest = 0;
+		for (size_t i = 0; i < freqs.size(); ++i) {
+			int depth = 0;
+			for (int n = static_cast<int>(i); freqs[i] && parent[n] >= 0; n = parent[n]) {
+				++depth;
+			}
+			lengths[i] = static_cast<uint8_t>(depth);
+			longest = std::max(longest, depth);
+		}
+		if (longest <= max_length)
+			return lengths;
+
+		for (uint32_t& f : freqs) {
+			if (f)
+				f = (f + 1) / 2;
+		}
+	}
+}
+
+// Canonical codes for the code lengths, as DEFLATE assigns them.
+std::vector<uint32_t> huffmanCodes(const std::vector<uint8_t>& lengths) {
+	uint32_t count[16] = {0};
+	for (uint8_t length : lengths) {
+		if (length)
+			++count[length];
+	}
+	uint32_t next[16] = {0};
+	uint32_t code = 0;
+	for (int bits = 1; bits < 16; ++bits) {
+		code = (code + count[bits - 1]) << 1;
+		next[bits] = code;
+	}
+	std::vector<uint32_t> codes(lengths.size(), 0);
+	for (size_t i = 0; i < lengths.size(); ++i) {
+		if (lengths[i])
+			codes[i] = next[lengths[i]]++;
+	}
+	return codes;
+}
+
+const uint16_t DEFLATE_LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t DEFLATE_LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DEFLATE_DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t DEFLATE_DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Index of the last base that value reaches.
+template <size_t N>
+int deflateCode(const uint16_t (&bases)[N], int value) {
+	int code = N - 1;
+	while (bases[code] > value) {
+		--code;
+	}
+	return code;
+}
+
+struct Lz77Symbol {
+	uint16_t length; // 0 for a literal
+	uint16_t value;  // The literal, or the match distance
+};
+
+// Greedy LZ77 matching, following hash chains of 3-byte prefixes.
+std::vector<Lz77Symbol> findLz77Symbols(const std::vector<uint8_t>& data) {
+	static const int HASH_BITS = 15;
+	static const int MAX_CHAIN = 16;
+	static const size_t WINDOW = 32768;
+	static const int MAX_MATCH = 258;
+
+	std::vector<int32_t> head(1 << HASH_BITS, -1);
+	std::vector<int32_t> prev(data.size(), -1);
+	auto hashAt = [&](size_t pos) {
+		uint32_t v = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+		return (v * 2654435761u) >> (32 - HASH_BITS);
+	};
+	auto insert = [&](size_t pos) {
+		if (pos + 3 <= data.size()) {
+			uint32_t h = hashAt(pos);
+			prev[pos] = head[h];
+			head[h] = static_cast<int32_t>(pos);
+		}
+	};
+
+	std::vector<Lz77Symbol> symbols;
+	size_t pos = 0;
+	while (pos < data.size()) {
+		int best_length = 0;
+		size_t best_dist = 0;
+		if (pos + 3 <= data.size()) {
+			int max_length = static_cast<int>(std::min<size_t>(MAX_MATCH, data.size() - pos));
+			int32_t candidate = head[hashAt(pos)];
+			for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 && pos - candidate <= WINDOW; ++chain) {
+				int length = 0;
+				while (length < max_length && data[candidate + length] == data[pos + length]) {
+					++length;
+				}
+				if (length > best_length) {
+					best_length = length;
+					best_dist = pos - candidate;
+				}
+				candidate = prev[candidate];
+			}
+		}
+
+		Lz77Symbol symbol;
+		if (best_length >= 3) {
+			symbol.length = static_cast<uint16_t>(best_length);
+			symbol.value = static_cast<uint16_t>(best_dist);
+		} else {
+			best_length = 1;
+			symbol.length = 0;
+			symbol.value = data[pos];
+		}
+		symbols.push_back(symbol);
+		for (int i = 0; i < best_length; ++i) {
+			insert(pos + i);
+		}
+		pos += best_length;
+	}
+	return symbols;
+}
+
+// Compresses data into a zlib stream of dynamic Huffman blocks, the kind
+// PNG encoders produce. Far from the best compression, but it exercises the
+// same decoder paths.
+std::vector<uint8_t> deflateZlib(const std::vector<uint8_t>& data) {
+	static const size_t BLOCK_SYMBOLS = 1 << 16;
+	static const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	std::vector<Lz77Symbol> symbols = findLz77Symbols(data);
+
+	std::vector<uint8_t> zlib;
+	zlib.push_back(0x78);
+	zlib.push_back(0x01);
+	BitWriter writer(&zlib);
+	for (size_t block = 0; block == 0 || block < symbols.size(); block += BLOCK_SYMBOLS) {
+		size_t block_end = std::min(symbols.size(), block + BLOCK_SYMBOLS);
+
+		std::vector<uint32_t> litlen_freqs(286, 0), dist_freqs(30, 0);
+		for (size_t i = block; i < block_end; ++i) {
+			const Lz77Symbol& sym = symbols[i];
+			if (sym.length == 0) {
+				++litlen_freqs[sym.value];
+			} else {
+				++litlen_freqs[257 + deflateCode(DEFLATE_LENGTH_BASE, sym.length)];
+				++dist_freqs[deflateCode(DEFLATE_DIST_BASE, sym.value)];
+			}
+		}
+		litlen_freqs[256] = 1;
+		if (std::count(dist_freqs.begin(), dist_freqs.end(), 0u) == 30)
+			dist_freqs[0] = 1;
+
+		std::vector<uint8_t> litlen_lengths = huffmanLengths(litlen_freqs, 15);
+		std::vector<uint8_t> dist_lengths = huffmanLengths(dist_freqs, 15);
+		std::vector<uint32_t> litlen_codes = huffmanCodes(litlen_lengths);
+		std::vector<uint32_t> dist_codes = huffmanCodes(dist_lengths);
+
+		// The code lengths themselves are written as plain code length
+		// symbols 0-15, without the run-length codes.
+		std::vector<uint8_t> all_lengths(litlen_lengths);
+		all_lengths.insert(all_lengths.end(), dist_lengths.begin(), dist_lengths.end());
+		std::vector<uint32_t> cl_freqs(19, 0);
+		for (uint8_t length : all_lengths) {
+			++cl_freqs[length];
+		}
+		std::vector<uint8_t> cl_lengths = huffmanLengths(cl_freqs, 7);
+		std::vector<uint32_t> cl_codes = huffmanCodes(cl_lengths);
+
+		writer.write(block_end == symbols.size() ? 1 : 0, 1);
+		writer.write(2, 2); // Dynamic Huffman codes
+		writer.write(286 - 257, 5);
+		writer.write(30 - 1, 5);
+		writer.write(19 - 4, 4);
+		for (uint8_t symbol : CODE_LENGTH_ORDER) {
+			writer.write(cl_lengths[symbol], 3);
+		}
+		for (uint8_t length : all_lengths) {
+			writer.writeCode(cl_codes[length], cl_lengths[length]);
+		}
+
+		for (size_t i = block; i < block_end; ++i) {
+			const Lz77Symbol& sym = symbols[i];
+			if (sym.length == 0) {
+				writer.writeCode(litlen_codes[sym.value], litlen_lengths[sym.value]);
+				continue;
+			}
+			int length_code = deflateCode(DEFLATE_LENGTH_BASE, sym.length);
+			writer.writeCode(litlen_codes[257 + length_code], litlen_lengths[257 + length_code]);
+			writer.write(sym.length - DEFLATE_LENGTH_BASE[length_code], DEFLATE_LENGTH_EXTRA[length_code]);
+			int dist_code = deflateCode(DEFLATE_DIST_BASE, sym.value);
+			writer.writeCode(dist_codes[dist_code], dist_lengths[dist_code]);
+			writer.write(sym.value - DEFLATE_DIST_BASE[dist_code], DEFLATE_DIST_EXTRA[dist_code]);
+		}
+		writer.writeCode(litlen_codes[256], litlen_lengths[256]);
+	}
+	writer.flush();
+	appendAdler32(zlib, data);
+	return zlib;
+}
+
+// Wraps a zlib stream of filtered 8-bit RGB or RGBA rows in a PNG.
+std::vector<uint8_t> makeBenchmarkPng(const std::vector<uint8_t>& zlib, int width, int height, int channels) {
+	static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	std::vector<uint8_t> png(SIGNATURE, SIGNATURE + 8);
+	std::vector<uint8_t> header;
+	appendU32BE(header, width);
+	appendU32BE(header, height);
+	header.push_back(8); // Bit depth
+	header.push_back(channels == 4 ? 6 : 2); // RGBA or RGB
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(0); // Not interlaced
+	appendPngChunk(png, "IHDR", header);
+	appendPngChunk(png, "IDAT", zlib);
+	appendPngChunk(png, "IEND", std::vector<uint8_t>());
+	return png;
+}
+
+// Gradients with some noise, so every Paeth predictor gets picked.
+std::vector<uint8_t> makeNoisyImage(RandomGenerator& rng, int width, int height, int channels) {
+	std::vector<uint8_t> pixels(size_t(width) * height * channels);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			for (int c = 0; c < channels; ++c) {
+				pixels[(size_t(y) * width + x) * channels + c] = uint8_t(x * (c + 1) + y * 2 + randRange(rng, 7));
+			}
+		}
+	}
+	return pixels;
+}
+
+// Decodes RGB and RGBA PNGs using every filter with each SIMD level of
+// stb_image, checking that all of them produce exactly the original pixels.
+int benchmarkPngUnfilter() {
+	static const int WIDTH = 1021; // Odd, so rows end in partial SIMD blocks
+	static const int HEIGHT = 1024;
+	static const int ITERATIONS = 10;
+	static const char* const LEVEL_NAMES[] = {"C", "SSE2", "SSSE3"};
+
+	RandomGenerator rng(43);
+	bool all_match = true;
+	for (int channels = 3; channels <= 4; ++channels) {
+		std::vector<uint8_t> pixels = makeNoisyImage(rng, WIDTH, HEIGHT, channels);
+		// Uncompressed, so decoding takes little more than unfiltering.
+		std::vector<uint8_t> png = makeBenchmarkPng(storeZlib(filterBenchmarkImage(pixels, WIDTH, HEIGHT, channels)), WIDTH, HEIGHT, channels);
+
+		for (int req_comp = channels; req_comp <= 4; ++req_comp) {
+			for (int level = 0; level < 3; ++level) {
+				stbi_set_simd_level(level);
+				double best_ns = 0.0;
+				bool match = true;
+				for (int i = 0; i < ITERATIONS; ++i) {
+					int w, h, comp;
+					Clock::time_point start = Clock::now();
+					stbi_uc* data = stbi_load_from_memory(png.data(), static_cast<int>(png.size()), &w, &h, &comp, req_comp);
+					double ns = elapsedNs(start, Clock::now());
+					if (i == 0 || ns < best_ns)
+						best_ns = ns;
+
+					if (data == nullptr || w != WIDTH || h != HEIGHT) {
+						match = false;
+					} else {
+						for (size_t p = 0; p < size_t(WIDTH) * HEIGHT && match; ++p) {
+							match = std::memcmp(&data[p * req_comp], &pixels[p * channels], channels) == 0
+								&& (req_comp == channels || data[p * req_comp + channels] == 255);
+						}
+					}
+					stbi_image_free(data);
+				}
+
+				std::cout << WIDTH << "x" << HEIGHT << ", " << channels << " to " << req_comp << " channels, "
+					<< LEVEL_NAMES[level] << ": " << best_ns / 1000000.0 << " ms" << (match ? "" : " MISMATCH") << "\n";
+				all_match = all_match && match;
+			}
+		}
+	}
+	stbi_set_simd_level(2);
+
+	return all_match ? 0 : 2;
+}
+
+// Inflates PNG-like zlib streams: one of noisy gradients, which is mostly
+// literals, and one of repeated tiles, which is mostly long matches. Each is
+// decoded both with and without stb_image's fast tables.
+int benchmarkInflate() {
+	static const int WIDTH = 1024;
+	static const int HEIGHT = 1024;
+	static const int TILE_SIZE = 32;
+	static const int ITERATIONS = 10;
+
+	RandomGenerator rng(44);
+	std::vector<uint8_t> images[2];
+	images[0] = makeNoisyImage(rng, WIDTH, HEIGHT, 4);
+	std::vector<uint8_t> tiles = makeNoisyImage(rng, TILE_SIZE, TILE_SIZE * 8, 4);
+	images[1].resize(size_t(WIDTH) * HEIGHT * 4);
+	for (int ty = 0; ty < HEIGHT / TILE_SIZE; ++ty) {
+		for (int tx = 0; tx < WIDTH / TILE_SIZE; ++tx) {
+			int tile = randRange(rng, 7);
+			for (int y = 0; y < TILE_SIZE; ++y) {
+				std::memcpy(&images[1][((size_t(ty) * TILE_SIZE + y) * WIDTH + tx * TILE_SIZE) * 4],
+					&tiles[(size_t(tile) * TILE_SIZE + y) * TILE_SIZE * 4], TILE_SIZE * 4);
+			}
+		}
+	}
+	static const char* const IMAGE_NAMES[2] = {"noisy", "tiled"};
+
+	static const char* const PATH_NAMES[2] = {"symbol at a time", "fast tables"};
+
+	bool all_match = true;
+	for (int i = 0; i < 2; ++i) {
+		std::vector<uint8_t> filtered = filterBenchmarkImage(images[i], WIDTH, HEIGHT, 4);
+		std::vector<uint8_t> zlib = deflateZlib(filtered);
+		std::vector<uint8_t> png = makeBenchmarkPng(zlib, WIDTH, HEIGHT, 4);
+		std::cout << IMAGE_NAMES[i] << ": " << zlib.size() / 1024 << " KB to " << filtered.size() / 1024 << " KB\n";
+
+		std::vector<char> out(filtered.size());
+		for (int fast = 0; fast < 2; ++fast) {
+			stbi_set_inflate_fast_tables(fast);
+			double inflate_ns = 0.0, png_ns = 0.0;
+			bool match = true;
+			for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
+				Clock::time_point start = Clock::now();
+				int length = stbi_zlib_decode_buffer(out.data(), static_cast<int>(out.size()),
+					reinterpret_cast<const char*>(zlib.data()), static_cast<int>(zlib.size()));
+				double ns = elapsedNs(start, Clock::now());
+				if (iteration == 0 || ns < inflate_ns)
+					inflate_ns = ns;
+				match = match && length == static_cast<int>(filtered.size())
+					&& std::memcmp(out.data(), filtered.data(), filtered.size()) == 0;
+
+				int w, h, comp;
+				start = Clock::now();
+				stbi_uc* data = stbi_load_from_memory(png.data(), static_cast<int>(png.size()), &w, &h, &comp, 4);
+				ns = elapsedNs(start, Clock::now());
+				if (iteration == 0 || ns < png_ns)
+					png_ns = ns;
+				match = match && data != nullptr && std::memcmp(data, images[i].data(), images[i].size()) == 0;
+				stbi_image_free(data);
+			}
+
+			std::cout << "  " << PATH_NAMES[fast] << ": inflate " << inflate_ns / 1000000.0 << " ms ("
+				<< filtered.size() / (inflate_ns / 1000.0) << " MB/s), whole PNG " << png_ns / 1000000.0 << " ms"
+				<< (match ? "" : " MISMATCH") << "\n";
+			all_match = all_match && match;
+		}
+	}
+	stbi_set_inflate_fast_tables(1);
+
+	return all_match ? 0 : 2;
+}
+
+/** Packs bits into bytes most significant bit first, as JPEG does, stuffing
+    a zero byte after every 0xFF. */
+class JpegBitWriter {
+public:
+	explicit JpegBitWriter(std::vector<uint8_t>* out) : out(out), bits(0), count(0) { }
+
+	void write(uint32_t value, int length) {
+		bits = (bits << length) | (value & ((1u << length) - 1));
+		count += length;
+		while (count >= 8) {
+			count -= 8;
+			uint8_t byte = static_cast<uint8_t>(bits >> count);
+			out->push_back(byte);
+			if (byte == 0xFF)
+				out->push_back(0);
+		}
+	}
+
+	// Pads the last byte with 1 bits.
+	void flush() {
+		if (count > 0)
+			write(0x7F, 8 - count);
+	}
+
+private:
+	std::vector<uint8_t>* out;
+	uint64_t bits;
+	int count;
+};
+
+// Natural (row-major) position of each zigzag index in an 8x8 block.
+const uint8_t JPEG_ZIGZAG[64] = {0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+/** The quantized 8x8 blocks of a 4:2:0 YCbCr image, in natural order. */
+struct JpegBlocks {
+	int width, height;
+	int mcus_x, mcus_y;
+	uint8_t quant[2][64]; // Luma and chroma, natural order
+	std::vector<int16_t> planes[3]; // Y, Cb, Cr; rows of blocks, each 64 coefficients
+
+	JpegBlocks(int width, int height) : width(width), height(height), mcus_x((width + 15) / 16), mcus_y((height + 15) / 16) {
+		planes[0].resize(size_t(mcus_x) * mcus_y * 4 * 64);
+		planes[1].resize(size_t(mcus_x) * mcus_y * 64);
+		planes[2].resize(size_t(mcus_x) * mcus_y * 64);
+	}
+
+	int16_t* block(int plane, int x, int y) {
+		int blocks_x = plane == 0 ? mcus_x * 2 : mcus_x;
+		return &planes[plane][(size_t(y) * blocks_x + x) * 64];
+	}
+};
+
+// Bit length of a coefficient's magnitude, JPEG's "size" category.
+int jpegSize(int value) {
+	int size = 0;
+	for (int v = std::abs(value); v; v >>= 1) {
+		++size;
+	}
+	return size;
+}
+
+struct JpegSymbol {
+	uint8_t table; // DC luma, AC luma, DC chroma, AC chroma
+	uint8_t symbol;
+	uint8_t extra_length;
+	uint16_t extra;
+};
+
+void appendJpegSymbol(std::vector<JpegSymbol>& symbols, int table, int symbol, int value, int size) {
+	JpegSymbol s;
+	s.table = static_cast<uint8_t>(table);
+	s.symbol = static_cast<uint8_t>(symbol);
+	s.extra_length = static_cast<uint8_t>(size);
+	s.extra = static_cast<uint16_t>(value >= 0 ? value : value + (1 << size) - 1);
+	symbols.push_back(s);
+}
+
+// Encodes the blocks as a baseline, interleaved 4:2:0 JPEG with Huffman
+// tables built for them.
+std::vector<uint8_t> encodeJpeg(JpegBlocks& blocks) {
+	std::vector<JpegSymbol> symbols;
+	int dc_pred[3] = {0, 0, 0};
+	for (int my = 0; my < blocks.mcus_y; ++my) {
+		for (int mx = 0; mx < blocks.mcus_x; ++mx) {
+			for (int b = 0; b < 6; ++b) {
+				int plane = b < 4 ? 0 : b - 3;
+				const int16_t* block = plane == 0 ? blocks.block(0, mx * 2 + (b & 1), my * 2 + (b >> 1)) : blocks.block(plane, mx, my);
+				int table = plane == 0 ? 0 : 2;
+				int diff = block[0] - dc_pred[plane];
+				dc_pred[plane] = block[0];
+				appendJpegSymbol(symbols, table, jpegSize(diff), diff, jpegSize(diff));
+				int run = 0;
+				for (int k = 1; k < 64; ++k) {
+					int value = block[JPEG_ZIGZAG[k]];
+					if (value == 0) {
+						++run;
+						continue;
+					}
+					for (; run >= 16; run -= 16) {
+						appendJpegSymbol(symbols, table + 1, 0xF0, 0, 0);
+					}
+					appendJpegSymbol(symbols, table + 1, (run << 4) | jpegSize(value), value, jpegSize(value));
+					run = 0;
+				}
+				if (run > 0)
+					appendJpegSymbol(symbols, table + 1, 0x00, 0, 0);
+			}
+		}
+	}
+
+	// Symbol 256 keeps a code for itself, so no real symbol gets all 1 bits.
+	std::vector<uint8_t> lengths[4];
+	std::vector<uint32_t> codes[4];
+	for (int t = 0; t < 4; ++t) {
+		std::vector<uint32_t> freqs(257, 0);
+		for (const JpegSymbol& s : symbols) {
+			if (s.table == t)
+				++freqs[s.symbol];
+		}
+		freqs[256] = 1;
+		lengths[t] = huffmanLengths(freqs, 15);
+		lengths[t][256] = 0;
+		codes[t] = huffmanCodes(lengths[t]);
+	}
+
+	std::vector<uint8_t> jpeg;
+	auto appendU16 = [&](int v) {
+		jpeg.push_back(static_cast<uint8_t>(v >> 8));
+		jpeg.push_back(static_cast<uint8_t>(v));
+	};
+	appendU16(0xFFD8); // SOI
+
+	appendU16(0xFFDB); // DQT
+	appendU16(2 + 2 * 65);
+	for (int t = 0; t < 2; ++t) {
+		jpeg.push_back(static_cast<uint8_t>(t));
+		for (int k = 0; k < 64; ++k) {
+			jpeg.push_back(blocks.quant[t][JPEG_ZIGZAG[k]]);
+		}
+	}
+
+	appendU16(0xFFC0); // SOF0
+	appendU16(8 + 3 * 3);
+	jpeg.push_back(8);
+	appendU16(blocks.height);
+	appendU16(blocks.width);
+	jpeg.push_back(3);
+	static const uint8_t COMPONENTS[3][3] = {{1, 0x22, 0}, {2, 0x11, 1}, {3, 0x11, 1}};
+	for (int c = 0; c < 3; ++c) {
+		jpeg.insert(jpeg.end(), COMPONENTS[c], COMPONENTS[c] + 3);
+	}
+
+	for (int t = 0; t < 4; ++t) {
+		std::vector<uint8_t> by_length;
+		uint8_t counts[16] = {0};
+		for (int length = 1; length <= 16; ++length) {
+			for (int s = 0; s < 256; ++s) {
+				if (lengths[t][s] == length) {
+					by_length.push_back(static_cast<uint8_t>(s));
+					++counts[length - 1];
+				}
+			}
+		}
+		appendU16(0xFFC4); // DHT
+		appendU16(2 + 1 + 16 + static_cast<int>(by_length.size()));
+		jpeg.push_back(static_cast<uint8_t>(((t & 1) << 4) | (t >> 1)));
+		jpeg.insert(jpeg.end(), counts, counts + 16);
+		jpeg.insert(jpeg.end(), by_length.begin(), by_length.end());
+	}
+
+	appendU16(0xFFDA); // SOS
+	appendU16(6 + 2 * 3);
+	jpeg.push_back(3);
+	static const uint8_t SCAN[3][2] = {{1, 0x00}, {2, 0x11}, {3, 0x11}};
+	for (int c = 0; c < 3; ++c) {
+		jpeg.insert(jpeg.end(), SCAN[c], SCAN[c] + 2);
+	}
+	jpeg.push_back(0);
+	jpeg.push_back(63);
+	jpeg.push_back(0);
+
+	JpegBitWriter writer(&jpeg);
+	for (const JpegSymbol& s : symbols) {
+		writer.write(codes[s.table][s.symbol], lengths[s.table][s.symbol]);
+		if (s.extra_length)
+			writer.write(s.extra, s.extra_length);
+	}
+	writer.flush();
+	appendU16(0xFFD9); // EOI
+	return jpeg;
+}
+
+// Converts RGB pixels to YCbCr, halves the chroma both ways, and runs the
+// forward DCT and quantization. Blocks past the edges repeat the last pixels.
+JpegBlocks makeJpegBlocks(const std::vector<uint8_t>& rgb, int width, int height) {
+	JpegBlocks blocks(width, height);
+	for (int k = 0; k < 64; ++k) {
+		int distance = (k >> 3) + (k & 7);
+		blocks.quant[0][k] = static_cast<uint8_t>(2 + distance * 2);
+		blocks.quant[1][k] = static_cast<uint8_t>(3 + distance * 3);
+	}
+
+	int full_w = blocks.mcus_x * 16, full_h = blocks.mcus_y * 16;
+	std::vector<float> planes[3];
+	for (int c = 0; c < 3; ++c) {
+		planes[c].resize(size_t(full_w) * full_h);
+	}
+	for (int y = 0; y < full_h; ++y) {
+		for (int x = 0; x < full_w; ++x) {
+			const uint8_t* p = &rgb[(size_t(std::min(y, height - 1)) * width + std::min(x, width - 1)) * 3];
+			size_t i = size_t(y) * full_w + x;
+			planes[0][i] = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+			planes[1][i] = -0.1687f * p[0] - 0.3313f * p[1] + 0.5f * p[2] + 128.0f;
+			planes[2][i] = 0.5f * p[0] - 0.4187f * p[1] - 0.0813f * p[2] + 128.0f;
+		}
+	}
+
+	float basis[8][8]; // [x][u]
+	for (int x = 0; x < 8; ++x) {
+		for (int u = 0; u < 8; ++u) {
+			basis[x][u] = (u == 0 ? std::sqrt(0.125f) : 0.5f) * std::cos((2 * x + 1) * u * 3.14159265f / 16);
+		}
+	}
+	for (int plane = 0; plane < 3; ++plane) {
+		int scale = plane == 0 ? 1 : 2;
+		int blocks_x = full_w / 8 / scale, blocks_y = full_h / 8 / scale;
+		for (int by = 0; by < blocks_y; ++by) {
+			for (int bx = 0; bx < blocks_x; ++bx) {
+				float samples[8][8], rows[8][8];
+				for (int y = 0; y < 8; ++y) {
+					for (int x = 0; x < 8; ++x) {
+						float sum = 0.0f;
+						for (int sy = 0; sy < scale; ++sy) {
+							for (int sx = 0; sx < scale; ++sx) {
+								sum += planes[plane][size_t((by * 8 + y) * scale + sy) * full_w + (bx * 8 + x) * scale + sx];
+							}
+						}
+						samples[y][x] = sum / (scale * scale) - 128.0f;
+					}
+				}
+				for (int y = 0; y < 8; ++y) {
+					for (int u = 0; u < 8; ++u) {
+						rows[y][u] = 0.0f;
+						for (int x = 0; x < 8; ++x) {
+							rows[y][u] += samples[y][x] * basis[x][u];
+						}
+					}
+				}
+				int16_t* block = blocks.block(plane, bx, by);
+				const uint8_t* quant = blocks.quant[plane == 0 ? 0 : 1];
+				for (int v = 0; v < 8; ++v) {
+					for (int u = 0; u < 8; ++u) {
+						float coefficient = 0.0f;
+						for (int y = 0; y < 8; ++y) {
+							coefficient += rows[y][u] * basis[y][v];
+						}
+						block[v * 8 + u] = static_cast<int16_t>(std::floor(coefficient / quant[v * 8 + u] + 0.5f));
+					}
+				}
+			}
+		}
+	}
+	return blocks;
+}
+
+// Blocks no encoder would make, quantized by 255 everywhere: a third with
+// coefficients whose dequantized values don't fit in 16 bits, a third whose
+// column pass overflows 16 bits, and a third that stays in range. Kept small
+// enough that the C IDCT's 32 bits don't overflow.
+JpegBlocks makeOutOfRangeJpegBlocks(RandomGenerator& rng, int width, int height) {
+	JpegBlocks blocks(width, height);
+	std::fill(blocks.quant[0], blocks.quant[0] + 64, 255);
+	std::fill(blocks.quant[1], blocks.quant[1] + 64, 255);
+	for (std::vector<int16_t>& plane : blocks.planes) {
+		for (size_t b = 0; b < plane.size(); b += 64) {
+			int16_t* block = &plane[b];
+			int sign = randBool(rng) ? 1 : -1;
+			switch (randRange(rng, 2)) {
+			case 0:
+				block[0] = static_cast<int16_t>(sign * randRange(rng, 129, 140));
+				block[randBool(rng) ? 1 : 8] = static_cast<int16_t>(randRange(rng, -140, 140));
+				break;
+			case 1:
+				block[0] = static_cast<int16_t>(sign * randRange(rng, 100, 128));
+				break;
+			default:
+				for (int k = 0; k < 64; ++k) {
+					block[k] = static_cast<int16_t>(randRange(rng, -15, 15));
+				}
+				break;
+			}
+		}
+	}
+	return blocks;
+}
+
+// Smooth gradients and rings with a little noise, something like a photo.
+std::vector<uint8_t> makePhotoImage(RandomGenerator& rng, int width, int height) {
+	std::vector<uint8_t> pixels(size_t(width) * height * 3);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float dx = x - width * 0.4f, dy = y - height * 0.6f;
+			float ring = std::sin(std::sqrt(dx * dx + dy * dy) * 0.05f);
+			uint8_t* p = &pixels[(size_t(y) * width + x) * 3];
+			p[0] = static_cast<uint8_t>(std::min(255, std::max(0, int(128 + 100 * ring) + randRange(rng, -6, 6))));
+			p[1] = static_cast<uint8_t>(std::min(255, std::max(0, x * 200 / width + randRange(rng, -6, 6))));
+			p[2] = static_cast<uint8_t>(std::min(255, std::max(0, y * 200 / height + int(40 * ring) + randRange(rng, -6, 6))));
+		}
+	}
+	return pixels;
+}
+
+// Decodes baseline 4:2:0 JPEGs with each SIMD level of stb_image, checking
+// that the IDCT, upsampling and color conversion give the same bytes at all
+// of them.
+int benchmarkJpeg() {
+	static const int ITERATIONS = 10;
+	static const char* const LEVEL_NAMES[] = {"C", "SSE2"};
+
+	RandomGenerator rng(45);
+	struct Image {
+		const char* name;
+		int width, height;
+		std::vector<uint8_t> jpeg;
+	} images[3] = {
+		{"photo", 1024, 768, std::vector<uint8_t>()},
+		{"odd-sized photo", 1021, 767, std::vector<uint8_t>()}, // Rows end in partial SIMD blocks
+		{"out-of-range blocks", 256, 256, std::vector<uint8_t>()},
+	};
+	for (int i = 0; i < 2; ++i) {
+		JpegBlocks blocks = makeJpegBlocks(makePhotoImage(rng, images[i].width, images[i].height), images[i].width, images[i].height);
+		images[i].jpeg = encodeJpeg(blocks);
+	}
+	JpegBlocks blocks = makeOutOfRangeJpegBlocks(rng, images[2].width, images[2].height);
+	images[2].jpeg = encodeJpeg(blocks);
+
+	bool all_match = true;
+	for (const Image& image : images) {
+		for (int req_comp = 3; req_comp <= 4; ++req_comp) {
+			std::vector<uint8_t> reference;
+			for (int level = 0; level < 2; ++level) {
+				stbi_set_simd_level(level);
+				double best_ns = 0.0;
+				bool match = true;
+				for (int i = 0; i < ITERATIONS; ++i) {
+					int w, h, comp;
+					Clock::time_point start = Clock::now();
+					stbi_uc* data = stbi_load_from_memory(image.jpeg.data(), static_cast<int>(image.jpeg.size()), &w, &h, &comp, req_comp);
+					double ns = elapsedNs(start, Clock::now());
+					if (i == 0 || ns < best_ns)
+						best_ns = ns;
+
+					size_t size = size_t(image.width) * image.height * req_comp;
+					if (data == nullptr || w != image.width || h != image.height) {
+						match = false;
+					} else if (reference.empty()) {
+						reference.assign(data, data + size);
+					} else {
+						match = match && std::memcmp(data, reference.data(), size) == 0;
+					}
+					stbi_image_free(data);
+				}
+
+				std::cout << image.name << ", " << image.width << "x" << image.height << " to " << req_comp << " channels, "
+					<< LEVEL_NAMES[level] << ": " << best_ns / 1000000.0 << " ms" << (match ? "" : " MISMATCH") << "\n";
+				all_match = all_match && match;
+			}
+		}
+	}
+	stbi_set_simd_level(2);
+
+	return all_match ? 0 : 2;
+}
+
+/** Packs LZW codes into bytes least significant bit first, as GIF does. */
+class GifBitWriter {
+public:
+	explicit GifBitWriter(std::vector<uint8_t>* out) : out(out), bits(0), count(0) { }
+
+	void write(uint32_t code, int length) {
+		bits |= code << count;
+		count += length;
+		while (count >= 8) {
+			out->push_back(static_cast<uint8_t>(bits));
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+
+	void flush() {
+		if (count > 0)
+			write(0, 8 - count);
+	}
+
+private:
+	std::vector<uint8_t>* out;
+	uint32_t bits;
+	int count;
+};
+
+// Compresses 8-bit palette indices with GIF's variant of LZW, starting over
+// with a clear code whenever the 4096 code table fills up.
+std::vector<uint8_t> compressGifLzw(const std::vector<uint8_t>& indices) {
+	static const int CLEAR_CODE = 256;
+	static const int END_CODE = 257;
+	static const int MAX_CODES = 4096;
+
+	std::vector<uint8_t> codes;
+	GifBitWriter writer(&codes);
+	// (prefix code << 8 | next index) to the code for that string.
+	std::unordered_map<uint32_t, int> table;
+	int code_size = 9;
+	int next_code = END_CODE + 1;
+
+	writer.write(CLEAR_CODE, code_size);
+	int prefix = indices[0];
+	for (size_t i = 1; i < indices.size(); ++i) {
+		uint32_t key = uint32_t(prefix) << 8 | indices[i];
+		auto found = table.find(key);
+		if (found != table.end()) {
+			prefix = found->second;
+			continue;
+		}
+		writer.write(prefix, code_size);
+		if (next_code < MAX_CODES) {
+			table[key] = next_code++;
+			// The decoder adds each code one code later, so it widens then.
+			if (next_code > (1 << code_size) && code_size < 12)
+				++code_size;
+		} else {
+			writer.write(CLEAR_CODE, code_size);
+			table.clear();
+			code_size = 9;
+			next_code = END_CODE + 1;
+		}
+		prefix = indices[i];
+	}
+	writer.write(prefix, code_size);
+	writer.write(END_CODE, code_size);
+	writer.flush();
+	return codes;
+}
+
+// Makes a GIF of full-size frames of 8-bit indices into one 256 color
+// palette, each shown for 'delay' hundredths of a second.
+std::vector<uint8_t> makeBenchmarkGif(const std::vector<std::vector<uint8_t>>& frames, const std::vector<uint8_t>& palette, int width, int height, int delay) {
+	static const char SIGNATURE[6] = {'G', 'I', 'F', '8', '9', 'a'};
+	std::vector<uint8_t> gif(SIGNATURE, SIGNATURE + 6);
+	auto appendU16LE = [&gif](int v) {
+		gif.push_back(v & 0xFF);
+		gif.push_back((v >> 8) & 0xFF);
+	};
+	appendU16LE(width);
+	appendU16LE(height);
+	gif.push_back(0xF7); // Global color table of 256 entries
+	gif.push_back(0); // Background color
+	gif.push_back(0); // Aspect ratio
+	gif.insert(gif.end(), palette.begin(), palette.end());
+
+	for (const std::vector<uint8_t>& frame : frames) {
+		// Graphic control extension: keep the frame, no transparency.
+		gif.push_back(0x21);
+		gif.push_back(0xF9);
+		gif.push_back(4);
+		gif.push_back(1 << 2);
+		appendU16LE(delay);
+		gif.push_back(0);
+		gif.push_back(0);
+
+		gif.push_back(0x2C);
+		appendU16LE(0);
+		appendU16LE(0);
+		appendU16LE(width);
+		appendU16LE(height);
+		gif.push_back(0); // No local color table, not interlaced
+		gif.push_back(8); // LZW minimum code size
+		std::vector<uint8_t> codes = compressGifLzw(frame);
+		for (size_t i = 0; i < codes.size(); i += 255) {
+			size_t length = std::min<size_t>(255, codes.size() - i);
+			gif.push_back(static_cast<uint8_t>(length));
+			gif.insert(gif.end(), codes.begin() + i, codes.begin() + i + length);
+		}
+		gif.push_back(0);
+	}
+	gif.push_back(0x3B);
+	return gif;
+}
+
+// Decodes animated GIFs through the frame iterator: one of noise, which is
+// mostly short codes, and one of flat runs, which is mostly long strings.
+// Each is decoded both with and without stb_image's direct string writes.
+int benchmarkGif() {
+	static const int WIDTH = 512;
+	static const int HEIGHT = 512;
+	static const int FRAMES = 8;
+	static const int DELAY = 4;
+	static const int ITERATIONS = 5;
+	static const char* const IMAGE_NAMES[2] = {"noisy", "flat"};
+	static const char* const WRITER_NAMES[2] = {"pixel at a time", "direct strings"};
+
+	RandomGenerator rng(46);
+	std::vector<uint8_t> palette(256 * 3);
+	for (uint8_t& c : palette)
+		c = static_cast<uint8_t>(randRange(rng, 255));
+
+	bool all_match = true;
+	for (int image = 0; image < 2; ++image) {
+		std::vector<std::vector<uint8_t>> frames(FRAMES, std::vector<uint8_t>(size_t(WIDTH) * HEIGHT));
+		for (std::vector<uint8_t>& frame : frames) {
+			if (image == 0) {
+				for (uint8_t& index : frame)
+					index = static_cast<uint8_t>(randRange(rng, 255));
+			} else {
+				for (size_t i = 0; i < frame.size(); ) {
+					size_t run = std::min<size_t>(randRange(rng, 200) + 1, frame.size() - i);
+					std::fill(frame.begin() + i, frame.begin() + i + run, static_cast<uint8_t>(randRange(rng, 255)));
+					i += run;
+				}
+			}
+		}
+		std::vector<uint8_t> gif = makeBenchmarkGif(frames, palette, WIDTH, HEIGHT, DELAY);
+
+		std::cout << IMAGE_NAMES[image] << ": " << FRAMES << " frames of " << WIDTH << "x" << HEIGHT << ", " << gif.size() / 1024 << " KB\n";
+
+		for (int direct = 0; direct < 2; ++direct) {
+			stbi_set_gif_direct_strings(direct);
+			double best_ns = 0.0;
+			bool match = true;
+			for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
+				int w = 0, h = 0, count = 0;
+				Clock::time_point start = Clock::now();
+				stbi_gif_frames* iterator = stbi_gif_frames_from_memory(nullptr, gif.data(), static_cast<int>(gif.size()), &w, &h);
+				const stbi_uc* pixels;
+				int delay, result;
+				while (iterator != nullptr && (result = stbi_gif_next_frame(iterator, &pixels, &delay)) > 0) {
+					const std::vector<uint8_t>& frame = frames[std::min(count, FRAMES - 1)];
+					for (size_t p = 0; p < frame.size() && match; ++p) {
+						match = std::memcmp(&pixels[p * 4], &palette[frame[p] * 3], 3) == 0 && pixels[p * 4 + 3] == 255;
+					}
+					match = match && delay == DELAY;
+					++count;
+				}
+				double ns = elapsedNs(start, Clock::now());
+				if (iteration == 0 || ns < best_ns)
+					best_ns = ns;
+				match = match && iterator != nullptr && result == 0 && count == FRAMES && w == WIDTH && h == HEIGHT;
+				if (iterator != nullptr)
+					stbi_gif_frames_free(iterator);
+			}
+
+			size_t pixel_count = size_t(WIDTH) * HEIGHT * FRAMES;
+			std::cout << "  " << WRITER_NAMES[direct] << ": " << best_ns / 1000000.0 << " ms ("
+				<< pixel_count / (best_ns / 1000.0) << " Mpixels/s)" << (match ? "" : " MISMATCH") << "\n";
+			all_match = all_match && match;
+		}
+	}
+	stbi_set_gif_direct_strings(1);
+
+	return all_match ? 0 : 2;
+}
+
+struct Benchmark {
+	const char* name;
+	int (*run)();
+};
+
+const Benchmark benchmarks[] = {
+	{"rng", benchmarkRng},
+	{"broadphase", benchmarkBroadphase},
+	{"narrowphase", benchmarkNarrowphase},
+	{"timers", benchmarkTimers},
+	{"scripts", benchmarkScripts},
+	{"events", benchmarkEvents},
+	{"pngunfilter", benchmarkPngUnfilter},
+	{"inflate", benchmarkInflate},
+	{"jpeg", benchmarkJpeg},
+	{"gif", benchmarkGif},
+};
+
+} // namespace
+
+int runBenchmark(const char* name) {
+	for (const Benchmark& b : benchmarks) {
+		if (std::strcmp(b.name, name) == 0)
+			return b.run();
+	}
+
+	std::cerr << "Unknown benchmark \"" << name << "\". Available:";
+	for (const Benchmark& b : benchmarks) {
+		std::cerr << " " << b.name;
+	}
+	std::cerr << "\n";
+	return 1;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Runs the named micro-benchmark and prints its results to stdout. Returns a
+// process exit code, non-zero if the name is unknown or a check failed.
+int runBenchmark(const char* name);
@@ -0,0 +1,373 @@
+#include "Broadphase.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "Game.hpp"
+
+// Extra contact distance in 24.8 fixed point.
+static const int32_t CONTACT_MARGIN_RAW = Broadphase::CONTACT_MARGIN << 8;
+
+namespace {
+
+// Contact test for when all gems have the same radius, which saves looking
+// up radii for every pair. Agrees exactly with MixedContactTest.
+struct UniformContactTest {
+	int64_t distance_sqr;
+
+	explicit UniformContactTest(int32_t radius) {
+		int64_t distance = 2 * int64_t(radius) + CONTACT_MARGIN_RAW;
+		distance_sqr = distance * distance;
+	}
+
+	bool operator ()(const Gem& a, const Gem& b) const {
+		int64_t dx = a.pos_x.value - b.pos_x.value;
+		int64_t dy = a.pos_y.value - b.pos_y.value;
+		return dx*dx + dy*dy < distance_sqr;
+	}
+};
+
+struct MixedContactTest {
+	bool operator ()(const Gem& a, const Gem& b) const {
+		int64_t distance = int64_t(a.radius.value) + b.radius.value + CONTACT_MARGIN_RAW;
+		int64_t dx = a.pos_x.value - b.pos_x.value;
+		int64_t dy = a.pos_y.value - b.pos_y.value;
+		return dx*dx + dy*dy < distance * distance;
+	}
+};
+
+} // namespace
+
+static GemPair makePair(uint32_t i, uint32_t j) {
+	GemPair p;
+	p.a = std::min(i, j);
+	p.b = std::max(i, j);
+	return p;
+}
+
+bool parseBroadphaseType(const char* name, BroadphaseType* out) {
+	if (std::strcmp(name, "brute") == 0) {
+		*out = BROADPHASE_BRUTE_FORCE;
+	} else if (std::strcmp(name, "grid") == 0) {
+		*out = BROADPHASE_GRID;
+	} else if (std::strcmp(name, "sap") == 0) {
+		*out = BROADPHASE_SWEEP_AND_PRUNE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+const char* broadphaseTypeName(BroadphaseType type) {
+	switch (type) {
+	case BROADPHASE_BRUTE_FORCE: return "brute";
+	case BROADPHASE_GRID: return "grid";
+	case BROADPHASE_SWEEP_AND_PRUNE: return "sap";
+	}
+	return "?";
+}
+
+Broadphase::Broadphase(BroadphaseType type)
+	: type(type), sap_axis(0)
+{ }
+
+void Broadphase::setType(BroadphaseType new_type) {
+	type = new_type;
+	sap_order.clear();
+}
+
+void Broadphase::findPairs(const std::vector<Gem>& gems, std::vector<GemPair>* pairs) {
+	pairs->clear();
+
+	int32_t min_radius = 0, max_radius = 0;
+	if (!gems.empty()) {
+		min_radius = max_radius = gems[0].radius.value;
+		for (const Gem& gem : gems) {
+			min_radius = std::min(min_radius, gem.radius.value);
+			max_radius = std::max(max_radius, gem.radius.value);
+		}
+	}
+	bool uniform = min_radius == max_radius;
+
+	switch (type) {
+	case BROADPHASE_BRUTE_FORCE:
+		if (uniform)
+			findPairsBruteForce(gems, UniformContactTest(max_radius), pairs);
+		else
+			findPairsBruteForce(gems, MixedContactTest(), pairs);
+		break;
+	case BROADPHASE_GRID:
+		if (uniform)
+			findPairsGrid(gems, UniformContactTest(max_radius), 2 * max_radius + CONTACT_MARGIN_RAW, pairs);
+		else
+			findPairsLayeredGrid(gems, pairs);
+		std::sort(pairs->begin(), pairs->end());
+		break;
+	case BROADPHASE_SWEEP_AND_PRUNE:
+		if (uniform)
+			findPairsSweepAndPrune(gems, UniformContactTest(max_radius), max_radius, pairs);
+		else
+			findPairsSweepAndPrune(gems, MixedContactTest(), max_radius, pairs);
+		std::sort(pairs->begin(), pairs->end());
+		break;
+	}
+}
+
+template <typename ContactTest>
+void Broadphase::findPairsBruteForce(const std::vector<Gem>& gems, const ContactTest& in_contact_range, std::vector<GemPair>* pairs) {
+	uint32_t n = static_cast<uint32_t>(gems.size());
+	for (uint32_t i = 0; i < n; ++i) {
+		for (uint32_t j = i + 1; j < n; ++j) {
+			if (in_contact_range(gems[i], gems[j]))
+				pairs->push_back(makePair(i, j));
+		}
+	}
+}
+
+// Floor division, so cells don't get merged around 0.
+static int32_t cellCoord(int32_t pos, int32_t cell_size) {
+	return pos >= 0 ? pos / cell_size : -((-pos - 1) / cell_size) - 1;
+}
+
+// Packs a grid level and cell coordinates so that keys sort by level, then
+// row, then column. Coordinates get 28 bits each, which covers the whole
+// 24.8 position range even for the smallest cells.
+static const int CELL_COORD_BITS = 28;
+static const int32_t CELL_COORD_BIAS = 1 << (CELL_COORD_BITS - 1);
+static const uint64_t CELL_COORD_MASK = (uint64_t(1) << CELL_COORD_BITS) - 1;
+
+static uint64_t cellKey(int level, int32_t cx, int32_t cy) {
+	return (uint64_t(level) << (2 * CELL_COORD_BITS))
+		| ((uint64_t(cy + CELL_COORD_BIAS) & CELL_COORD_MASK) << CELL_COORD_BITS)
+		| (uint64_t(cx + CELL_COORD_BIAS) & CELL_COORD_MASK);
+}
+
+static int cellLevel(uint64_t key) {
+	return static_cast<int>(key >> (2 * CELL_COORD_BITS));
+}
+
+static int32_t cellX(uint64_t key) {
+	return static_cast<int32_t>(key & CELL_COORD_MASK) - CELL_COORD_BIAS;
+}
+
+static int32_t cellY(uint64_t key) {
+	return static_cast<int32_t>((key >> CELL_COORD_BITS) & CELL_COORD_MASK) - CELL_COORD_BIAS;
+}
+
+static_assert((Gem::RADIUS << (Broadphase::GRID_LEVELS - 1)) >= Gem::MAX_RADIUS, "Grid levels don't cover the largest gems");
+
+int Broadphase::gridLevel(int32_t radius) {
+	int level = 0;
+	while (level + 1 < GRID_LEVELS && radius > (Gem::RADIUS << level << 8))
+		++level;
+	return level;
+}
+
+int32_t Broadphase::gridCellSize(int level) {
+	// Fits the contact distance of the largest gems in the level.
+	return 2 * (Gem::RADIUS << level << 8) + CONTACT_MARGIN_RAW;
+}
+
+void Broadphase::buildGridCells() {
+	std::sort(grid_entries.begin(), grid_entries.end());
+
+	grid_cells.clear();
+	for (uint32_t i = 0; i < grid_entries.size(); ) {
+		GridCell cell;
+		cell.key = grid_entries[i].cell;
+		cell.begin = i;
+		while (i < grid_entries.size() && grid_entries[i].cell == cell.key)
+			++i;
+		cell.end = i;
+		grid_cells.push_back(cell);
+	}
+}
+
+const Broadphase::GridCell* Broadphase::findGridCell(uint64_t key) const {
+	GridCell probe;
+	probe.key = key;
+	auto cell = std::lower_bound(grid_cells.begin(), grid_cells.end(), probe,
+		[](const GridCell& l, const GridCell& r) { return l.key < r.key; });
+	if (cell == grid_cells.end() || cell->key != key)
+		return nullptr;
+	return &*cell;
+}
+
+template <typename ContactTest>
+void Broadphase::findPairsInGridLevels(const std::vector<Gem>& gems, const ContactTest& in_contact_range, std::vector<GemPair>* pairs) {
+	for (const GridCell& cell : grid_cells) {
+		for (uint32_t i = cell.begin; i < cell.end; ++i) {
+			for (uint32_t j = i + 1; j < cell.end; ++j) {
+				uint32_t a = grid_entries[i].gem, b = grid_entries[j].gem;
+				if (in_contact_range(gems[a], gems[b]))
+					pairs->push_back(makePair(a, b));
+			}
+		}
+
+		// Visit half of the neighbours so that every pair of cells is only
+		// checked once: right, and the three cells in the next row.
+		int level = cellLevel(cell.key);
+		int32_t cx = cellX(cell.key);
+		int32_t cy = cellY(cell.key);
+		const uint64_t neighbours[4] = {
+			cellKey(level, cx + 1, cy),
+			cellKey(level, cx - 1, cy + 1),
+			cellKey(level, cx,     cy + 1),
+			cellKey(level, cx + 1, cy + 1),
+		};
+
+		for (uint64_t key : neighbours) {
+			const GridCell* other = findGridCell(key);
+			if (!other)
+				continue;
+
+			for (uint32_t i = cell.begin; i < cell.end; ++i) {
+				for (uint32_t j = other->begin; j < other->end; ++j) {
+					uint32_t a = grid_entries[i].gem, b = grid_entries[j].gem;
+					if (in_contact_range(gems[a], gems[b]))
+						pairs->push_back(makePair(a, b));
+				}
+			}
+		}
+	}
+}
+
+template <typename ContactTest>
+void Broadphase::findPairsGrid(const std::vector<Gem>& gems, const ContactTest& in_contact_range, int32_t cell_size, std::vector<GemPair>* pairs) {
+	// Sparse grid with cells as wide as the contact distance: bucket gems by
+	// sorting them on cell key, then only compare gems in neighbouring cells.
+	grid_entries.resize(gems.size());
+	for (uint32_t i = 0; i < gems.size(); ++i) {
+		grid_entries[i].cell = cellKey(0, cellCoord(gems[i].pos_x.value, cell_size), cellCoord(gems[i].pos_y.value, cell_size));
+		grid_entries[i].gem = i;
+	}
+	buildGridCells();
+
+	findPairsInGridLevels(gems, in_contact_range, pairs);
+}
+
+void Broadphase::findPairsLayeredGrid(const std::vector<Gem>& gems, std::vector<GemPair>* pairs) {
+	// One grid per size class, each with cells fitting its largest gems, so
+	// small gems aren't compared against a whole big cell's worth of others.
+	// All levels share one sorted entry list, told apart by the key's level.
+	bool level_used[GRID_LEVELS] = {false};
+	grid_entries.resize(gems.size());
+	for (uint32_t i = 0; i < gems.size(); ++i) {
+		int level = gridLevel(gems[i].radius.value);
+		int32_t cell_size = gridCellSize(level);
+		grid_entries[i].cell = cellKey(level, cellCoord(gems[i].pos_x.value, cell_size), cellCoord(gems[i].pos_y.value, cell_size));
+		grid_entries[i].gem = i;
+		level_used[level] = true;
+	}
+	buildGridCells();
+
+	MixedContactTest in_contact_range;
+	findPairsInGridLevels(gems, in_contact_range, pairs);
+
+	// Pairs between levels: look each gem up in the 3x3 neighbourhood of
+	// every larger level. The larger level's cells fit the contact distance
+	// of its own gems, so they fit that of a pair with a smaller gem too.
+	for (const GridCell& cell : grid_cells) {
+		int level = cellLevel(cell.key);
+
+		for (int upper = level + 1; upper < GRID_LEVELS; ++upper) {
+			if (!level_used[upper])
+				continue;
+			int32_t cell_size = gridCellSize(upper);
+
+			for (uint32_t i = cell.begin; i < cell.end; ++i) {
+				uint32_t a = grid_entries[i].gem;
+				int32_t cx = cellCoord(gems[a].pos_x.value, cell_size);
+				int32_t cy = cellCoord(gems[a].pos_y.value, cell_size);
+
+				for (int32_t y = cy - 1; y <= cy + 1; ++y) {
+					for (int32_t x = cx - 1; x <= cx + 1; ++x) {
+						const GridCell* other = findGridCell(cellKey(upper, x, y));
+						if (!other)
+							continue;
+
+						for (uint32_t j = other->begin; j < other->end; ++j) {
+							uint32_t b = grid_entries[j].gem;
+							if (in_contact_range(gems[a], gems[b]))
+								pairs->push_back(makePair(a, b));
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+template <typename ContactTest>
+void Broadphase::findPairsSweepAndPrune(const std::vector<Gem>& gems, const ContactTest& in_contact_range, int32_t max_radius, std::vector<GemPair>* pairs) {
+	uint32_t n = static_cast<uint32_t>(gems.size());
+
+	// Gems get added and removed between frames, shifting indices. Dropping
+	// out-of-range entries from a permutation of [0, m) always leaves a
+	// permutation of [0, n), so the old order stays a valid (if slightly
+	// off) starting point for the sort.
+	if (sap_order.size() != n) {
+		sap_order.erase(std::remove_if(sap_order.begin(), sap_order.end(),
+			[n](const SapEntry& e) { return e.gem >= n; }), sap_order.end());
+		for (uint32_t i = static_cast<uint32_t>(sap_order.size()); i < n; ++i) {
+			SapEntry e = {0, i};
+			sap_order.push_back(e);
+		}
+	}
+
+	// Sweeping along x is hopeless in a tall, narrow pile where most gems
+	// overlap horizontally, so sweep along whichever axis the gems are spread
+	// out the most. Only switch on a clear difference, since switching loses
+	// the previous order.
+	if (n > 0) {
+		int32_t min_x = gems[0].pos_x.value, max_x = min_x;
+		int32_t min_y = gems[0].pos_y.value, max_y = min_y;
+		for (const Gem& gem : gems) {
+			min_x = std::min(min_x, gem.pos_x.value);
+			max_x = std::max(max_x, gem.pos_x.value);
+			min_y = std::min(min_y, gem.pos_y.value);
+			max_y = std::max(max_y, gem.pos_y.value);
+		}
+		int64_t extent_x = int64_t(max_x) - min_x, extent_y = int64_t(max_y) - min_y;
+		if (sap_axis == 0 && extent_y > 2 * extent_x) {
+			sap_axis = 1;
+		} else if (sap_axis == 1 && extent_x > 2 * extent_y) {
+			sap_axis = 0;
+		}
+	}
+
+	for (SapEntry& e : sap_order) {
+		e.key = sap_axis == 0 ? gems[e.gem].pos_x.value : gems[e.gem].pos_y.value;
+	}
+
+	// Insertion sort, nearly linear since the order barely changes. If the
+	// order turns out to be far off (first frame, or lots of new gems) give up
+	// on it before it goes quadratic and sort from scratch.
+	size_t move_budget = 8 * size_t(n) + 64;
+	for (uint32_t i = 1; i < n; ++i) {
+		SapEntry e = sap_order[i];
+		uint32_t j = i;
+		while (j > 0 && sap_order[j - 1].key > e.key) {
+			sap_order[j] = sap_order[j - 1];
+			--j;
+		}
+		sap_order[j] = e;
+
+		move_budget -= std::min(move_budget, size_t(i - j));
+		if (move_budget == 0) {
+			std::sort(sap_order.begin(), sap_order.end());
+			break;
+		}
+	}
+
+	// Sweep over centers, wide enough for a pair of the largest gems. Only
+	// gems at most that far apart along the axis can be in contact range.
+	int32_t window = 2 * max_radius + CONTACT_MARGIN_RAW;
+	for (uint32_t i = 0; i < n; ++i) {
+		const Gem& a = gems[sap_order[i].gem];
+		for (uint32_t j = i + 1; j < n && sap_order[j].key - sap_order[i].key < window; ++j) {
+			const Gem& b = gems[sap_order[j].gem];
+			if (in_contact_range(a, b))
+				pairs->push_back(makePair(sap_order[i].gem, sap_order[j].gem));
+		}
+	}
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+struct Gem;
+
+enum BroadphaseType {
+	BROADPHASE_BRUTE_FORCE,
+	BROADPHASE_GRID,
+	BROADPHASE_SWEEP_AND_PRUNE
+};
+
+// Parses "brute", "grid" or "sap". Returns false for anything else.
+bool parseBroadphaseType(const char* name, BroadphaseType* out);
+const char* broadphaseTypeName(BroadphaseType type);
+
+/** Indices of two gems that may be touching, with a < b. */
+struct GemPair {
+	uint32_t a, b;
+
+	bool operator <(const GemPair& o) const {
+		return a < o.a || (a == o.a && b < o.b);
+	}
+	bool operator ==(const GemPair& o) const {
+		return a == o.a && b == o.b;
+	}
+};
+
+/**
+ * Finds the pairs of gems that need to go through collideBallWithBall().
+ *
+ * All algorithms report exactly the same pairs (those closer than the sum of
+ * their radii plus CONTACT_MARGIN, tested in fixed point), sorted by index, so
+ * switching algorithms never changes the simulation. Each has a fast path for
+ * the common case where all gems have the same radius.
+ */
+class Broadphase {
+public:
+	// Pairs further apart than this beyond touching can't touch this frame.
+	// The margin catches pairs pushed together by earlier contacts.
+	static const int CONTACT_MARGIN = 2;
+
+	// Size classes for the grid with mixed gem sizes: level n holds gems up to
+	// Gem::RADIUS << n, enough levels to reach Gem::MAX_RADIUS.
+	static const int GRID_LEVELS = 3;
+
+	explicit Broadphase(BroadphaseType type = BROADPHASE_GRID);
+
+	void setType(BroadphaseType new_type);
+	BroadphaseType getType() const { return type; }
+
+	void findPairs(const std::vector<Gem>& gems, std::vector<GemPair>* pairs);
+
+private:
+	struct GridEntry {
+		uint64_t cell;
+		uint32_t gem;
+
+		bool operator <(const GridEntry& o) const {
+			return cell < o.cell || (cell == o.cell && gem < o.gem);
+		}
+	};
+
+	struct GridCell {
+		uint64_t key;
+		uint32_t begin, end; // Range in grid_entries
+	};
+
+	template <typename ContactTest>
+	void findPairsBruteForce(const std::vector<Gem>& gems, const ContactTest& in_contact_range, std::vector<GemPair>* pairs);
+	template <typename ContactTest>
+	void findPairsGrid(const std::vector<Gem>& gems, const ContactTest& in_contact_range, int32_t cell_size, std::vector<GemPair>* pairs);
+	void findPairsLayeredGrid(const std::vector<Gem>& gems, std::vector<GemPair>* pairs);
+	template <typename ContactTest>
+	void findPairsSweepAndPrune(const std::vector<Gem>& gems, const ContactTest& in_contact_range, int32_t max_radius, std::vector<GemPair>* pairs);
+
+	static int gridLevel(int32_t radius);
+	static int32_t gridCellSize(int level);
+	// Sorts grid_entries and groups them into grid_cells.
+	void buildGridCells();
+	const GridCell* findGridCell(uint64_t key) const;
+	// Pairs within each cell and between neighbouring cells of the same level.
+	template <typename ContactTest>
+	void findPairsInGridLevels(const std::vector<Gem>& gems, const ContactTest& in_contact_range, std::vector<GemPair>* pairs);
+
+	BroadphaseType type;
+
+	// Grid scratch space, kept to avoid reallocating every frame.
+	std::vector<GridEntry> grid_entries;
+	std::vector<GridCell> grid_cells;
+
+	struct SapEntry {
+		int32_t key; // Gem position along sap_axis
+		uint32_t gem;
+
+		bool operator <(const SapEntry& o) const {
+			return key < o.key;
+		}
+	};
+
+	// Gems sorted along the sweep axis as of the previous frame. Gems only
+	// move a few pixels per frame, so re-sorting with insertion sort is ~O(n).
+	std::vector<SapEntry> sap_order;
+	// 0 to sweep along x, 1 along y.
+	int sap_axis;
+};
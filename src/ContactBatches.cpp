@@ -0,0 +1,42 @@
+#include "ContactBatches.hpp"
+
+#include <algorithm>
+
+void ContactBatches::build(const std::vector<GemPair>& pairs, size_t gem_count) {
+	gem_colors.assign(gem_count, 0);
+	pair_colors.resize(pairs.size());
+
+	size_t color_counts[MAX_COLORS + 1] = {0};
+	unsigned int used_colors = 0;
+
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		uint64_t used = gem_colors[pairs[i].a] | gem_colors[pairs[i].b];
+
+		unsigned int color = 0;
+		while (color < MAX_COLORS && (used & (uint64_t(1) << color)))
+			++color;
+
+		if (color < MAX_COLORS) {
+			gem_colors[pairs[i].a] |= uint64_t(1) << color;
+			gem_colors[pairs[i].b] |= uint64_t(1) << color;
+		}
+		pair_colors[i] = static_cast<uint8_t>(color);
+		color_counts[color] += 1;
+		used_colors = std::max(used_colors, color + 1);
+	}
+
+	// Counting sort by color, stable so each batch keeps the pair order.
+	batch_start.assign(used_colors + 1, 0);
+	for (unsigned int c = 0; c < used_colors; ++c) {
+		batch_start[c + 1] = batch_start[c] + color_counts[c];
+	}
+
+	sorted_pairs.resize(pairs.size());
+	size_t fill[MAX_COLORS + 1];
+	for (unsigned int c = 0; c < used_colors; ++c) {
+		fill[c] = batch_start[c];
+	}
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		sorted_pairs[fill[pair_colors[i]]++] = pairs[i];
+	}
+}
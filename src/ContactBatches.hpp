@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <cstdint>
+#include "Broadphase.hpp"
+
+/**
+ * Reorders contact pairs into batches in which no gem appears more than once.
+ *
+ * Pairs are greedily colored in their original order, each getting the
+ * lowest color not yet used by either of its gems. Since the pairs within a
+ * batch touch disjoint gems, a batch can be solved in any order or in
+ * parallel with the same result, and the batches themselves are always
+ * solved in color order, so results don't depend on the thread count.
+ */
+class ContactBatches {
+public:
+	// Colors tracked per gem. Pairs that can't get one of these go into a
+	// final overflow batch, which must be solved serially.
+	static const unsigned int MAX_COLORS = 64;
+
+	void build(const std::vector<GemPair>& pairs, size_t gem_count);
+
+	size_t batchCount() const { return batch_start.size() - 1; }
+	// The overflow batch, if present, is always the last one.
+	bool isOverflowBatch(size_t batch) const { return batch == MAX_COLORS; }
+
+	const GemPair* batchBegin(size_t batch) const { return sorted_pairs.data() + batch_start[batch]; }
+	size_t batchSize(size_t batch) const { return batch_start[batch + 1] - batch_start[batch]; }
+
+private:
+	std::vector<uint64_t> gem_colors; // Bitmask of colors used by each gem
+	std::vector<uint8_t> pair_colors;
+	std::vector<GemPair> sorted_pairs;
+	std::vector<size_t> batch_start;
+};
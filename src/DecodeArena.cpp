@@ -0,0 +1,86 @@
+#include "DecodeArena.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace {
+
+// Covers the scratch buffers of a typical sprite sheet in one block.
+const size_t MIN_BLOCK_SIZE = 1 << 20;
+const size_t ALIGNMENT = 16;
+
+size_t alignUp(size_t offset) {
+	return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+} // namespace
+
+DecodeArena::DecodeArena()
+	: total_size(0), block_size(0), used(0), last(nullptr)
+{ }
+
+stbi_allocator DecodeArena::allocator() {
+	stbi_allocator hooks;
+	hooks.allocate = &DecodeArena::allocateHook;
+	hooks.reallocate = &DecodeArena::reallocateHook;
+	hooks.release = nullptr; // Everything goes at reset().
+	hooks.user = this;
+	return hooks;
+}
+
+void DecodeArena::reset() {
+	if (blocks.size() > 1) {
+		blocks.clear();
+		uint8_t* block = new (std::nothrow) uint8_t[total_size];
+		if (block != nullptr) {
+			blocks.push_back(std::unique_ptr<uint8_t[]>(block));
+			block_size = total_size;
+		} else {
+			total_size = block_size = 0;
+		}
+	}
+	used = 0;
+	last = nullptr;
+}
+
+void* DecodeArena::allocate(size_t size) {
+	size_t offset = alignUp(used);
+	if (blocks.empty() || offset > block_size || size > block_size - offset) {
+		size_t new_size = std::max(std::max(size, MIN_BLOCK_SIZE), block_size * 2);
+		uint8_t* block = new (std::nothrow) uint8_t[new_size];
+		if (block == nullptr)
+			return nullptr;
+		blocks.push_back(std::unique_ptr<uint8_t[]>(block));
+		total_size += new_size;
+		block_size = new_size;
+		offset = 0;
+	}
+	last = blocks.back().get() + offset;
+	used = offset + size;
+	return last;
+}
+
+void* DecodeArena::reallocate(void* p, size_t old_size, size_t new_size) {
+	// stb_image grows its compressed and inflated data buffers by doubling,
+	// always the one it allocated last, so those just extend the used space.
+	if (p != nullptr && p == last) {
+		size_t offset = last - blocks.back().get();
+		if (new_size <= block_size - offset) {
+			used = offset + new_size;
+			return p;
+		}
+	}
+	void* moved = allocate(new_size);
+	if (moved != nullptr && p != nullptr)
+		std::memcpy(moved, p, std::min(old_size, new_size));
+	return moved;
+}
+
+void* DecodeArena::allocateHook(void* user, size_t size) {
+	return static_cast<DecodeArena*>(user)->allocate(size);
+}
+
+void* DecodeArena::reallocateHook(void* user, void* p, size_t old_size, size_t new_size) {
+	return static_cast<DecodeArena*>(user)->reallocate(p, old_size, new_size);
+}
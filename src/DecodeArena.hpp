@@ -0,0 +1,46 @@
+#pragma once
+
+#include "stb_image.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Bump allocator for the scratch memory of one image decode.
+ *
+ * stb_image allocates and frees a handful of buffers per image (compressed
+ * data, unfiltered rows, component planes). Passing allocator() in a
+ * stbi_context makes it take them from here instead, and reset() gives them
+ * all back at once after the decode. Memory is kept between decodes; if one
+ * needed more than a single block, the next reset() replaces the blocks with
+ * one block of their total size, so a steady stream of similar images settles
+ * on one allocation.
+ */
+class DecodeArena {
+public:
+	DecodeArena();
+
+	// Hooks for stbi_context::allocator. Memory from them stays valid until
+	// reset().
+	stbi_allocator allocator();
+	void reset();
+
+private:
+	// Not copyable.
+	DecodeArena(const DecodeArena&);
+	DecodeArena& operator=(const DecodeArena&);
+
+	void* allocate(size_t size);
+	void* reallocate(void* p, size_t old_size, size_t new_size);
+	static void* allocateHook(void* user, size_t size);
+	static void* reallocateHook(void* user, void* p, size_t old_size, size_t new_size);
+
+	std::vector<std::unique_ptr<uint8_t[]>> blocks;
+	size_t total_size;
+	// Of the last block, where allocations come from.
+	size_t block_size;
+	size_t used;
+	// Most recent allocation, which can grow in place.
+	uint8_t* last;
+};
@@ -0,0 +1,598 @@
+#include "Game.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "vec2.hpp"
+#include "Hash.hpp"
+#include "ThreadPool.hpp"
+#include "UnionFind.hpp"
+
+const fixed16_16 Gem::SLEEP_SPEED(0, 1, 4);
+
+// Splits vector vel into components parallel and perpendicular to the normal
+// of the plane n.
+void splitVector(vec2 vel, vec2 n, vec2* out_par, vec2* out_perp) {
+	vec2 par = dot(vel, n) * n;
+	*out_par = par;
+	*out_perp = vel - par;
+}
+
+void collideBallWithBoundary(Gem& ball) {
+	// Left boundary
+	if (ball.pos_x - ball.radius < 0) {
+		ball.vel_x = -ball.vel_x;
+		ball.pos_x = ball.radius;
+	}
+
+	// Right boundary
+	if (ball.pos_x + ball.radius > WINDOW_WIDTH) {
+		ball.vel_x = -ball.vel_x;
+		ball.pos_x = fixed24_8(WINDOW_WIDTH) - ball.radius;
+	}
+
+	// Top boundary
+	/*
+	if (ball.pos_y - ball.radius < 0) {
+		ball.vel_y = -ball.vel_y;
+		ball.pos_y = ball.radius;
+	}
+	*/
+
+	// Bottom boundary
+	/*
+	if (ball.pos_y + ball.radius > WINDOW_HEIGHT) {
+		ball.vel_y = -ball.vel_y;
+		ball.pos_y = fixed24_8(WINDOW_HEIGHT) - ball.radius;
+	}
+	*/
+}
+
+fixed24_8 Gem::radiusForValue(int score_value) {
+	// r = RADIUS * sqrt(score_value / INITIAL_VALUE), in integers so every
+	// platform agrees on it.
+	static const uint64_t BASE = uint64_t(RADIUS) << 8;
+	uint64_t r_sqr = BASE * BASE * uint64_t(std::max(score_value, 0)) / INITIAL_VALUE;
+
+	uint64_t r = 0;
+	for (uint64_t bit = uint64_t(1) << 31; bit != 0; bit >>= 1) {
+		if ((r + bit) * (r + bit) <= r_sqr)
+			r += bit;
+	}
+
+	return fixed24_8::raw(static_cast<int32_t>(std::min(r, uint64_t(MAX_RADIUS) << 8)));
+}
+
+bool collideBallWithBall(Gem& a, Gem& b) {
+	vec2 dv = {(a.pos_x - b.pos_x).toFloat(), (a.pos_y - b.pos_y).toFloat()};
+	float d_sqr = length_sqr(dv);
+	fixed24_8 radii = a.radius + b.radius;
+	float contact_distance = radii.toFloat();
+
+	if (d_sqr < contact_distance*contact_distance) {
+		fixed16_16 rel_vel_x = a.vel_x - b.vel_x;
+		fixed16_16 rel_vel_y = a.vel_y - b.vel_y;
+		vec2 rel_vel = {rel_vel_x.toFloat(), rel_vel_y.toFloat()};
+		float rel_speed_sqr = length_sqr(rel_vel);
+		
+		if (rel_speed_sqr >= Gem::MERGE_SPEED*Gem::MERGE_SPEED) {
+			// Left for mergeGems(), so that merging doesn't depend on the
+			// order in which pairs are visited.
+			return true;
+		} else {
+			float d = std::sqrt(d_sqr);
+			float sz = (contact_distance - d) / 2.0f;
+
+			vec2 normal = dv / d;
+			fixed24_8 push_back_x(sz * normal.x);
+			fixed24_8 push_back_y(sz * normal.y);
+
+			a.pos_x += push_back_x;
+			a.pos_y += push_back_y;
+			b.pos_x -= push_back_x;
+			b.pos_y -= push_back_y;
+
+			vec2 a_par, a_perp;
+			vec2 b_par, b_perp;
+
+			vec2 a_vel = {a.vel_x.toFloat(), a.vel_y.toFloat()};
+			vec2 b_vel = {b.vel_x.toFloat(), b.vel_y.toFloat()};
+			splitVector(a_vel, normal, &a_par, &a_perp);
+			splitVector(b_vel, -normal, &b_par, &b_perp);
+
+			static const float friction = 1.0f;
+			static const float bounce = 0.9f;
+
+			float A = (1.0f + bounce) / 2.0f;
+			float B = (1.0f - bounce) / 2.0f;
+
+			a_vel = A*b_par + B*a_par + friction*a_perp;
+			b_vel = A*a_par + B*b_par + friction*b_perp;
+
+			a.vel_x = fixed16_16(a_vel.x);
+			a.vel_y = fixed16_16(a_vel.y);
+
+			b.vel_x = fixed16_16(b_vel.x);
+			b.vel_y = fixed16_16(b_vel.y);
+		}
+	}
+
+	return false;
+}
+
+// Returns the nearest point in line segment a-b to point p.
+vec2 pointLineSegmentNearestPoint(vec2 p, vec2 a, vec2 b) {
+	// Taken from http://stackoverflow.com/a/1501725
+	const float l2 = length_sqr(b - a);
+	if (l2 == 0.0f) {
+		return a;
+	}
+
+	const float t = dot(p - a, b - a) / l2;
+	if (t < 0.0f) {
+		return a;
+	} else if (t > 1.0f) {
+		return b;
+	} else {
+		return a + t * (b - a);
+	}
+}
+
+// Resting gems sit right at the surface, so count those as touching too.
+static const float PADDLE_REST_SLOP = 1.0f;
+
+// Returns the offset of the ball from the nearest point on the paddle, and in
+// *r the distance at which they touch.
+static vec2 paddleOffset(const Gem& ball, const Paddle& paddle, float* r) {
+	SpriteMatrix matrix = paddle.getSpriteMatrix();
+
+	// Left sphere
+	vec2 left = {-24, 0};
+	// Right sphere
+	vec2 right = {24, 0};
+
+	matrix.transform(&left.x, &left.y);
+	matrix.transform(&right.x, &right.y);
+
+	static const int PADDLE_RADIUS = 8;
+
+	fixed24_8 rel_ball_x = ball.pos_x - paddle.pos_x;
+	fixed24_8 rel_ball_y = ball.pos_y - paddle.pos_y;
+	vec2 rel_ball = {rel_ball_x.toFloat(), rel_ball_y.toFloat()};
+
+	*r = PADDLE_RADIUS + ball.radius.toFloat();
+	return rel_ball - pointLineSegmentNearestPoint(rel_ball, left, right);
+}
+
+PaddleContact paddleContact(const Gem& ball, const Paddle& paddle) {
+	float r;
+	float d_sqr = length_sqr(paddleOffset(ball, paddle, &r));
+	if (d_sqr < r*r)
+		return PADDLE_HIT;
+	return d_sqr < (r + PADDLE_REST_SLOP) * (r + PADDLE_REST_SLOP) ? PADDLE_RESTING : PADDLE_APART;
+}
+
+PaddleContact collideBallWithPaddle(Gem& ball, const Paddle& paddle) {
+	float r;
+	vec2 penetration = paddleOffset(ball, paddle, &r);
+	float d_sqr = length_sqr(penetration);
+	if (d_sqr < r*r) {
+		vec2 vel = {ball.vel_x.toFloat(), ball.vel_y.toFloat()};
+		int score_addition = static_cast<int>(ball.score_value * (ball.vel_y.toFloat() / 128.f));
+		ball.setScoreValue(std::min(ball.score_value + std::max(score_addition, 0), Gem::MAX_VALUE));
+
+		float d = std::sqrt(d_sqr);
+		float sz = r - d;
+
+		vec2 normal = penetration / d;
+		fixed24_8 push_back_x(sz * normal.x);
+		fixed24_8 push_back_y(sz * normal.y);
+
+		ball.pos_x += push_back_x;
+		ball.pos_y += push_back_y;
+
+		vec2 par, perp;
+		splitVector(vel, normal, &par, &perp);
+		vel = perp - par;
+
+		ball.vel_x = fixed16_16(vel.x);
+		ball.vel_y = fixed16_16(vel.y);
+		return PADDLE_HIT;
+	}
+
+	return d_sqr < (r + PADDLE_REST_SLOP) * (r + PADDLE_REST_SLOP) ? PADDLE_RESTING : PADDLE_APART;
+}
+
+unsigned int moveBall(Gem& ball, const Paddle& paddle, PaddleContact* paddle_contact) {
+	int32_t dx = fixed24_8(ball.vel_x).value;
+	int32_t dy = fixed24_8(ball.vel_y).value;
+
+	const int32_t max_step = fixed24_8(Gem::SUBSTEP_DISTANCE).value;
+	// |dx| + |dy| is never less than the true length, so no sub-step is
+	// longer than max_step; the larger of the two can be 1/sqrt(2) of it.
+	int32_t distance = std::abs(dx) + std::abs(dy);
+	unsigned int steps = (distance + max_step - 1) / max_step;
+
+	if (steps <= 1) {
+		ball.pos_x += fixed24_8::raw(dx);
+		ball.pos_y += fixed24_8::raw(dy);
+		collideBallWithBoundary(ball);
+		return 1;
+	}
+
+	const unsigned int needed_steps = steps;
+	steps = std::min(steps, static_cast<unsigned int>(Gem::MAX_SUBSTEPS));
+	for (unsigned int i = 0; i < steps; ++i) {
+		// Splitting the displacement like this makes the sub-steps add up to
+		// exactly one full step, unless a bounce changes the velocity midway.
+		int64_t full_x = fixed24_8(ball.vel_x).value;
+		int64_t full_y = fixed24_8(ball.vel_y).value;
+		ball.pos_x += fixed24_8::raw(static_cast<int32_t>(full_x * (i + 1) / steps - full_x * i / steps));
+		ball.pos_y += fixed24_8::raw(static_cast<int32_t>(full_y * (i + 1) / steps - full_y * i / steps));
+
+		collideBallWithBoundary(ball);
+		*paddle_contact = std::max(*paddle_contact, collideBallWithPaddle(ball, paddle));
+	}
+
+	return needed_steps;
+}
+
+void solveGemContacts(std::vector<Gem>& gems, StepContext& context) {
+	// Below this many pairs handing a batch to the pool costs more than it saves.
+	static const size_t MIN_PARALLEL_BATCH = 512;
+	static const size_t PARALLEL_CHUNK = 128;
+
+	context.broadphase.findPairs(gems, &context.pairs);
+
+	// Sleeping gems stay put, so there's nothing to solve between two of them.
+	context.active_pairs.clear();
+	for (const GemPair& pair : context.pairs) {
+		if (!gems[pair.a].isAsleep() || !gems[pair.b].isAsleep())
+			context.active_pairs.push_back(pair);
+	}
+	context.contact_batches.build(context.active_pairs, gems.size());
+
+	const ContactBatches& batches = context.contact_batches;
+	// One flag per pair, in batch order, so parallel batches can report
+	// merges without synchronizing.
+	context.merge_flags.assign(context.active_pairs.size(), 0);
+
+	size_t batch_offset = 0;
+	for (size_t batch = 0; batch < batches.batchCount(); ++batch) {
+		const GemPair* pairs = batches.batchBegin(batch);
+		size_t count = batches.batchSize(batch);
+		uint8_t* merge_flags = context.merge_flags.data() + batch_offset;
+
+		if (context.thread_pool && count >= MIN_PARALLEL_BATCH && !batches.isOverflowBatch(batch)) {
+			Gem* gem_data = gems.data();
+			context.thread_pool->parallelFor(count, [=](size_t i) {
+				merge_flags[i] = collideBallWithBall(gem_data[pairs[i].a], gem_data[pairs[i].b]);
+			}, PARALLEL_CHUNK);
+		} else {
+			for (size_t i = 0; i < count; ++i) {
+				merge_flags[i] = collideBallWithBall(gems[pairs[i].a], gems[pairs[i].b]);
+			}
+		}
+
+		batch_offset += count;
+	}
+
+	context.merge_pairs.clear();
+	for (size_t batch = 0, i = 0; batch < batches.batchCount(); ++batch) {
+		const GemPair* pairs = batches.batchBegin(batch);
+		for (size_t j = 0; j < batches.batchSize(batch); ++j, ++i) {
+			if (context.merge_flags[i])
+				context.merge_pairs.push_back(pairs[j]);
+		}
+	}
+}
+
+void mergeGems(std::vector<Gem>& gems, StepContext& context) {
+	if (context.merge_pairs.empty())
+		return;
+
+	UnionFind& groups = context.merge_groups;
+	groups.reset(gems.size());
+	for (const GemPair& pair : context.merge_pairs) {
+		groups.unite(pair.a, pair.b);
+	}
+
+	// Sum every group into its lowest-indexed gem. All sums are integers, so
+	// the result doesn't depend on the order gems are added in.
+	std::vector<MergeAccumulator>& acc = context.merge_accumulators;
+	acc.assign(gems.size(), MergeAccumulator());
+	for (uint32_t i = 0; i < gems.size(); ++i) {
+		MergeAccumulator& group = acc[groups.find(i)];
+		group.pos_x += gems[i].pos_x.value;
+		group.pos_y += gems[i].pos_y.value;
+		group.vel_x += gems[i].vel_x.value;
+		group.vel_y += gems[i].vel_y.value;
+		group.score_value += gems[i].score_value;
+		group.count += 1;
+	}
+
+	size_t kept = 0;
+	for (uint32_t i = 0; i < gems.size(); ++i) {
+		if (groups.find(i) != i)
+			continue; // Absorbed into another gem
+
+		Gem gem = gems[i];
+		const MergeAccumulator& group = acc[i];
+		if (group.count > 1) {
+			gem.pos_x = fixed24_8::raw(static_cast<int32_t>(group.pos_x / group.count));
+			gem.pos_y = fixed24_8::raw(static_cast<int32_t>(group.pos_y / group.count));
+			gem.vel_x = fixed16_16::raw(static_cast<int32_t>(group.vel_x));
+			gem.vel_y = fixed16_16::raw(static_cast<int32_t>(group.vel_y));
+			gem.setScoreValue(group.score_value);
+			gem.rest_frames = 0;
+			context.events.add(GameEvent::GEMS_MERGED, gem.id, gem.pos_x, gem.pos_y, gem.score_value, group.count);
+		}
+		gems[kept++] = gem;
+	}
+	gems.resize(kept);
+}
+
+void updateSleeping(std::vector<Gem>& gems, StepContext& context, bool paddle_moved) {
+	const int64_t sleep_speed_sqr = int64_t(Gem::SLEEP_SPEED.value) * Gem::SLEEP_SPEED.value;
+
+	// Islands are groups of gems in contact range of each other.
+	UnionFind& islands = context.islands;
+	islands.reset(gems.size());
+	for (const GemPair& pair : context.pairs) {
+		islands.unite(pair.a, pair.b);
+	}
+
+	// Per island root: whether it rests on the paddle, whether something
+	// woke one of its gems, and whether any of its gems is awake.
+	enum { ISLAND_ON_PADDLE = 1, ISLAND_WOKEN = 2, ISLAND_AWAKE = 4 };
+	std::vector<uint8_t>& flags = context.island_flags;
+	flags.assign(gems.size(), 0);
+
+	for (uint32_t i = 0; i < gems.size(); ++i) {
+		const Gem& gem = gems[i];
+		uint8_t& island = flags[islands.find(i)];
+
+		if (context.touching_paddle[i])
+			island |= ISLAND_ON_PADDLE;
+
+		if (gem.isAsleep()) {
+			// Sleeping gems don't move by themselves, so any speed came from a
+			// contact with an awake gem. A moving paddle shoves its whole pile.
+			int64_t vx = gem.vel_x.value, vy = gem.vel_y.value;
+			if (vx*vx + vy*vy >= sleep_speed_sqr || (paddle_moved && context.touching_paddle[i]))
+				island |= ISLAND_WOKEN;
+		} else {
+			island |= ISLAND_AWAKE;
+		}
+	}
+
+	StepStats& stats = context.stats;
+	stats.active_gems = stats.sleeping_gems = stats.sleeping_islands = 0;
+
+	for (uint32_t i = 0; i < gems.size(); ++i) {
+		Gem& gem = gems[i];
+		uint32_t root = islands.find(i);
+		uint8_t island = flags[root];
+
+		if (gem.isAsleep()) {
+			// Only the paddle holds anything up, so an island that lost touch
+			// with it has to fall.
+			if ((island & ISLAND_WOKEN) || !(island & ISLAND_ON_PADDLE)) {
+				gem.rest_frames = 0;
+			}
+		} else {
+			int64_t vx = gem.vel_x.value, vy = gem.vel_y.value;
+			if (vx*vx + vy*vy < sleep_speed_sqr) {
+				gem.rest_frames += 1;
+				if (gem.isAsleep())
+					gem.vel_x = gem.vel_y = 0;
+			} else {
+				gem.rest_frames = 0;
+			}
+		}
+
+		if (gem.isAsleep()) {
+			stats.sleeping_gems += 1;
+			if (root == i && !(island & ISLAND_AWAKE) && (island & ISLAND_ON_PADDLE) && !(island & ISLAND_WOKEN))
+				stats.sleeping_islands += 1;
+		} else {
+			stats.active_gems += 1;
+		}
+	}
+}
+
+void applyGameEvents(GameState& game_state, const GameEventBuffer& events) {
+	for (const GameEvent& e : events) {
+		switch (e.type) {
+		case GameEvent::PADDLE_HIT:
+			game_state.score += e.value;
+			break;
+		case GameEvent::GEM_LOST:
+			if (game_state.lives > 0)
+				game_state.lives -= 1;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void initGameState(GameState& game_state, uint32_t seed) {
+	game_state.rng.seed(seed);
+
+	{
+		Paddle& p = game_state.paddle;
+		p.pos_x = WINDOW_WIDTH / 2;
+		p.pos_y = WINDOW_HEIGHT - 32;
+		p.rotation = 0;
+	}
+
+	game_state.gems.clear();
+	game_state.score = 0;
+	game_state.lives = 5;
+	game_state.timers.reset(0);
+	std::memset(game_state.scripts, 0, sizeof(game_state.scripts));
+	// Scripts can only run inside a step, so start this one on the first.
+	game_state.timers.schedule(0, TIMER_START_SCRIPT, SCRIPT_GEM_RAIN);
+	game_state.frame = 0;
+	game_state.next_gem_id = 0;
+}
+
+void spawnGemAt(GameState& game_state, StepContext& context, int pos_x) {
+	Gem b;
+	b.pos_x = pos_x;
+	b.pos_y = -10;
+	b.vel_x = b.vel_y = 0;
+	b.setScoreValue(Gem::INITIAL_VALUE);
+	b.rest_frames = 0;
+	b.id = game_state.next_gem_id++;
+
+	game_state.gems.push_back(b);
+	context.events.add(GameEvent::GEM_SPAWNED, b.id, b.pos_x, b.pos_y, b.score_value);
+}
+
+void spawnGem(GameState& game_state, StepContext& context) {
+	spawnGemAt(game_state, context, randRange(game_state.rng, WINDOW_WIDTH * 1 / 6, WINDOW_WIDTH * 5 / 6));
+}
+
+void stepGame(GameState& game_state, InputState input, StepContext& context) {
+	context.events.clear();
+
+	/* Update paddle */
+	bool paddle_moved;
+	{
+		Paddle& paddle = game_state.paddle;
+		Paddle old_paddle = paddle;
+
+		fixed24_8 paddle_speed(0);
+		fixed8_24 rotation = 0;
+		if (input & INPUT_LEFT) {
+			paddle_speed -= PADDLE_MOVEMENT_SPEED;
+			rotation -= PADDLE_ROTATION_RATE;
+		}
+		if (input & INPUT_RIGHT) {
+			paddle_speed += PADDLE_MOVEMENT_SPEED;
+			rotation += PADDLE_ROTATION_RATE;
+		}
+
+		if (rotation == 0) {
+			paddle.rotation = stepTowards(paddle.rotation, fixed8_24(0), PADDLE_ROTATION_RETURN_RATE);
+		} else {
+			paddle.rotation = clamp(-PADDLE_MAX_ROTATION, paddle.rotation + rotation, PADDLE_MAX_ROTATION);
+		}
+		paddle.pos_x += paddle_speed;
+
+		paddle_moved = paddle.pos_x != old_paddle.pos_x || paddle.rotation != old_paddle.rotation;
+	}
+
+	/* Run timers */
+	game_state.timers.advance();
+	TimerEvent timer;
+	while (game_state.timers.popExpired(&timer)) {
+		switch (timer.type) {
+		case TIMER_START_SCRIPT:
+			startScript(game_state, context, static_cast<ScriptId>(timer.param));
+			break;
+		case TIMER_RESUME_SCRIPT:
+			resumeScript(game_state, context, timer.param);
+			break;
+		}
+	}
+
+	/* Update balls */
+	// A gem already touching the paddle is resting on it or still being
+	// pushed out, so only gems that weren't can hit it, once per step.
+	context.paddle_hits.resize(game_state.gems.size());
+	for (size_t i = 0; i < game_state.gems.size(); ++i) {
+		PaddleHitState& hit = context.paddle_hits[i];
+		hit.start_value = game_state.gems[i].score_value;
+		hit.touching_at_start = paddleContact(game_state.gems[i], game_state.paddle) != PADDLE_APART;
+		hit.hit = 0;
+	}
+	context.touching_paddle.assign(game_state.gems.size(), 0);
+	context.stats.fast_gems = 0;
+	context.stats.substeps = 0;
+	context.stats.clamped_gems = 0;
+	for (size_t i = 0; i < game_state.gems.size(); ++i) {
+		Gem& ball = game_state.gems[i];
+		if (ball.isAsleep())
+			continue;
+
+		ball.vel_y += GEM_GRAVITY;
+
+		PaddleContact paddle_contact = PADDLE_APART;
+		unsigned int steps = moveBall(ball, game_state.paddle, &paddle_contact);
+		if (steps > 1) {
+			context.stats.fast_gems += 1;
+			context.stats.substeps += std::min(steps, static_cast<unsigned int>(Gem::MAX_SUBSTEPS));
+			if (steps > Gem::MAX_SUBSTEPS)
+				context.stats.clamped_gems += 1;
+		}
+		if (paddle_contact == PADDLE_HIT)
+			context.paddle_hits[i].hit = 1;
+		context.touching_paddle[i] = paddle_contact != PADDLE_APART;
+	}
+
+	solveGemContacts(game_state.gems, context);
+
+	for (size_t i = 0; i < game_state.gems.size(); ++i) {
+		Gem& ball = game_state.gems[i];
+		PaddleContact paddle_contact = collideBallWithPaddle(ball, game_state.paddle);
+		if (paddle_contact == PADDLE_HIT)
+			context.paddle_hits[i].hit = 1;
+		if (paddle_contact != PADDLE_APART)
+			context.touching_paddle[i] = 1;
+	}
+	for (size_t i = 0; i < game_state.gems.size(); ++i) {
+		const PaddleHitState& hit = context.paddle_hits[i];
+		const Gem& ball = game_state.gems[i];
+		if (hit.hit && !hit.touching_at_start)
+			context.events.add(GameEvent::PADDLE_HIT, ball.id, ball.pos_x, ball.pos_y, ball.score_value - hit.start_value);
+	}
+
+	// Needs the pair list, so must run before merging renumbers the gems.
+	updateSleeping(game_state.gems, context, paddle_moved);
+	mergeGems(game_state.gems, context);
+
+	/* Clean up dead gems */
+	auto isLost = [](const Gem& gem) {
+		return gem.pos_y > WINDOW_HEIGHT + 128 && gem.vel_y > 0;
+	};
+	for (const Gem& gem : game_state.gems) {
+		if (isLost(gem))
+			context.events.add(GameEvent::GEM_LOST, gem.id, gem.pos_x, gem.pos_y, gem.score_value);
+	}
+	remove_if(game_state.gems, isLost);
+
+	applyGameEvents(game_state, context.events);
+
+	game_state.frame += 1;
+}
+
+uint64_t hashGameState(const GameState& game_state) {
+	Hasher h;
+
+	const Paddle& paddle = game_state.paddle;
+	h.add(static_cast<uint32_t>(paddle.pos_x.value));
+	h.add(static_cast<uint32_t>(paddle.pos_y.value));
+	h.add(static_cast<uint32_t>(paddle.rotation.value));
+
+	h.add(static_cast<uint32_t>(game_state.score));
+	h.add(static_cast<uint32_t>(game_state.lives));
+	h.add(game_state.frame);
+	h.add(game_state.next_gem_id);
+
+	h.add(game_state.gems.size());
+	h.addBytes(game_state.gems.data(), game_state.gems.size() * sizeof(Gem));
+
+	// The wheel and the scripts are plain arrays with no padding, like the
+	// gems.
+	h.addBytes(&game_state.timers, sizeof(game_state.timers));
+	h.addBytes(game_state.scripts, sizeof(game_state.scripts));
+
+	// The engine is just two words of state, so hashing its memory directly
+	// is equivalent to serializing it.
+	h.addBytes(&game_state.rng, sizeof(game_state.rng));
+
+	return h.result();
+}
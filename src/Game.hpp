@@ -0,0 +1,239 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include "util.hpp"
+#include "Fixed.hpp"
+#include "SpriteBuffer.hpp"
+#include "Broadphase.hpp"
+#include "ContactBatches.hpp"
+#include "GameEvents.hpp"
+#include "TimerWheel.hpp"
+#include "Script.hpp"
+#include "UnionFind.hpp"
+
+class ThreadPool;
+
+struct Gem {
+	fixed24_8 pos_x;
+	fixed24_8 pos_y;
+
+	fixed16_16 vel_x;
+	fixed16_16 vel_y;
+
+	int score_value;
+	static const int MAX_VALUE = 10000;
+	static const int INITIAL_VALUE = 100;
+
+	static const int MERGE_SPEED = 6;
+
+	// Grows with score_value, from RADIUS for a new gem up to MAX_RADIUS, so
+	// that the gem's area is proportional to its value. Kept up to date with
+	// setScoreValue().
+	fixed24_8 radius;
+	static const int RADIUS = 8;
+	static const int MAX_RADIUS = 24;
+
+	static fixed24_8 radiusForValue(int score_value);
+	void setScoreValue(int value) {
+		score_value = value;
+		radius = radiusForValue(value);
+	}
+
+	// Consecutive frames the gem has moved slower than SLEEP_SPEED. Once it
+	// reaches SLEEP_DELAY the gem is asleep: it stops moving and is skipped
+	// in gem-gem tests against other sleeping gems until something wakes it.
+	int rest_frames;
+	static const fixed16_16 SLEEP_SPEED;
+	static const int SLEEP_DELAY = 30;
+
+	bool isAsleep() const { return rest_frames >= SLEEP_DELAY; }
+
+	// Unique for the lifetime of a game, so events can refer to the gem. A
+	// merged gem keeps the id of its first gem.
+	uint32_t id;
+
+	// Gems moving further than this in a frame could pass through the paddle
+	// or the boundary, so they're moved in several sub-steps of at most this
+	// length. Other gems are only collided with once per frame, sub-steps or
+	// not. Gems that would need more than MAX_SUBSTEPS move further in each.
+	static const int SUBSTEP_DISTANCE = RADIUS;
+	static const int MAX_SUBSTEPS = 8;
+};
+// Gems are hashed and copied as raw memory, so there must be no padding.
+static_assert(sizeof(Gem) == 8 * 4, "Gem has unexpected padding");
+
+struct Paddle {
+	fixed24_8 pos_x;
+	fixed24_8 pos_y;
+
+	fixed8_24 rotation;
+
+	SpriteMatrix getSpriteMatrix() const {
+		return SpriteMatrix().loadIdentity().rotate(rotation.toFloat());
+	};
+};
+
+static const fixed24_8 PADDLE_MOVEMENT_SPEED(4);
+static const fixed8_24 PADDLE_MAX_ROTATION(15);
+static const fixed8_24 PADDLE_ROTATION_RATE(3);
+static const fixed8_24 PADDLE_ROTATION_RETURN_RATE(1);
+// Added to every awake gem's vertical velocity each frame.
+static const fixed16_16 GEM_GRAVITY(0, 1, 8);
+
+struct GameState {
+	RandomGenerator rng;
+
+	Paddle paddle;
+	std::vector<Gem> gems;
+
+	int score;
+	int lives;
+
+	// Timed game events, as TimerType values. The wheel advances in step with
+	// frame.
+	TimerWheel timers;
+	// Running scripts, see Script.hpp.
+	ScriptState scripts[MAX_SCRIPTS];
+	// Number of steps simulated since initGameState().
+	uint32_t frame;
+	// Id for the next spawned gem.
+	uint32_t next_gem_id;
+
+	GameState()
+		: score(0), lives(5), frame(0), next_gem_id(0)
+	{
+		timers.reset(0);
+		std::memset(scripts, 0, sizeof(scripts));
+	}
+};
+
+enum TimerType : uint16_t {
+	TIMER_START_SCRIPT,  // param is the ScriptId
+	TIMER_RESUME_SCRIPT  // param is the script slot
+};
+
+static const int WINDOW_WIDTH = 240;
+static const int WINDOW_HEIGHT = 360;
+
+static const int GEM_SPAWN_INTERVAL = 60*5;
+
+// Player input for a single frame, as a combination of INPUT_* bits.
+typedef uint8_t InputState;
+static const InputState INPUT_LEFT  = 1 << 0;
+static const InputState INPUT_RIGHT = 1 << 1;
+
+void collideBallWithBoundary(Gem& ball);
+// Pushes apart and bounces two touching gems. Returns true instead, without
+// changing either gem, if they hit hard enough to merge.
+bool collideBallWithBall(Gem& a, Gem& b);
+enum PaddleContact {
+	PADDLE_APART,
+	PADDLE_RESTING, // Touching the surface without pushing into it
+	PADDLE_HIT
+};
+// Whether the ball is pushing into the paddle (PADDLE_HIT), touching it or
+// neither, without moving it.
+PaddleContact paddleContact(const Gem& ball, const Paddle& paddle);
+// Bounces the ball off the paddle if it's pushing into it, increasing its
+// value by how fast it hit.
+PaddleContact collideBallWithPaddle(Gem& ball, const Paddle& paddle);
+// Moves the ball by its velocity for one frame and collides it with the
+// boundary. Fast balls are also collided with the paddle after every sub-step,
+// raising *paddle_contact to the closest contact. Returns the number of
+// sub-steps the ball needed, which is more than it got if it needed more than
+// Gem::MAX_SUBSTEPS.
+unsigned int moveBall(Gem& ball, const Paddle& paddle, PaddleContact* paddle_contact);
+
+/** Position, velocity and score sums of one group of gems merging this step. */
+struct MergeAccumulator {
+	int64_t pos_x, pos_y;
+	int64_t vel_x, vel_y;
+	int score_value;
+	int count;
+
+	MergeAccumulator()
+		: pos_x(0), pos_y(0), vel_x(0), vel_y(0), score_value(0), count(0)
+	{ }
+};
+
+/** How a gem met the paddle during a step, so each hit is reported once. */
+struct PaddleHitState {
+	int start_value;
+	uint8_t touching_at_start;
+	uint8_t hit; // Pushed into the paddle during the step
+};
+
+/** Counters about the last step, for profiling. */
+struct StepStats {
+	unsigned int active_gems;
+	unsigned int sleeping_gems;
+	// Groups of touching gems that are all asleep.
+	unsigned int sleeping_islands;
+	// Gems that needed more than one sub-step, and the sub-steps they used.
+	unsigned int fast_gems;
+	unsigned int substeps;
+	// Fast gems that needed more than Gem::MAX_SUBSTEPS.
+	unsigned int clamped_gems;
+
+	StepStats()
+		: active_gems(0), sleeping_gems(0), sleeping_islands(0), fast_gems(0), substeps(0), clamped_gems(0)
+	{ }
+};
+
+/**
+ * Scratch space and settings reused from one step to the next. None of it is
+ * simulation state: stepping with a fresh context, or with another
+ * broadphase, gives exactly the same results.
+ */
+struct StepContext {
+	Broadphase broadphase;
+	std::vector<GemPair> pairs;
+	// Pairs with at least one gem awake; the ones that need solving.
+	std::vector<GemPair> active_pairs;
+	ContactBatches contact_batches;
+	// Solves large contact batches in parallel if set. Not owned.
+	ThreadPool* thread_pool;
+
+	std::vector<uint8_t> merge_flags;
+	std::vector<GemPair> merge_pairs;
+	UnionFind merge_groups;
+	std::vector<MergeAccumulator> merge_accumulators;
+
+	std::vector<uint8_t> touching_paddle;
+	std::vector<PaddleHitState> paddle_hits;
+	UnionFind islands;
+	std::vector<uint8_t> island_flags;
+
+	StepStats stats;
+	// What happened during the last step.
+	GameEventBuffer events;
+
+	StepContext() : thread_pool(nullptr) { }
+};
+
+// Resolves collisions between all gem pairs found by the broadphase, and
+// collects the pairs that should merge in context.merge_pairs.
+void solveGemContacts(std::vector<Gem>& gems, StepContext& context);
+// Updates which gems are asleep, based on how fast they moved this step and on
+// what their island of touching gems is doing.
+void updateSleeping(std::vector<Gem>& gems, StepContext& context, bool paddle_moved);
+// Updates the score and lives from the events of the step.
+void applyGameEvents(GameState& game_state, const GameEventBuffer& events);
+// Merges every group of gems linked by context.merge_pairs into one gem, at
+// the average position of the group and with its summed velocity and value.
+void mergeGems(std::vector<Gem>& gems, StepContext& context);
+
+// Adds a gem above the field at the given x position.
+void spawnGemAt(GameState& game_state, StepContext& context, int pos_x);
+// Adds a gem at a random position above the field.
+void spawnGem(GameState& game_state, StepContext& context);
+// Resets the state to the beginning of a new game.
+void initGameState(GameState& game_state, uint32_t seed);
+// Advances the simulation by one frame. Doesn't touch any window or GL state,
+// so it can be driven by live input just as well as by a replay.
+void stepGame(GameState& game_state, InputState input, StepContext& context);
+// Hashes all of the simulation state, including the RNG. Two runs are in sync
+// for as long as their per-frame hashes match.
+uint64_t hashGameState(const GameState& game_state);
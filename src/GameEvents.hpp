@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include "Fixed.hpp"
+
+/** Something that happened to a gem during a step. */
+struct GameEvent {
+	enum Type : uint8_t {
+		GEM_SPAWNED,
+		PADDLE_HIT,
+		GEMS_MERGED,
+		GEM_LOST
+	};
+
+	Type type;
+	uint32_t gem_id;
+	fixed24_8 pos_x, pos_y;
+	// GEM_SPAWNED, GEM_LOST: the gem's value. PADDLE_HIT: the value the gem
+	// gained from the hit. GEMS_MERGED: the value of the merged gem.
+	int value;
+	// GEMS_MERGED: how many gems went into the merged one. Otherwise 1.
+	int count;
+};
+
+/**
+ * The events of the last step, in the order they happened.
+ *
+ * The simulation only appends records here, so collision code doesn't call
+ * out to anything; scoring and other consumers read the buffer after the
+ * step. Records go into a fixed array that's cleared at the start of every
+ * step, so adding one never allocates.
+ *
+ * Once CAPACITY events have been added in a step, further ones are dropped
+ * and counted in dropped(); they don't count towards the score either. The
+ * capacity is fixed, so that's still the same on every machine and replays
+ * stay deterministic, but it's far more than a step normally produces.
+ */
+class GameEventBuffer {
+public:
+	static const size_t CAPACITY = 1024;
+
+	GameEventBuffer() : event_count(0), dropped_count(0) { }
+
+	void clear() {
+		event_count = 0;
+		dropped_count = 0;
+	}
+
+	void add(GameEvent::Type type, uint32_t gem_id, fixed24_8 pos_x, fixed24_8 pos_y, int value, int count = 1) {
+		if (event_count == CAPACITY) {
+			dropped_count += 1;
+			return;
+		}
+
+		GameEvent& e = events[event_count++];
+		e.type = type;
+		e.gem_id = gem_id;
+		e.pos_x = pos_x;
+		e.pos_y = pos_y;
+		e.value = value;
+		e.count = count;
+	}
+
+	size_t size() const { return event_count; }
+	bool empty() const { return event_count == 0; }
+	// Events that didn't fit since the last clear().
+	size_t dropped() const { return dropped_count; }
+	const GameEvent& operator [](size_t i) const { return events[i]; }
+
+	const GameEvent* begin() const { return events; }
+	const GameEvent* end() const { return events + event_count; }
+
+private:
+	GameEvent events[CAPACITY];
+	size_t event_count;
+	size_t dropped_count;
+};
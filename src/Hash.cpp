@@ -0,0 +1,86 @@
+#include "Hash.hpp"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HASH_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Each 16-byte block is xored with a key and folded into two 64-bit lanes by
+// multiplying the low and high halves of each lane, as in XXH3's accumulator.
+// The key advances every block so that swapping two blocks changes the hash.
+static const uint64_t KEY_INIT[2] = {0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull};
+static const uint64_t KEY_STEP[2] = {0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full};
+
+static uint64_t finishHash(uint64_t acc0, uint64_t acc1, size_t size) {
+	return Hasher::mix(acc0 ^ Hasher::mix(acc1 + size));
+}
+
+#ifdef HASH_USE_SSE2
+
+static inline void accumulateBlock(__m128i& acc, __m128i& key, __m128i data) {
+	__m128i data_key = _mm_xor_si128(data, key);
+	__m128i key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+	acc = _mm_add_epi64(acc, _mm_mul_epu32(data_key, key_hi));
+	acc = _mm_add_epi64(acc, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+	key = _mm_add_epi64(key, _mm_loadu_si128(reinterpret_cast<const __m128i*>(KEY_STEP)));
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	const uint8_t* end = p + (size & ~size_t(15));
+
+	__m128i acc = _mm_set_epi32(0, 0, static_cast<int>(seed >> 32), static_cast<int>(seed));
+	__m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(KEY_INIT));
+
+	for (; p != end; p += 16) {
+		accumulateBlock(acc, key, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+	}
+
+	if (size & 15) {
+		uint8_t tail[16] = {0};
+		std::memcpy(tail, p, size & 15);
+		accumulateBlock(acc, key, _mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+	return finishHash(lanes[0], lanes[1], size);
+}
+
+#else
+
+static inline void accumulateBlock(uint64_t acc[2], uint64_t key[2], const uint8_t* p) {
+	uint64_t data[2];
+	std::memcpy(data, p, 16);
+
+	for (int i = 0; i < 2; ++i) {
+		uint64_t data_key = data[i] ^ key[i];
+		acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+		acc[i] += data[i ^ 1];
+		key[i] += KEY_STEP[i];
+	}
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	const uint8_t* end = p + (size & ~size_t(15));
+
+	uint64_t acc[2] = {seed, 0};
+	uint64_t key[2] = {KEY_INIT[0], KEY_INIT[1]};
+
+	for (; p != end; p += 16) {
+		accumulateBlock(acc, key, p);
+	}
+
+	if (size & 15) {
+		uint8_t tail[16] = {0};
+		std::memcpy(tail, p, size & 15);
+		accumulateBlock(acc, key, tail);
+	}
+
+	return finishHash(acc[0], acc[1], size);
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Hashes a block of memory. Processes 16 bytes per step using SSE2 where
+// available; the scalar fallback produces identical results, so hashes can be
+// compared between builds.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed);
+
+/** Incrementally combines values into a single 64-bit hash. */
+class Hasher {
+public:
+	Hasher() : h(0x9E3779B97F4A7C15ull) { }
+
+	void add(uint64_t v) {
+		h = mix(h ^ v);
+	}
+
+	void addBytes(const void* data, size_t size) {
+		add(hashBytes(data, size, h));
+	}
+
+	uint64_t result() const { return h; }
+
+	// Finalizer from SplitMix64.
+	static uint64_t mix(uint64_t x) {
+		x ^= x >> 30;
+		x *= 0xBF58476D1CE4E5B9ull;
+		x ^= x >> 27;
+		x *= 0x94D049BB133111EBull;
+		x ^= x >> 31;
+		return x;
+	}
+
+private:
+	uint64_t h;
+};
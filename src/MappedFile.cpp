@@ -0,0 +1,25 @@
+#include "MappedFile.hpp"
+
+MappedFile::MappedFile()
+	: is_open(false)
+{
+	mapping.data = nullptr;
+	mapping.size = 0;
+	mapping.file = mapping.mapping = nullptr;
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const char* filename) {
+	close();
+	is_open = stbi_map_file(&mapping, filename) != 0;
+	return is_open;
+}
+
+void MappedFile::close() {
+	if (is_open)
+		stbi_unmap_file(&mapping);
+	is_open = false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "stb_image.h"
+
+/**
+ * Read-only memory mapping of a whole file.
+ *
+ * The contents are paged in by the OS as they're touched, so large files
+ * don't need to be read up front and nothing gets copied into a buffer. A
+ * wrapper around stbi_map_file(), which the image loader uses for the same
+ * thing, so the platform code is in one place.
+ */
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Maps the file, replacing any previous mapping. Returns false if it
+	// couldn't be opened or mapped.
+	bool open(const char* filename);
+	void close();
+
+	bool isOpen() const { return is_open; }
+	// nullptr for an empty file.
+	const uint8_t* data() const { return mapping.data; }
+	size_t size() const { return mapping.size; }
+
+private:
+	// Not copyable.
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	stbi_mapped_file mapping;
+	bool is_open;
+};
@@ -0,0 +1,171 @@
+#include "Replay.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+
+static const char REPLAY_MAGIC[4] = {'P', 'N', 'G', 'R'};
+static const uint16_t REPLAY_VERSION = 2;
+
+static void writeU8(std::vector<uint8_t>& buf, uint8_t v) {
+	buf.push_back(v);
+}
+
+static void writeU16(std::vector<uint8_t>& buf, uint16_t v) {
+	buf.push_back(v & 0xFF);
+	buf.push_back(v >> 8);
+}
+
+static void writeU32(std::vector<uint8_t>& buf, uint32_t v) {
+	writeU16(buf, v & 0xFFFF);
+	writeU16(buf, v >> 16);
+}
+
+static void writeU64(std::vector<uint8_t>& buf, uint64_t v) {
+	writeU32(buf, v & 0xFFFFFFFF);
+	writeU32(buf, v >> 32);
+}
+
+static void writeVarint(std::vector<uint8_t>& buf, uint32_t v) {
+	while (v >= 0x80) {
+		buf.push_back(static_cast<uint8_t>(v | 0x80));
+		v >>= 7;
+	}
+	buf.push_back(static_cast<uint8_t>(v));
+}
+
+struct ReadCursor {
+	const uint8_t* p;
+	const uint8_t* end;
+
+	bool readU8(uint8_t* v) {
+		if (p == end) return false;
+		*v = *p++;
+		return true;
+	}
+
+	bool readU16(uint16_t* v) {
+		if (end - p < 2) return false;
+		*v = p[0] | (p[1] << 8);
+		p += 2;
+		return true;
+	}
+
+	bool readU32(uint32_t* v) {
+		uint16_t lo, hi;
+		if (!readU16(&lo) || !readU16(&hi)) return false;
+		*v = lo | (uint32_t(hi) << 16);
+		return true;
+	}
+
+	bool readU64(uint64_t* v) {
+		uint32_t lo, hi;
+		if (!readU32(&lo) || !readU32(&hi)) return false;
+		*v = lo | (uint64_t(hi) << 32);
+		return true;
+	}
+
+	bool readVarint(uint32_t* v) {
+		*v = 0;
+		for (int shift = 0; shift < 32; shift += 7) {
+			uint8_t b;
+			if (!readU8(&b)) return false;
+			*v |= uint32_t(b & 0x7F) << shift;
+			if ((b & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+};
+
+bool saveReplay(const Replay& replay, const std::string& filename) {
+	std::vector<uint8_t> buf;
+	buf.insert(buf.end(), REPLAY_MAGIC, REPLAY_MAGIC + 4);
+	writeU16(buf, REPLAY_VERSION);
+	writeU32(buf, replay.seed);
+	writeU32(buf, static_cast<uint32_t>(replay.inputs.size()));
+
+	size_t i = 0;
+	while (i < replay.inputs.size()) {
+		InputState input = replay.inputs[i];
+		size_t run_end = i + 1;
+		while (run_end < replay.inputs.size() && replay.inputs[run_end] == input)
+			++run_end;
+
+		writeU8(buf, input);
+		writeVarint(buf, static_cast<uint32_t>(run_end - i));
+		i = run_end;
+	}
+
+	writeU32(buf, static_cast<uint32_t>(replay.hashes.size()));
+	for (uint64_t hash : replay.hashes) {
+		writeU64(buf, hash);
+	}
+
+	std::ofstream f(filename, std::ios::binary);
+	if (!f) {
+		std::cerr << "Couldn't open " << filename << " for writing.\n";
+		return false;
+	}
+	f.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+	return f.good();
+}
+
+bool loadReplay(Replay* replay, const std::string& filename) {
+	std::ifstream f(filename, std::ios::binary);
+	if (!f) {
+		std::cerr << "Couldn't open " << filename << ".\n";
+		return false;
+	}
+	std::vector<uint8_t> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+	ReadCursor c = {buf.data(), buf.data() + buf.size()};
+	if (buf.size() < 4 || !std::equal(REPLAY_MAGIC, REPLAY_MAGIC + 4, buf.begin())) {
+		std::cerr << filename << " is not a replay file.\n";
+		return false;
+	}
+	c.p += 4;
+
+	uint16_t version;
+	uint32_t frame_count;
+	if (!c.readU16(&version) || !c.readU32(&replay->seed) || !c.readU32(&frame_count)) {
+		std::cerr << filename << ": truncated header.\n";
+		return false;
+	}
+	if (version < 1 || version > REPLAY_VERSION) {
+		std::cerr << filename << ": unsupported replay version " << version << ".\n";
+		return false;
+	}
+
+	replay->inputs.clear();
+	replay->inputs.reserve(frame_count);
+	while (replay->inputs.size() < frame_count) {
+		uint8_t input;
+		uint32_t run_length;
+		if (!c.readU8(&input) || !c.readVarint(&run_length)
+				|| run_length == 0 || run_length > frame_count - replay->inputs.size()) {
+			std::cerr << filename << ": corrupt input stream at frame " << replay->inputs.size() << ".\n";
+			return false;
+		}
+		replay->inputs.insert(replay->inputs.end(), run_length, input);
+	}
+
+	replay->hashes.clear();
+	if (version >= 2) {
+		uint32_t hash_count;
+		if (!c.readU32(&hash_count) || (hash_count != 0 && hash_count != frame_count)) {
+			std::cerr << filename << ": corrupt hash stream.\n";
+			return false;
+		}
+		replay->hashes.resize(hash_count);
+		for (uint32_t i = 0; i < hash_count; ++i) {
+			if (!c.readU64(&replay->hashes[i])) {
+				std::cerr << filename << ": truncated hash stream.\n";
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "Game.hpp"
+
+/** A recorded game session: the RNG seed plus the input of every frame. */
+struct Replay {
+	uint32_t seed;
+	std::vector<InputState> inputs;
+	// hashGameState() after each frame. Empty if the recording has no hashes.
+	std::vector<uint64_t> hashes;
+
+	Replay() : seed(0) { }
+};
+
+// On-disk format (all integers little-endian):
+//   char[4]  magic "PNGR"
+//   uint16   format version
+//   uint32   seed
+//   uint32   frame count
+//   runs of (uint8 input, varint length) until frame count is reached
+//   uint32   hash count (version 2+), either 0 or the frame count
+//   uint64   state hash of each frame
+// Lengths are LEB128 varints, so a key held for a few seconds costs 2 bytes.
+bool saveReplay(const Replay& replay, const std::string& filename);
+bool loadReplay(Replay* replay, const std::string& filename);
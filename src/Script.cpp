@@ -0,0 +1,88 @@
+#include "Script.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include "Game.hpp"
+
+namespace {
+
+typedef int32_t (*ScriptFunction)(ScriptState& s, GameState& game_state, StepContext& context);
+
+int32_t scriptGemRain(ScriptState& s, GameState& game_state, StepContext& context) {
+	SCRIPT_BEGIN(s);
+	for (;;) {
+		SCRIPT_WAIT(s, GEM_SPAWN_INTERVAL);
+		spawnGem(game_state, context);
+	}
+	SCRIPT_END(s);
+}
+
+int32_t scriptGemWaves(ScriptState& s, GameState& game_state, StepContext& context) {
+	SCRIPT_BEGIN(s);
+	for (;;) {
+		for (s.vars[0] = 0; s.vars[0] < WAVE_SIZE; ++s.vars[0]) {
+			if (s.vars[0] > 0)
+				SCRIPT_WAIT(s, WAVE_SPACING);
+			spawnGemAt(game_state, context, WINDOW_WIDTH * (s.vars[0] + 1) / (WAVE_SIZE + 1));
+		}
+		SCRIPT_WAIT(s, WAVE_PAUSE);
+	}
+	SCRIPT_END(s);
+}
+
+const ScriptFunction script_functions[SCRIPT_COUNT] = {
+	nullptr,
+	scriptGemRain,
+	scriptGemWaves,
+};
+
+// Runs the script in the slot until it waits or finishes.
+void runScript(GameState& game_state, StepContext& context, int slot) {
+	ScriptState& s = game_state.scripts[slot];
+	int32_t wait = script_functions[s.script](s, game_state, context);
+
+	if (wait == SCRIPT_DONE) {
+		s.script = SCRIPT_NONE;
+		s.resume_timer = TimerWheel::INVALID_HANDLE;
+	} else {
+		if (wait < 1)
+			wait = 1;
+		s.resume_timer = game_state.timers.schedule(game_state.frame + wait, TIMER_RESUME_SCRIPT, slot);
+		if (s.resume_timer == TimerWheel::INVALID_HANDLE) {
+			// The wheel is fixed-size so it can be snapshotted; running out
+			// means MAX_TIMERS is too small for the game, not a recoverable
+			// situation. Carrying on would silently stop the script.
+			std::cerr << "Out of timers: script " << s.script << " in slot " << slot << " can't wait\n";
+			std::abort();
+		}
+	}
+}
+
+} // namespace
+
+int startScript(GameState& game_state, StepContext& context, ScriptId script) {
+	for (int slot = 0; slot < MAX_SCRIPTS; ++slot) {
+		ScriptState& s = game_state.scripts[slot];
+		if (s.script != SCRIPT_NONE)
+			continue;
+
+		s.script = script;
+		s.line = 0;
+		s.resume_timer = TimerWheel::INVALID_HANDLE;
+		for (int32_t& var : s.vars) {
+			var = 0;
+		}
+
+		runScript(game_state, context, slot);
+		return slot;
+	}
+
+	return -1;
+}
+
+void resumeScript(GameState& game_state, StepContext& context, int slot) {
+	if (slot < 0 || slot >= MAX_SCRIPTS || game_state.scripts[slot].script == SCRIPT_NONE)
+		return;
+
+	runScript(game_state, context, slot);
+}
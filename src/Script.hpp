@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+struct GameState;
+struct StepContext;
+
+/**
+ * Scripts are functions that run sequential game logic across many frames,
+ * like spawn patterns, written with the SCRIPT_* macros below:
+ *
+ *     int32_t scriptExample(ScriptState& s, GameState& game_state, StepContext& context) {
+ *         SCRIPT_BEGIN(s);
+ *         for (s.vars[0] = 0; s.vars[0] < 5; ++s.vars[0]) {
+ *             spawnGem(game_state, context);
+ *             SCRIPT_WAIT(s, 10);
+ *         }
+ *         SCRIPT_END(s);
+ *     }
+ *
+ * SCRIPT_WAIT returns from the function, and the next call jumps back to
+ * where it left off (a switch on the line number, as in protothreads), so
+ * all of a script's state is its ScriptState slot: anything that has to
+ * survive a wait must be kept in vars, not in local variables, and there
+ * can't be any SCRIPT_WAIT inside a switch statement.
+ *
+ * Slots are plain data in a fixed array in GameState and waits are timers in
+ * GameState::timers, so running scripts cost no allocations and are copied,
+ * hashed and rolled back along with the rest of the state.
+ */
+struct ScriptState {
+	uint16_t script; // ScriptId, or SCRIPT_NONE if the slot is free
+	uint16_t line;   // Where to resume, 0 to start from the top
+	uint32_t resume_timer; // Timer handle of the pending wait
+	int32_t vars[4];
+};
+
+enum ScriptId : uint16_t {
+	SCRIPT_NONE,
+	// A gem every GEM_SPAWN_INTERVAL frames at a random position.
+	SCRIPT_GEM_RAIN,
+	// Rows of WAVE_SIZE gems sweeping across the field.
+	SCRIPT_GEM_WAVES,
+	SCRIPT_COUNT
+};
+
+static const int MAX_SCRIPTS = 16;
+
+// The wave pattern: WAVE_SIZE gems WAVE_SPACING frames apart, left to right,
+// then WAVE_PAUSE frames until the next row.
+static const int WAVE_SIZE = 5;
+static const int WAVE_SPACING = 10;
+static const int WAVE_PAUSE = 2 * 60;
+
+// What script functions return when they're finished.
+static const int32_t SCRIPT_DONE = -1;
+
+#define SCRIPT_BEGIN(s) switch ((s).line) { case 0:
+// Suspends the script for the given number of frames (at least 1).
+#define SCRIPT_WAIT(s, frames) do { (s).line = __LINE__; return (frames); case __LINE__: ; } while (0)
+#define SCRIPT_END(s) } (s).line = 0; return SCRIPT_DONE
+
+// Starts a script in a free slot, running it up to its first wait right
+// away. Returns the slot, or -1 if all slots are taken.
+int startScript(GameState& game_state, StepContext& context, ScriptId script);
+// Continues the script in the slot after its wait has ended.
+void resumeScript(GameState& game_state, StepContext& context, int slot);
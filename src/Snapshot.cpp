@@ -0,0 +1,95 @@
+#include "Snapshot.hpp"
+
+#include <cstring>
+
+// Keeps the gem array that follows each header suitably aligned.
+static size_t alignSize(size_t size) {
+	return (size + 15) & ~size_t(15);
+}
+
+SnapshotRing::SnapshotRing(unsigned int frame_capacity, unsigned int max_gems)
+	: slot_size(alignSize(sizeof(SlotHeader)) + alignSize(max_gems * sizeof(Gem))),
+	frame_capacity(frame_capacity), max_gems(max_gems),
+	newest(frame_capacity - 1), count(0)
+{
+	arena.resize(slot_size * frame_capacity);
+}
+
+SnapshotRing::SlotHeader* SnapshotRing::slotHeader(unsigned int slot) {
+	return reinterpret_cast<SlotHeader*>(&arena[slot * slot_size]);
+}
+
+const SnapshotRing::SlotHeader* SnapshotRing::slotHeader(unsigned int slot) const {
+	return reinterpret_cast<const SlotHeader*>(&arena[slot * slot_size]);
+}
+
+bool SnapshotRing::save(const GameState& state) {
+	if (state.gems.size() > max_gems || frame_capacity == 0)
+		return false;
+
+	newest = (newest + 1) % frame_capacity;
+	if (count < frame_capacity)
+		count += 1;
+
+	SlotHeader* header = slotHeader(newest);
+	header->rng = state.rng;
+	header->paddle = state.paddle;
+	header->score = state.score;
+	header->lives = state.lives;
+	header->timers = state.timers;
+	std::memcpy(header->scripts, state.scripts, sizeof(state.scripts));
+	header->frame = state.frame;
+	header->next_gem_id = state.next_gem_id;
+	header->gem_count = static_cast<uint32_t>(state.gems.size());
+
+	if (!state.gems.empty()) {
+		uint8_t* gems = reinterpret_cast<uint8_t*>(header) + alignSize(sizeof(SlotHeader));
+		std::memcpy(gems, state.gems.data(), state.gems.size() * sizeof(Gem));
+	}
+
+	return true;
+}
+
+bool SnapshotRing::restore(GameState& state, unsigned int frames_ago) const {
+	if (frames_ago >= count)
+		return false;
+
+	unsigned int slot = (newest + frame_capacity - frames_ago) % frame_capacity;
+	const SlotHeader* header = slotHeader(slot);
+
+	state.rng = header->rng;
+	state.paddle = header->paddle;
+	state.score = header->score;
+	state.lives = header->lives;
+	state.timers = header->timers;
+	std::memcpy(state.scripts, header->scripts, sizeof(state.scripts));
+	state.frame = header->frame;
+	state.next_gem_id = header->next_gem_id;
+
+	const Gem* gems = reinterpret_cast<const Gem*>(reinterpret_cast<const uint8_t*>(header) + alignSize(sizeof(SlotHeader)));
+	state.gems.assign(gems, gems + header->gem_count);
+
+	return true;
+}
+
+void SnapshotRing::discard(unsigned int discard_count) {
+	if (discard_count > count)
+		discard_count = count;
+
+	newest = (newest + frame_capacity - discard_count) % frame_capacity;
+	count -= discard_count;
+}
+
+bool rewindAndResimulate(SnapshotRing& ring, GameState& state, unsigned int frames_ago, const InputState* inputs, StepContext& context) {
+	if (!ring.restore(state, frames_ago))
+		return false;
+	ring.discard(frames_ago);
+
+	for (unsigned int i = 0; i < frames_ago; ++i) {
+		stepGame(state, inputs[i], context);
+		if (!ring.save(state))
+			return false;
+	}
+
+	return true;
+}
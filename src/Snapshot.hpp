@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "Game.hpp"
+
+/**
+ * Keeps copies of the last N simulation states in a single preallocated
+ * arena, for rolling back and re-simulating with corrected input.
+ *
+ * Every slot is a flat header followed by room for a fixed number of gems, so
+ * saving and restoring are plain copies proportional to the state size and
+ * never allocate (restore reuses the capacity of the target's gem vector).
+ */
+class SnapshotRing {
+public:
+	SnapshotRing(unsigned int frame_capacity, unsigned int max_gems);
+
+	// Stores state as the newest snapshot, overwriting the oldest one if the
+	// ring is full. Fails if the state has more gems than fit in a slot.
+	bool save(const GameState& state);
+	// Loads the snapshot saved frames_ago saves before the newest one.
+	bool restore(GameState& state, unsigned int frames_ago) const;
+	// Forgets the newest count snapshots.
+	void discard(unsigned int count);
+	void clear() { count = 0; }
+
+	unsigned int size() const { return count; }
+	unsigned int capacity() const { return frame_capacity; }
+
+private:
+	struct SlotHeader {
+		RandomGenerator rng;
+		Paddle paddle;
+		int score;
+		int lives;
+		TimerWheel timers;
+		ScriptState scripts[MAX_SCRIPTS];
+		uint32_t frame;
+		uint32_t next_gem_id;
+		uint32_t gem_count;
+	};
+
+	SlotHeader* slotHeader(unsigned int slot);
+	const SlotHeader* slotHeader(unsigned int slot) const;
+
+	std::vector<uint8_t> arena;
+	size_t slot_size;
+	unsigned int frame_capacity;
+	unsigned int max_gems;
+
+	unsigned int newest; // Slot of the newest snapshot
+	unsigned int count;
+};
+
+// Rolls state back frames_ago frames and steps it forward again, feeding
+// inputs[0..frames_ago) for the re-simulated frames and saving each new state
+// back into the ring. With the original inputs this reproduces state exactly.
+bool rewindAndResimulate(SnapshotRing& ring, GameState& state, unsigned int frames_ago, const InputState* inputs, StepContext& context);
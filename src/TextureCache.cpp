@@ -0,0 +1,105 @@
+#include "TextureCache.hpp"
+
+#include "Hash.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+namespace {
+
+const char CACHE_MAGIC[4] = {'P', 'T', 'X', 'C'};
+const uint32_t CACHE_VERSION = 1;
+// Larger than any texture GL will take, so bogus headers can't overflow sizes.
+const int MAX_DIMENSION = 1 << 15;
+
+struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t source_hash;
+	int32_t width, height;
+};
+// Keeps the pixels that follow 8-byte aligned.
+static_assert(sizeof(CacheHeader) == 24, "Cache header layout changed");
+
+} // namespace
+
+bool CachedImage::open(const std::string& filename, uint64_t source_hash) {
+	image_width = image_height = 0;
+	if (!file.open(filename.c_str()))
+		return false;
+
+	CacheHeader header;
+	if (file.size() < sizeof(header)) {
+		file.close();
+		return false;
+	}
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	bool valid = std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+		&& header.version == CACHE_VERSION
+		&& header.source_hash == source_hash
+		&& header.width > 0 && header.width <= MAX_DIMENSION
+		&& header.height > 0 && header.height <= MAX_DIMENSION
+		&& file.size() == sizeof(header) + size_t(header.width) * header.height * 4;
+	if (!valid) {
+		file.close();
+		return false;
+	}
+
+	image_width = header.width;
+	image_height = header.height;
+	return true;
+}
+
+const uint8_t* CachedImage::pixels() const {
+	return file.data() + sizeof(CacheHeader);
+}
+
+uint64_t hashImageSource(const uint8_t* data, size_t size) {
+	Hasher hasher;
+	hasher.add(size);
+	hasher.addBytes(data, size);
+	return hasher.result();
+}
+
+bool writeCachedImage(const std::string& filename, uint64_t source_hash, const uint8_t* pixels, int width, int height) {
+	if (width <= 0 || width > MAX_DIMENSION || height <= 0 || height > MAX_DIMENSION)
+		return false;
+
+	CacheHeader header;
+	std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.source_hash = source_hash;
+	header.width = width;
+	header.height = height;
+
+	// Written under a temporary name first, so a crash halfway through
+	// never leaves a truncated entry behind. The name is per thread, so two
+	// loaders writing the same entry don't write into one file.
+	std::string temp_filename = filename + "." + std::to_string(static_cast<unsigned long long>(
+		std::hash<std::thread::id>()(std::this_thread::get_id()))) + ".tmp";
+	{
+		std::ofstream f(temp_filename, std::ios::binary);
+		f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		f.write(reinterpret_cast<const char*>(pixels), std::streamsize(width) * height * 4);
+		if (!f) {
+			f.close();
+			std::remove(temp_filename.c_str());
+			return false;
+		}
+	}
+
+	// rename() doesn't replace existing files on Windows.
+	std::remove(filename.c_str());
+	if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+		std::remove(temp_filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::string cachedImageFilename(const std::string& source_filename) {
+	return source_filename + ".rgba";
+}
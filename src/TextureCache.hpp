@@ -0,0 +1,41 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include <cstdint>
+#include <string>
+
+/**
+ * Disk cache of decoded images, so textures can skip PNG decoding after the
+ * first launch.
+ *
+ * Each cache file holds a small header and the raw RGBA pixels, and is mapped
+ * straight into memory when read. The header records a hash of the source
+ * file's contents, so an entry is ignored (and rewritten) as soon as the
+ * source changes. Files are in native byte order; they're only meant to be
+ * read back on the machine that wrote them.
+ */
+class CachedImage {
+public:
+	CachedImage() : image_width(0), image_height(0) { }
+
+	// Maps the cache file. Returns false if it's missing, malformed, or was
+	// made from a different source than the one with source_hash.
+	bool open(const std::string& filename, uint64_t source_hash);
+
+	// RGBA, 4 bytes per pixel and no row padding. Valid while open.
+	const uint8_t* pixels() const;
+	int width() const { return image_width; }
+	int height() const { return image_height; }
+
+private:
+	MappedFile file;
+	int image_width, image_height;
+};
+
+// Hash of a source file's contents identifying its cache entry.
+uint64_t hashImageSource(const uint8_t* data, size_t size);
+// Writes a cache file for the decoded RGBA pixels of the source with the
+// given hash, replacing any existing one.
+bool writeCachedImage(const std::string& filename, uint64_t source_hash, const uint8_t* pixels, int width, int height);
+// Name of the cache file for an image file.
+std::string cachedImageFilename(const std::string& source_filename);
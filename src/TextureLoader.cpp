@@ -0,0 +1,389 @@
+#include "TextureLoader.hpp"
+
+#include "stb_image.h"
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <iostream>
+#include <new>
+
+namespace {
+
+const unsigned int MAX_WORKERS = 4;
+// GIF delays are in hundredths of a second; browsers show frames with a
+// delay this short or shorter for DEFAULT_FRAME_MS instead.
+const int MIN_FRAME_DELAY = 1;
+const int DEFAULT_FRAME_MS = 100;
+
+struct DecodedAnimation {
+	int width, height;
+	std::vector<uint8_t> pixels; // RGBA frames, one after the other
+	std::vector<int> delays_ms;
+};
+
+// Decodes every frame of a GIF. Leaves the animation without frames if it
+// can't; a missing file is not an error, as animations are optional art.
+void decodeAnimation(const std::string& filename, DecodeArena* arena, DecodedAnimation* animation) {
+	animation->width = animation->height = 0;
+	MappedFile source;
+	if (!source.open(filename.c_str()))
+		return;
+	if (source.size() > INT_MAX) {
+		std::cerr << "Couldn't load " << filename << ": too large\n";
+		return;
+	}
+
+	stbi_context context;
+	stbi_context_init(&context);
+	context.allocator = arena->allocator();
+	int width, height;
+	stbi_gif_frames* frames = stbi_gif_frames_from_memory(&context, source.data(), static_cast<int>(source.size()), &width, &height);
+	if (frames == nullptr) {
+		std::cerr << "Couldn't load " << filename << ": " << context.failure_reason << "\n";
+		arena->reset();
+		return;
+	}
+	if (width <= 0 || height <= 0) {
+		std::cerr << "Couldn't load " << filename << ": bad size\n";
+		stbi_gif_frames_free(frames);
+		arena->reset();
+		return;
+	}
+	const size_t frame_size = size_t(width) * height * 4;
+	const stbi_uc* pixels;
+	int delay, result;
+	while ((result = stbi_gif_next_frame(frames, &pixels, &delay)) > 0) {
+		animation->pixels.insert(animation->pixels.end(), pixels, pixels + frame_size);
+		animation->delays_ms.push_back(delay <= MIN_FRAME_DELAY ? DEFAULT_FRAME_MS : delay * 10);
+	}
+	stbi_gif_frames_free(frames);
+	arena->reset();
+	if (result < 0) {
+		std::cerr << "Couldn't load " << filename << ": " << context.failure_reason << "\n";
+		animation->pixels.clear();
+		animation->delays_ms.clear();
+		return;
+	}
+	animation->width = width;
+	animation->height = height;
+}
+
+// Places the frames of the animations in rows below the first image_height
+// rows of an atlas atlas_width wide, left to right, a row as tall as the
+// tallest frame in it. An animation that would make the atlas taller than
+// max_size, or that is wider than the atlas, is left out with an empty clip.
+// Returns the number of animations left out.
+int placeFrames(const std::vector<DecodedAnimation>& animations, int atlas_width, int image_height, int max_size,
+	std::vector<AnimationClip>* clips, int* atlas_height)
+{
+	int left_out = 0;
+	clips->assign(animations.size(), AnimationClip());
+	int row_x = 0, row_y = image_height, row_height = 0;
+	for (size_t i = 0; i < animations.size(); ++i) {
+		const DecodedAnimation& animation = animations[i];
+		AnimationClip& clip = (*clips)[i];
+		clip.width = animation.width;
+		clip.height = animation.height;
+		const int start_x = row_x, start_y = row_y, start_height = row_height;
+		int end_ms = 0;
+		for (int delay_ms : animation.delays_ms) {
+			if (row_x + clip.width > atlas_width) {
+				row_x = 0;
+				row_y += row_height;
+				row_height = 0;
+			}
+			if (clip.width > atlas_width || row_y + clip.height > max_size) {
+				clip.frames.clear();
+				row_x = start_x;
+				row_y = start_y;
+				row_height = start_height;
+				++left_out;
+				break;
+			}
+			end_ms += delay_ms;
+			AnimationClip::Frame frame = { row_x, row_y, end_ms };
+			clip.frames.push_back(frame);
+			row_x += clip.width;
+			row_height = std::max(row_height, clip.height);
+		}
+	}
+	*atlas_height = row_y + row_height;
+	return left_out;
+}
+
+struct RowTarget {
+	uint8_t* pixels;
+	int width;
+};
+
+int copyRow(void* user, int y, const stbi_uc* row) {
+	RowTarget* target = static_cast<RowTarget*>(user);
+	const size_t row_size = size_t(target->width) * 4;
+	std::memcpy(target->pixels + row_size * y, row, row_size);
+	return 1;
+}
+
+} // namespace
+
+TextureLoader::TextureLoader()
+	: pixel_buffer(0), max_texture_size(0), shutting_down(false)
+{
+	unsigned int worker_count = std::max(1u, std::min(MAX_WORKERS, std::thread::hardware_concurrency()));
+	for (unsigned int i = 0; i < worker_count; ++i) {
+		workers.push_back(std::thread(&TextureLoader::workerMain, this));
+	}
+}
+
+TextureLoader::~TextureLoader() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shutting_down = true;
+	}
+	work_available.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	for (const DecodedImage& image : decoded) {
+		freeImage(image);
+	}
+	if (pixel_buffer != 0)
+		glDeleteBuffers(1, &pixel_buffer);
+}
+
+TextureHandle TextureLoader::load(const char* filename, const std::vector<std::string>& animations) {
+	Texture t;
+	t.state = LOADING;
+	t.texture = 0;
+	t.width = t.height = 0;
+	t.animations.resize(animations.size());
+	if (max_texture_size == 0)
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+	TextureHandle handle = static_cast<TextureHandle>(textures.size());
+	textures.push_back(t);
+
+	Request request;
+	request.handle = handle;
+	request.filename = filename;
+	request.animations = animations;
+	request.max_size = max_texture_size;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back(request);
+	}
+	work_available.notify_one();
+
+	return handle;
+}
+
+void TextureLoader::update() {
+	std::vector<DecodedImage> images;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		images.swap(decoded);
+	}
+
+	for (const DecodedImage& image : images) {
+		upload(image);
+		freeImage(image);
+	}
+}
+
+void TextureLoader::workerMain() {
+	DecodeArena arena;
+	for (;;) {
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (pending.empty() && !shutting_down)
+				work_available.wait(lock);
+			if (shutting_down)
+				return;
+			request = pending.front();
+			pending.pop_front();
+		}
+
+		DecodedImage image;
+		image.handle = request.handle;
+		loadImage(request.filename, &arena, &image);
+		if (image.pixels != nullptr && !request.animations.empty())
+			packAnimations(request.animations, request.max_size, &arena, &image);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		decoded.push_back(image);
+	}
+}
+
+void TextureLoader::loadImage(const std::string& filename, DecodeArena* arena, DecodedImage* image) {
+	image->pixels = nullptr;
+	image->width = image->height = 0;
+	image->decoded = nullptr;
+	image->cached = nullptr;
+
+	// The source has to be read anyway to check that the cache entry still
+	// matches it, and is decoded from the same mapping if it doesn't.
+	MappedFile source;
+	if (!source.open(filename.c_str()) || source.size() > INT_MAX) {
+		std::cerr << "Couldn't open " << filename << "\n";
+		return;
+	}
+	uint64_t source_hash = hashImageSource(source.data(), source.size());
+	std::string cache_filename = cachedImageFilename(filename);
+
+	CachedImage* cached = new CachedImage;
+	if (cached->open(cache_filename, source_hash)) {
+		image->cached = cached;
+		image->pixels = cached->pixels();
+		image->width = cached->width();
+		image->height = cached->height();
+		return;
+	}
+	delete cached;
+
+	// The pixels are decoded straight into memory owned here, and whatever
+	// stb_image needs on the way comes from the arena, so nothing it
+	// allocates outlives the call.
+	stbi_context context;
+	stbi_context_init(&context);
+	context.allocator = arena->allocator();
+	int width, height, comp;
+	const int source_size = static_cast<int>(source.size());
+	if (!stbi_info_from_memory_ctx(&context, source.data(), source_size, &width, &height, &comp) || width <= 0 || height <= 0) {
+		std::cerr << "Couldn't load " << filename << ": " << (context.failure_reason ? context.failure_reason : "bad size") << "\n";
+		return;
+	}
+	uint8_t* pixels = new (std::nothrow) uint8_t[size_t(width) * height * 4];
+	bool loaded = false;
+	if (pixels != nullptr) {
+		// PNGs are inflated and unfiltered a few rows at a time, so neither the
+		// compressed nor the inflated image is ever held; anything that can't
+		// be streamed (other formats, interlaced PNGs) is decoded whole.
+		RowTarget target = { pixels, width };
+		loaded = stbi_png_rows_from_memory(&context, source.data(), source_size, &image->width, &image->height, &comp, 4, &copyRow, &target)
+			|| stbi_load_into(&context, source.data(), source_size, pixels, width * 4, width, height, &image->width, &image->height, &comp, 4);
+	}
+	arena->reset();
+	if (!loaded) {
+		std::cerr << "Couldn't load " << filename << ": " << (pixels ? context.failure_reason : "out of memory") << "\n";
+		delete[] pixels;
+		return;
+	}
+	image->decoded = pixels;
+	image->pixels = pixels;
+
+	if (!writeCachedImage(cache_filename, source_hash, image->pixels, image->width, image->height))
+		std::cerr << "Couldn't write texture cache " << cache_filename << "\n";
+}
+
+void TextureLoader::packAnimations(const std::vector<std::string>& filenames, int max_size, DecodeArena* arena, DecodedImage* image) {
+	std::vector<DecodedAnimation> decoded_animations(filenames.size());
+	int widest = 0;
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		decodeAnimation(filenames[i], arena, &decoded_animations[i]);
+		widest = std::max(widest, decoded_animations[i].width);
+	}
+
+	// As narrow as the frames allow, unless a wider atlas, up to the largest
+	// texture GL takes, lets more animations fit.
+	int atlas_width = std::max(image->width, std::min(widest, max_size));
+	int atlas_height;
+	int left_out = placeFrames(decoded_animations, atlas_width, image->height, max_size, &image->animations, &atlas_height);
+	for (int width = atlas_width; left_out > 0 && width < max_size; ) {
+		width = std::min(width * 2, max_size);
+		std::vector<AnimationClip> clips;
+		int height;
+		int wider_left_out = placeFrames(decoded_animations, width, image->height, max_size, &clips, &height);
+		if (wider_left_out < left_out) {
+			left_out = wider_left_out;
+			atlas_width = width;
+			atlas_height = height;
+			image->animations.swap(clips);
+		}
+	}
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		if (image->animations[i].empty() && !decoded_animations[i].delays_ms.empty())
+			std::cerr << "Couldn't fit " << filenames[i] << " in a " << max_size << " pixel texture\n";
+	}
+	if (atlas_height == image->height)
+		return;
+
+	uint8_t* pixels = new (std::nothrow) uint8_t[size_t(atlas_width) * atlas_height * 4];
+	if (pixels == nullptr) {
+		std::cerr << "Couldn't pack animations: out of memory\n";
+		image->animations.assign(filenames.size(), AnimationClip());
+		return;
+	}
+	std::memset(pixels, 0, size_t(atlas_width) * atlas_height * 4);
+	for (int y = 0; y < image->height; ++y) {
+		std::memcpy(pixels + size_t(atlas_width) * y * 4, image->pixels + size_t(image->width) * y * 4, size_t(image->width) * 4);
+	}
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		const DecodedAnimation& decoded_animation = decoded_animations[i];
+		const AnimationClip& clip = image->animations[i];
+		const size_t frame_size = size_t(clip.width) * clip.height * 4;
+		for (size_t f = 0; f < clip.frames.size(); ++f) {
+			const uint8_t* frame_pixels = &decoded_animation.pixels[frame_size * f];
+			for (int y = 0; y < clip.height; ++y) {
+				std::memcpy(pixels + (size_t(atlas_width) * (clip.frames[f].img_y + y) + clip.frames[f].img_x) * 4,
+					frame_pixels + size_t(clip.width) * y * 4, size_t(clip.width) * 4);
+			}
+		}
+	}
+
+	freeImage(*image);
+	image->cached = nullptr;
+	image->decoded = pixels;
+	image->pixels = pixels;
+	image->width = atlas_width;
+	image->height = atlas_height;
+}
+
+void TextureLoader::freeImage(const DecodedImage& image) {
+	delete[] image.decoded;
+	delete image.cached;
+}
+
+void TextureLoader::upload(const DecodedImage& image) {
+	Texture& t = textures[image.handle];
+	if (image.pixels == nullptr) {
+		t.state = FAILED;
+		return;
+	}
+
+	// Copying into a pixel buffer lets glTexImage2D return without waiting
+	// for the driver to take the pixels; the transfer to the texture happens
+	// asynchronously from there.
+	size_t size = size_t(image.width) * image.height * 4;
+	if (pixel_buffer == 0)
+		glGenBuffers(1, &pixel_buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+	// Orphans the previous contents, so this never waits on an earlier upload.
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped == nullptr) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		t.state = FAILED;
+		return;
+	}
+	std::memcpy(mapped, image.pixels, size);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glGenTextures(1, &t.texture);
+	glBindTexture(GL_TEXTURE_2D, t.texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// With a buffer bound, the data argument is an offset into it.
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	t.width = image.width;
+	t.height = image.height;
+	t.animations = image.animations;
+	t.state = READY;
+}
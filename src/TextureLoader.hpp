@@ -0,0 +1,107 @@
+#pragma once
+
+#include "graphics_init.hpp"
+#include "TextureCache.hpp"
+#include "DecodeArena.hpp"
+#include "Animation.hpp"
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+typedef unsigned int TextureHandle;
+
+/**
+ * Loads textures without blocking the GL thread on image decoding.
+ *
+ * load() only queues the file; one of a few worker threads decodes it, and
+ * update(), called from the GL thread once per frame, uploads finished images
+ * through a pixel buffer object. Until then the texture is just not ready, so
+ * callers keep running and check isReady() before using it.
+ *
+ * Decoded images are kept in a TextureCache file next to the source, so later
+ * loads of an unchanged file map the pixels from there and skip decoding.
+ *
+ * A texture can also take the frames of animated GIFs: they're decoded with
+ * the image and packed below it, so the texture works as an atlas for them
+ * and playing them needs no decoding. These aren't cached, GIFs being small
+ * and quick to decode.
+ */
+class TextureLoader {
+public:
+	enum State {
+		LOADING,
+		READY,
+		FAILED
+	};
+
+	TextureLoader();
+	~TextureLoader();
+
+	// Starts loading an image file as an RGBA texture, with the frames of the
+	// given GIF files packed below it. The texture is widened if that lets
+	// more frames fit in GL_MAX_TEXTURE_SIZE; animations that still don't
+	// fit are left empty. GL thread only.
+	TextureHandle load(const char* filename, const std::vector<std::string>& animations = std::vector<std::string>());
+	// Uploads the images decoded since the last call. GL thread only.
+	void update();
+
+	State state(TextureHandle handle) const { return textures[handle].state; }
+	bool isReady(TextureHandle handle) const { return state(handle) == READY; }
+
+	// Valid once the texture is ready.
+	GLuint texture(TextureHandle handle) const { return textures[handle].texture; }
+	int width(TextureHandle handle) const { return textures[handle].width; }
+	int height(TextureHandle handle) const { return textures[handle].height; }
+	// Frames of the index-th animation given to load(). Empty if its file
+	// was missing or couldn't be decoded.
+	const AnimationClip& animation(TextureHandle handle, size_t index) const { return textures[handle].animations[index]; }
+
+private:
+	struct Texture {
+		State state;
+		GLuint texture;
+		int width, height;
+		std::vector<AnimationClip> animations;
+	};
+
+	struct Request {
+		TextureHandle handle;
+		std::string filename;
+		std::vector<std::string> animations;
+		int max_size; // GL_MAX_TEXTURE_SIZE
+	};
+
+	struct DecodedImage {
+		TextureHandle handle;
+		const uint8_t* pixels; // nullptr if loading failed
+		int width, height;
+		// Owner of pixels, one of the two.
+		uint8_t* decoded; // new[]ed, filled by stb_image
+		CachedImage* cached;
+		std::vector<AnimationClip> animations;
+	};
+
+	void workerMain();
+	static void loadImage(const std::string& filename, DecodeArena* arena, DecodedImage* image);
+	static void packAnimations(const std::vector<std::string>& filenames, int max_size, DecodeArena* arena, DecodedImage* image);
+	static void freeImage(const DecodedImage& image);
+	void upload(const DecodedImage& image);
+
+	// Only touched by the GL thread.
+	std::vector<Texture> textures;
+	GLuint pixel_buffer;
+	GLint max_texture_size; // 0 until the first load()
+
+	// Decode in parallel, each stb_image call with its own context, taking
+	// scratch memory from its worker's DecodeArena.
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable work_available;
+	// Guarded by mutex.
+	std::deque<Request> pending;
+	std::vector<DecodedImage> decoded;
+	bool shutting_down;
+};
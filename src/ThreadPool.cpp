@@ -0,0 +1,132 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int thread_count)
+	: generation(0), shutting_down(false), current_job(nullptr)
+{
+	items_remaining = 0;
+
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned int i = 0; i < thread_count; ++i) {
+		queues.push_back(new WorkQueue);
+	}
+
+	// The thread calling parallelFor() works on queue 0.
+	for (unsigned int i = 1; i < thread_count; ++i) {
+		threads.push_back(std::thread(&ThreadPool::workerMain, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		shutting_down = true;
+	}
+	work_available.notify_all();
+
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	for (WorkQueue* q : queues) {
+		delete q;
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& job, size_t min_chunk) {
+	if (count == 0)
+		return;
+
+	// Several chunks per thread leave something to steal when work is uneven.
+	size_t chunk_size = std::max(std::max(min_chunk, size_t(1)), count / (threadCount() * 8));
+
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		current_job = &job;
+		items_remaining = count;
+
+		unsigned int queue_i = 0;
+		for (size_t begin = 0; begin < count; begin += chunk_size) {
+			Range r = {begin, std::min(begin + chunk_size, count)};
+
+			WorkQueue& q = *queues[queue_i];
+			std::lock_guard<std::mutex> queue_lock(q.mutex);
+			q.ranges.push_back(r);
+
+			queue_i = (queue_i + 1) % threadCount();
+		}
+
+		generation += 1;
+	}
+	work_available.notify_all();
+
+	runRanges(0);
+
+	std::unique_lock<std::mutex> lock(state_mutex);
+	while (items_remaining != 0) {
+		work_finished.wait(lock);
+	}
+	current_job = nullptr;
+}
+
+void ThreadPool::workerMain(unsigned int index) {
+	unsigned int seen_generation = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(state_mutex);
+			while (!shutting_down && generation == seen_generation) {
+				work_available.wait(lock);
+			}
+			if (shutting_down)
+				return;
+			seen_generation = generation;
+		}
+
+		runRanges(index);
+	}
+}
+
+bool ThreadPool::popRange(unsigned int index, Range* out) {
+	{
+		WorkQueue& own = *queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.ranges.empty()) {
+			*out = own.ranges.back();
+			own.ranges.pop_back();
+			return true;
+		}
+	}
+
+	for (unsigned int i = 1; i < threadCount(); ++i) {
+		WorkQueue& victim = *queues[(index + i) % threadCount()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.ranges.empty()) {
+			*out = victim.ranges.front();
+			victim.ranges.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::runRanges(unsigned int index) {
+	Range r;
+	while (popRange(index, &r)) {
+		// Ranges are only queued after current_job is set, so popping one
+		// guarantees we see the matching job.
+		const std::function<void(size_t)>& job = *current_job;
+		for (size_t i = r.begin; i < r.end; ++i) {
+			job(i);
+		}
+
+		size_t done = r.end - r.begin;
+		if (items_remaining.fetch_sub(done) == done) {
+			std::lock_guard<std::mutex> lock(state_mutex);
+			work_finished.notify_all();
+		}
+	}
+}
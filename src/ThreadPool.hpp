@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/**
+ * Fixed set of worker threads running parallel loops.
+ *
+ * parallelFor() cuts the index range into chunks and deals them out to
+ * per-thread queues. Each thread takes chunks from the back of its own queue
+ * and, once that runs dry, steals from the front of the others, so uneven
+ * work (e.g. games that end early) still keeps every core busy.
+ */
+class ThreadPool {
+public:
+	// A thread_count of 0 uses one thread per hardware thread.
+	explicit ThreadPool(unsigned int thread_count = 0);
+	~ThreadPool();
+
+	// Number of threads working on a loop, including the calling thread.
+	unsigned int threadCount() const { return static_cast<unsigned int>(queues.size()); }
+
+	// Calls job(i) for every i in [0, count), in no particular order and
+	// possibly concurrently, and returns once all calls have finished. Indices
+	// are handed out in chunks of at least min_chunk. Not reentrant.
+	void parallelFor(size_t count, const std::function<void(size_t)>& job, size_t min_chunk = 1);
+
+private:
+	struct Range {
+		size_t begin, end;
+	};
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Range> ranges;
+	};
+
+	void workerMain(unsigned int index);
+	bool popRange(unsigned int index, Range* out);
+	void runRanges(unsigned int index);
+
+	std::vector<std::thread> threads;
+	std::vector<WorkQueue*> queues;
+
+	std::mutex state_mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_finished;
+	unsigned int generation;
+	bool shutting_down;
+
+	const std::function<void(size_t)>* current_job;
+	std::atomic<size_t> items_remaining;
+};
@@ -0,0 +1,152 @@
+#include "TimerWheel.hpp"
+
+#include <cstring>
+
+void TimerWheel::reset(uint32_t frame) {
+	// Clears the padding too, so equal wheels hash equal.
+	std::memset(this, 0, sizeof(*this));
+	current = frame;
+
+	for (int i = 0; i < LIST_COUNT; ++i) {
+		lists[i].head = lists[i].tail = NIL;
+	}
+	for (int16_t i = 0; i < MAX_TIMERS; ++i) {
+		pushBack(FREE_LIST, i);
+	}
+}
+
+void TimerWheel::pushBack(int list, int16_t node) {
+	Node& n = nodes[node];
+	n.list = static_cast<int16_t>(list);
+	n.next = NIL;
+	n.prev = lists[list].tail;
+
+	if (n.prev != NIL)
+		nodes[n.prev].next = node;
+	else
+		lists[list].head = node;
+	lists[list].tail = node;
+}
+
+void TimerWheel::unlink(int16_t node) {
+	Node& n = nodes[node];
+	List& list = lists[n.list];
+
+	if (n.prev != NIL)
+		nodes[n.prev].next = n.next;
+	else
+		list.head = n.next;
+
+	if (n.next != NIL)
+		nodes[n.next].prev = n.prev;
+	else
+		list.tail = n.prev;
+}
+
+void TimerWheel::insert(int16_t node) {
+	uint32_t frame = nodes[node].frame;
+	// Overdue timers go into the slot processed next.
+	uint32_t delta = frame - current;
+	if (static_cast<int32_t>(delta) < 0) {
+		frame = current;
+		delta = 0;
+	}
+
+	for (int level = 0; level < LEVELS; ++level) {
+		if (delta < (uint32_t(1) << (SLOT_BITS * (level + 1)))) {
+			int slot = (frame >> (SLOT_BITS * level)) & (SLOTS - 1);
+			pushBack(level * SLOTS + slot, node);
+			return;
+		}
+	}
+
+	// Too far ahead for the wheel: park it in the top level slot that comes
+	// up last, and it gets placed again from there.
+	static const int TOP_SHIFT = SLOT_BITS * (LEVELS - 1);
+	int slot = ((current >> TOP_SHIFT) + SLOTS - 1) & (SLOTS - 1);
+	pushBack((LEVELS - 1) * SLOTS + slot, node);
+}
+
+void TimerWheel::freeNode(int16_t node) {
+	nodes[node].generation += 1;
+	pushBack(FREE_LIST, node);
+	active_count -= 1;
+}
+
+TimerWheel::Handle TimerWheel::schedule(uint32_t frame, uint16_t type, int32_t param) {
+	int16_t node = lists[FREE_LIST].head;
+	if (node == NIL)
+		return INVALID_HANDLE;
+	unlink(node);
+
+	Node& n = nodes[node];
+	n.frame = frame;
+	n.type = type;
+	n.param = param;
+	insert(node);
+	active_count += 1;
+
+	// Index + 1, so that no valid handle is 0.
+	return (Handle(n.generation) << 16) | Handle(node + 1);
+}
+
+bool TimerWheel::cancel(Handle handle) {
+	int node = int(handle & 0xFFFF) - 1;
+	if (node < 0 || node >= MAX_TIMERS)
+		return false;
+
+	Node& n = nodes[node];
+	if (n.generation != (handle >> 16) || n.list == FREE_LIST)
+		return false;
+
+	unlink(static_cast<int16_t>(node));
+	freeNode(static_cast<int16_t>(node));
+	return true;
+}
+
+void TimerWheel::advance() {
+	// Entering a new rotation of a level's slots: spread the timers from the
+	// upper level's slot for this stretch over the levels below, highest
+	// first so they can keep trickling down.
+	int top = 0;
+	while (top + 1 < LEVELS && (current & ((uint32_t(1) << (SLOT_BITS * (top + 1))) - 1)) == 0)
+		++top;
+
+	for (int level = top; level >= 1; --level) {
+		int list = level * SLOTS + ((current >> (SLOT_BITS * level)) & (SLOTS - 1));
+		int16_t node = lists[list].head;
+		lists[list].head = lists[list].tail = NIL;
+
+		while (node != NIL) {
+			int16_t next = nodes[node].next;
+			insert(node);
+			node = next;
+		}
+	}
+
+	int list = current & (SLOTS - 1);
+	int16_t node = lists[list].head;
+	lists[list].head = lists[list].tail = NIL;
+	while (node != NIL) {
+		int16_t next = nodes[node].next;
+		pushBack(EXPIRED_LIST, node);
+		node = next;
+	}
+
+	current += 1;
+}
+
+bool TimerWheel::popExpired(TimerEvent* out) {
+	int16_t node = lists[EXPIRED_LIST].head;
+	if (node == NIL)
+		return false;
+	unlink(node);
+
+	const Node& n = nodes[node];
+	out->frame = n.frame;
+	out->type = n.type;
+	out->param = n.param;
+
+	freeNode(node);
+	return true;
+}
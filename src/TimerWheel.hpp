@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+
+/** A timer that came due, as returned by TimerWheel::popExpired(). */
+struct TimerEvent {
+	uint32_t frame; // Frame the timer was scheduled for
+	uint16_t type;
+	int32_t param;
+};
+
+/**
+ * Hierarchical timer wheel counting simulation frames.
+ *
+ * Timers are kept in doubly linked lists threaded through a fixed pool of
+ * nodes, one list per wheel slot, so scheduling and cancelling are O(1) and
+ * advancing a frame only touches the timers in the slot that comes due (plus,
+ * every 64^n frames, one slot of level n that gets spread over the levels
+ * below). Timers due on the same frame fire in a deterministic order.
+ *
+ * Everything is stored in fixed-size arrays of plain integers, so the wheel
+ * can be copied, hashed and snapshotted as raw memory along with the rest of
+ * the game state.
+ */
+class TimerWheel {
+public:
+	typedef uint32_t Handle;
+	static const Handle INVALID_HANDLE = 0;
+
+	static const int MAX_TIMERS = 256;
+	static const int LEVELS = 4;
+	static const int SLOT_BITS = 6;
+	static const int SLOTS = 1 << SLOT_BITS;
+
+	// Removes all timers and sets the next frame to advance to.
+	void reset(uint32_t frame);
+
+	// Schedules a timer to fire when the wheel advances to the given frame, or
+	// on the next advance if that frame has passed. Returns INVALID_HANDLE if
+	// all MAX_TIMERS timers are in use.
+	Handle schedule(uint32_t frame, uint16_t type, int32_t param);
+	// Returns false if the timer has already fired or been cancelled. Handles
+	// carry the generation of their node, so a stale handle whose node has
+	// been reused for another timer doesn't cancel that one.
+	bool cancel(Handle handle);
+
+	// Moves the timers due on nextFrame() to the expired list, then moves on
+	// to the following frame.
+	void advance();
+	// Takes the next timer from the expired list.
+	bool popExpired(TimerEvent* out);
+
+	uint32_t nextFrame() const { return current; }
+	unsigned int activeCount() const { return active_count; }
+
+private:
+	static const int16_t NIL = -1;
+	// Lists for the wheel slots, then the expired list, then the free list.
+	static const int EXPIRED_LIST = LEVELS * SLOTS;
+	static const int FREE_LIST = EXPIRED_LIST + 1;
+	static const int LIST_COUNT = FREE_LIST + 1;
+
+	struct Node {
+		uint32_t frame;
+		int32_t param;
+		uint16_t type;
+		uint16_t generation; // Bumped whenever the node is freed
+		int16_t next, prev;
+		int16_t list;
+		uint16_t padding;
+	};
+
+	struct List {
+		int16_t head, tail;
+	};
+
+	void pushBack(int list, int16_t node);
+	void unlink(int16_t node);
+	// Puts a node into the slot for its frame, relative to current.
+	void insert(int16_t node);
+	void freeNode(int16_t node);
+
+	Node nodes[MAX_TIMERS];
+	List lists[LIST_COUNT];
+	uint32_t current;
+	uint32_t active_count;
+};
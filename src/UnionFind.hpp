@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * Disjoint-set forest over the indices [0, n).
+ *
+ * The representative of a set is always its smallest index, so the result
+ * doesn't depend on the order in which sets were joined.
+ */
+class UnionFind {
+public:
+	void reset(size_t n) {
+		parent.resize(n);
+		for (size_t i = 0; i < n; ++i) {
+			parent[i] = static_cast<uint32_t>(i);
+		}
+	}
+
+	uint32_t find(uint32_t i) {
+		while (parent[i] != i) {
+			parent[i] = parent[parent[i]]; // Path halving
+			i = parent[i];
+		}
+		return i;
+	}
+
+	void unite(uint32_t a, uint32_t b) {
+		a = find(a);
+		b = find(b);
+		if (a < b) {
+			parent[b] = a;
+		} else if (b < a) {
+			parent[a] = b;
+		}
+	}
+
+private:
+	std::vector<uint32_t> parent;
+};
@@ -1,29 +1,8 @@
 #include "graphics_init.hpp"
 
-#include "stb_image.h"
+#include "MappedFile.hpp"
 #include <iostream>
 #include <vector>
-#include <fstream>
-
-GLuint loadTexture(int* width, int* height, const char* filename) {
-	GLuint main_texture;
-	glGenTextures(1, &main_texture);
-
-	glBindTexture(GL_TEXTURE_2D, main_texture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	int comp;
-	unsigned char* data = stbi_load(filename, width, height, &comp, 4);
-	if (data == nullptr)
-		return 0;
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, *width, *height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-	return main_texture;
-}
 
 GLuint loadShader(const char* shader_src, GLenum shader_type) {
 	GLuint shader = glCreateShader(shader_type);
@@ -51,17 +30,11 @@ GLuint loadShader(const char* shader_src, GLenum shader_type) {
 }
 
 std::string loadTextFile(const std::string& filename) {
-	std::string ret;
-	
-	std::ifstream f(filename);
-	if (f) {
-		f.seekg(0, std::ios::end);
-		ret.resize(static_cast<size_t>(f.tellg()));
-		f.seekg(0);
-		f.read(&ret[0], ret.size());
-	}
-
-	return ret;
+	// Copied once, straight from the page cache.
+	MappedFile f;
+	if (!f.open(filename.c_str()) || f.data() == nullptr)
+		return std::string();
+	return std::string(reinterpret_cast<const char*>(f.data()), f.size());
 }
 
 GLuint loadShaderProgram() {
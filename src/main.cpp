@@ -11,11 +11,23 @@
 #include <array>
 #include <algorithm>
 #include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
 #include "util.hpp"
 #include "Fixed.hpp"
 #include "SpriteBuffer.hpp"
 #include "vec2.hpp"
 #include "graphics_init.hpp"
+#include "Game.hpp"
+#include "Replay.hpp"
+#include "Snapshot.hpp"
+#include "BatchRunner.hpp"
+#include "Benchmarks.hpp"
+#include "ThreadPool.hpp"
+#include "TextureLoader.hpp"
+#include "Animation.hpp"
 
 std::vector<Sprite> debug_sprites;
 
@@ -28,218 +40,6 @@ void debugPoint(int x, int y) {
 	debug_sprites.push_back(spr);
 }
 
-struct Gem {
-	fixed24_8 pos_x;
-	fixed24_8 pos_y;
-
-	fixed16_16 vel_x;
-	fixed16_16 vel_y;
-
-	int score_value;
-	static const int MAX_VALUE = 10000;
-	static const int INITIAL_VALUE = 100;
-
-	static const int RADIUS = 8;
-	static const int MERGE_SPEED = 6;
-};
-
-struct Paddle {
-	fixed24_8 pos_x;
-	fixed24_8 pos_y;
-
-	fixed8_24 rotation;
-
-	SpriteMatrix getSpriteMatrix() const {
-		return SpriteMatrix().loadIdentity().rotate(rotation.toFloat());
-	};
-};
-
-static const fixed24_8 PADDLE_MOVEMENT_SPEED(4);
-static const fixed8_24 PADDLE_MAX_ROTATION(15);
-static const fixed8_24 PADDLE_ROTATION_RATE(3);
-static const fixed8_24 PADDLE_ROTATION_RETURN_RATE(1);
-
-struct GameState {
-	RandomGenerator rng;
-
-	Paddle paddle;
-	std::vector<Gem> gems;
-
-	int score;
-	int lives;
-
-	GameState()
-		: score(0), lives(5)
-	{ }
-};
-
-static const int WINDOW_WIDTH = 240;
-static const int WINDOW_HEIGHT = 360;
-
-// Splits vector vel into components parallel and perpendicular to the normal
-// of the plane n.
-void splitVector(vec2 vel, vec2 n, vec2* out_par, vec2* out_perp) {
-	vec2 par = dot(vel, n) * n;
-	*out_par = par;
-	*out_perp = vel - par;
-}
-
-void collideBallWithBoundary(Gem& ball) {
-	// Left boundary
-	if (ball.pos_x - Gem::RADIUS < 0) {
-		ball.vel_x = -ball.vel_x;
-		ball.pos_x = Gem::RADIUS;
-	}
-
-	// Right boundary
-	if (ball.pos_x + Gem::RADIUS > WINDOW_WIDTH) {
-		ball.vel_x = -ball.vel_x;
-		ball.pos_x = WINDOW_WIDTH - Gem::RADIUS;
-	}
-
-	// Top boundary
-	/*
-	if (ball.pos_y - Gem::RADIUS < 0) {
-		ball.vel_y = -ball.vel_y;
-		ball.pos_y = Gem::RADIUS;
-	}
-	*/
-
-	// Bottom boundary
-	/*
-	if (ball.pos_y + Gem::RADIUS > WINDOW_HEIGHT) {
-		ball.vel_y = -ball.vel_y;
-		ball.pos_y = WINDOW_HEIGHT - Gem::RADIUS;
-	}
-	*/
-}
-
-void collideBallWithBall(Gem& a, Gem& b) {
-	vec2 dv = {(a.pos_x - b.pos_x).toFloat(), (a.pos_y - b.pos_y).toFloat()};
-	float d_sqr = length_sqr(dv);
-
-	if (d_sqr < (2*Gem::RADIUS)*(2*Gem::RADIUS)) {
-		fixed16_16 rel_vel_x = a.vel_x - b.vel_x;
-		fixed16_16 rel_vel_y = a.vel_y - b.vel_y;
-		vec2 rel_vel = {rel_vel_x.toFloat(), rel_vel_y.toFloat()};
-		float rel_speed_sqr = length_sqr(rel_vel);
-		
-		if (rel_speed_sqr >= Gem::MERGE_SPEED*Gem::MERGE_SPEED) {
-			fixed32_0 two(2);
-			a.pos_x = (a.pos_x + b.pos_x) / two;
-			a.pos_y = (a.pos_y + b.pos_y) / two;
-
-			a.vel_x = a.vel_x + b.vel_x;
-			a.vel_y = a.vel_y + b.vel_y;
-
-			a.score_value += b.score_value;
-
-			b.pos_x = -9999;
-			b.pos_y = 9999;
-			b.vel_x = b.vel_y = 0;
-			b.score_value = 0;
-		} else {
-			float d = std::sqrt(d_sqr);
-			float sz = Gem::RADIUS - d / 2.0f;
-
-			vec2 normal = dv / d;
-			fixed24_8 push_back_x(sz * normal.x);
-			fixed24_8 push_back_y(sz * normal.y);
-
-			a.pos_x += push_back_x;
-			a.pos_y += push_back_y;
-			b.pos_x -= push_back_x;
-			b.pos_y -= push_back_y;
-
-			vec2 a_par, a_perp;
-			vec2 b_par, b_perp;
-
-			vec2 a_vel = {a.vel_x.toFloat(), a.vel_y.toFloat()};
-			vec2 b_vel = {b.vel_x.toFloat(), b.vel_y.toFloat()};
-			splitVector(a_vel, normal, &a_par, &a_perp);
-			splitVector(b_vel, -normal, &b_par, &b_perp);
-
-			static const float friction = 1.0f;
-			static const float bounce = 0.9f;
-
-			float A = (1.0f + bounce) / 2.0f;
-			float B = (1.0f - bounce) / 2.0f;
-
-			a_vel = A*b_par + B*a_par + friction*a_perp;
-			b_vel = A*a_par + B*b_par + friction*b_perp;
-
-			a.vel_x = fixed16_16(a_vel.x);
-			a.vel_y = fixed16_16(a_vel.y);
-
-			b.vel_x = fixed16_16(b_vel.x);
-			b.vel_y = fixed16_16(b_vel.y);
-		}
-	}
-}
-
-// Returns the nearest point in line segment a-b to point p.
-vec2 pointLineSegmentNearestPoint(vec2 p, vec2 a, vec2 b) {
-	// Taken from http://stackoverflow.com/a/1501725
-	const float l2 = length_sqr(b - a);
-	if (l2 == 0.0f) {
-		return a;
-	}
-
-	const float t = dot(p - a, b - a) / l2;
-	if (t < 0.0f) {
-		return a;
-	} else if (t > 1.0f) {
-		return b;
-	} else {
-		return a + t * (b - a);
-	}
-}
-
-void collideBallWithPaddle(Gem& ball, const Paddle& paddle) {
-	SpriteMatrix matrix = paddle.getSpriteMatrix();
-
-	// Left sphere
-	vec2 left = {-24, 0};
-	// Right sphere
-	vec2 right = {24, 0};
-
-	matrix.transform(&left.x, &left.y);
-	matrix.transform(&right.x, &right.y);
-
-	static const int PADDLE_RADIUS = 8;
-
-	fixed24_8 rel_ball_x = ball.pos_x - paddle.pos_x;
-	fixed24_8 rel_ball_y = ball.pos_y - paddle.pos_y;
-	vec2 rel_ball = {rel_ball_x.toFloat(), rel_ball_y.toFloat()};
-
-	vec2 nearest_point = pointLineSegmentNearestPoint(rel_ball, left, right);
-	vec2 penetration = rel_ball - nearest_point;
-	float d_sqr = length_sqr(penetration);
-	float r = PADDLE_RADIUS + Gem::RADIUS;
-	if (d_sqr < r*r) {
-		vec2 vel = {ball.vel_x.toFloat(), ball.vel_y.toFloat()};
-		int score_addition = static_cast<int>(ball.score_value * (ball.vel_y.toFloat() / 128.f));
-		ball.score_value = std::min(ball.score_value + std::max(score_addition, 0), Gem::MAX_VALUE);
-
-		float d = std::sqrt(d_sqr);
-		float sz = r - d;
-
-		vec2 normal = penetration / d;
-		fixed24_8 push_back_x(sz * normal.x);
-		fixed24_8 push_back_y(sz * normal.y);
-
-		ball.pos_x += push_back_x;
-		ball.pos_y += push_back_y;
-
-		vec2 par, perp;
-		splitVector(vel, normal, &par, &perp);
-		vel = perp - par;
-
-		ball.vel_x = fixed16_16(vel.x);
-		ball.vel_y = fixed16_16(vel.y);
-	}
-}
-
 void hsvToRgb(float h, float s, float v, float* out_r, float* out_g, float* out_b) {
 	// Taken from http://www.cs.rit.edu/~ncs/color/t_convert.html
 
@@ -297,15 +97,193 @@ void drawText(int x, int y, const std::string& text, SpriteBuffer& buffer, const
 	}
 }
 
-int main() {
+static const uint32_t DEFAULT_SEED = 123;
+
+// One game step per frame, at the monitor's refresh rate.
+static const float FRAME_MS = 1000.0f / 60.0f;
+
+// Packed into the texture after graphics.png, in this order. Gems loop the
+// first; the second plays once where gems merge.
+static const char* const ANIMATION_FILES[] = {"gem.gif", "merge.gif"};
+enum {
+	GEM_ANIMATION,
+	MERGE_ANIMATION
+};
+
+struct Effect {
+	int x, y; // Center
+	Animation animation;
+};
+
+// Replays a recorded session as fast as possible, without opening a window.
+// If rollback_frames is non-zero, every frame is also rewound that many frames
+// and re-simulated, to check and time the snapshot system. Contacts are solved
+// on thread_count threads (0 for all hardware threads).
+int runReplay(const char* filename, unsigned int rollback_frames, BroadphaseType broadphase, unsigned int thread_count) {
+	Replay replay;
+	if (!loadReplay(&replay, filename))
+		return 1;
+
+	GameState game_state;
+	initGameState(game_state, replay.seed);
+	StepContext context;
+	context.broadphase.setType(broadphase);
+	ThreadPool thread_pool(thread_count);
+	if (thread_pool.threadCount() > 1)
+		context.thread_pool = &thread_pool;
+
+	bool check_hashes = !replay.hashes.empty();
+	size_t first_divergence = replay.inputs.size();
+
+	static const unsigned int MAX_SNAPSHOT_GEMS = 4096;
+	SnapshotRing snapshots(rollback_frames + 1, MAX_SNAPSHOT_GEMS);
+	unsigned int rollback_count = 0;
+	unsigned int rollback_mismatches = 0;
+	double rollback_total_ms = 0.0;
+	double rollback_max_ms = 0.0;
+	uint64_t total_active_gems = 0;
+	uint64_t total_sleeping_gems = 0;
+	uint64_t total_substeps = 0;
+	unsigned int max_substeps = 0;
+	uint64_t total_clamped_gems = 0;
+	unsigned int event_counts[GameEvent::GEM_LOST + 1] = {0};
+	uint64_t dropped_events = 0;
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+	for (size_t frame = 0; frame < replay.inputs.size(); ++frame) {
+		stepGame(game_state, replay.inputs[frame], context);
+		total_active_gems += context.stats.active_gems;
+		total_sleeping_gems += context.stats.sleeping_gems;
+		total_substeps += context.stats.substeps;
+		max_substeps = std::max(max_substeps, context.stats.substeps);
+		total_clamped_gems += context.stats.clamped_gems;
+		for (const GameEvent& e : context.events) {
+			event_counts[e.type] += 1;
+		}
+		dropped_events += context.events.dropped();
+
+		if (check_hashes && hashGameState(game_state) != replay.hashes[frame]) {
+			first_divergence = frame;
+			check_hashes = false;
+		}
+
+		if (rollback_frames > 0) {
+			if (!snapshots.save(game_state)) {
+				std::cerr << "Too many gems to snapshot at frame " << frame << ".\n";
+				return 1;
+			}
+
+			if (snapshots.size() > rollback_frames) {
+				uint64_t expected_hash = hashGameState(game_state);
+
+				auto rollback_start = std::chrono::high_resolution_clock::now();
+				rewindAndResimulate(snapshots, game_state, rollback_frames, &replay.inputs[frame + 1 - rollback_frames], context);
+				auto rollback_end = std::chrono::high_resolution_clock::now();
+
+				double ms = std::chrono::duration_cast<std::chrono::nanoseconds>(rollback_end - rollback_start).count() / 1000000.0;
+				rollback_total_ms += ms;
+				rollback_max_ms = std::max(rollback_max_ms, ms);
+				rollback_count += 1;
+				if (hashGameState(game_state) != expected_hash)
+					rollback_mismatches += 1;
+			}
+		}
+	}
+	auto end_time = std::chrono::high_resolution_clock::now();
+
+	double elapsed_ms = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count() / 1000.0;
+	std::cout << "Replayed " << replay.inputs.size() << " frames in " << elapsed_ms << " ms";
+	if (elapsed_ms > 0.0)
+		std::cout << " (" << (replay.inputs.size() / elapsed_ms * 1000.0) << " frames/s)";
+	std::cout << "\n";
+	std::cout << "Final state: " << game_state.gems.size() << " gems, score " << game_state.score << ", lives " << game_state.lives << "\n";
+	if (!replay.inputs.empty()) {
+		std::cout << "Gems per frame: " << double(total_active_gems) / replay.inputs.size() << " active, "
+			<< double(total_sleeping_gems) / replay.inputs.size() << " sleeping on average; "
+			<< context.stats.sleeping_islands << " sleeping islands at the end\n";
+		std::cout << "Sub-steps for fast gems: " << double(total_substeps) / replay.inputs.size()
+			<< " per frame on average, " << max_substeps << " max; " << total_clamped_gems << " gems capped at "
+			<< Gem::MAX_SUBSTEPS << "\n";
+		std::cout << "Events: " << event_counts[GameEvent::GEM_SPAWNED] << " spawns, "
+			<< event_counts[GameEvent::PADDLE_HIT] << " paddle hits, "
+			<< event_counts[GameEvent::GEMS_MERGED] << " merges, "
+			<< event_counts[GameEvent::GEM_LOST] << " gems lost, " << dropped_events << " dropped\n";
+	}
+
+	if (rollback_count > 0) {
+		std::cout << "Rolled back " << rollback_frames << " frames " << rollback_count << " times: "
+			<< (rollback_total_ms / rollback_count) << " ms average, " << rollback_max_ms << " ms max, "
+			<< rollback_mismatches << " mismatches\n";
+	}
+
+	if (replay.hashes.empty()) {
+		std::cout << "Replay has no state hashes, determinism not checked.\n";
+	} else if (first_divergence != replay.inputs.size()) {
+		std::cout << "State diverged from recording at frame " << first_divergence << ".\n";
+		return 2;
+	} else {
+		std::cout << "State matched recording on all frames.\n";
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	const char* record_filename = nullptr;
+	const char* replay_filename = nullptr;
+	unsigned int rollback_frames = 0;
+	bool run_batch = false;
+	BatchConfig batch_config;
+	BroadphaseType broadphase = BROADPHASE_GRID;
+	unsigned int replay_threads = 1;
+
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record_filename = argv[++i];
+		} else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay_filename = argv[++i];
+		} else if (std::strcmp(argv[i], "--rollback") == 0 && i + 1 < argc) {
+			rollback_frames = std::atoi(argv[++i]);
+		} else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+			run_batch = true;
+			batch_config.game_count = std::atoi(argv[++i]);
+		} else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			batch_config.frames_per_game = std::atoi(argv[++i]);
+		} else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			batch_config.thread_count = replay_threads = std::atoi(argv[++i]);
+		} else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			batch_config.first_seed = std::strtoul(argv[++i], nullptr, 10);
+		} else if (std::strcmp(argv[i], "--broadphase") == 0 && i + 1 < argc) {
+			if (!parseBroadphaseType(argv[++i], &broadphase)) {
+				std::cerr << "Unknown broadphase \"" << argv[i] << "\", expected brute, grid or sap.\n";
+				return 1;
+			}
+		} else if (std::strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+			return runBenchmark(argv[i + 1]);
+		} else {
+			std::cerr << "Usage: " << argv[0] << " [--record <file> | --replay <file> [--rollback <frames>] [--threads <n>]] [--broadphase brute|grid|sap]\n";
+			std::cerr << "       " << argv[0] << " --batch <games> [--frames <n>] [--threads <n>] [--seed <first seed>] [--broadphase brute|grid|sap]\n";
+			std::cerr << "       " << argv[0] << " --bench <name>\n";
+			return 1;
+		}
+	}
+
+	if (replay_filename)
+		return runReplay(replay_filename, rollback_frames, broadphase, replay_threads);
+	if (run_batch) {
+		batch_config.broadphase = broadphase;
+		return runBatchCommand(batch_config);
+	}
+
 	if (!initWindow(WINDOW_WIDTH, WINDOW_HEIGHT)) {
 		std::cerr << "Failed to initialize window.\n";
 		return 1;
 	}
 
-	int tex_width, tex_height;
-	GLuint main_texture = loadTexture(&tex_width, &tex_height, "graphics.png");
-	assert(main_texture != 0);
+	// Owned through a pointer so it can be destroyed before the GL context.
+	std::unique_ptr<TextureLoader> texture_loader(new TextureLoader);
+	TextureHandle main_texture = texture_loader->load("graphics.png",
+		std::vector<std::string>(ANIMATION_FILES, ANIMATION_FILES + sizeof(ANIMATION_FILES) / sizeof(ANIMATION_FILES[0])));
 
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -327,15 +305,13 @@ int main() {
 	CHECK_GL_ERROR;
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, main_texture);
 
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
 	CHECK_GL_ERROR;
 
 	SpriteBuffer sprite_buffer;
-	sprite_buffer.tex_width = static_cast<float>(tex_width);
-	sprite_buffer.tex_height = static_cast<float>(tex_height);
+	bool texture_bound = false;
 
 	GLuint vao_id;
 	glGenVertexArrays(1, &vao_id);
@@ -359,24 +335,21 @@ int main() {
 	// Initialize game state //
 	///////////////////////////
 	GameState game_state;
-	RandomGenerator& rng = game_state.rng;
-	rng.seed(123);
-
-	{
-		Paddle& p = game_state.paddle;
-		p.pos_x = WINDOW_WIDTH / 2;
-		p.pos_y = WINDOW_HEIGHT - 32;
-		p.rotation = 0;
-	}
+	initGameState(game_state, DEFAULT_SEED);
+	StepContext step_context;
+	step_context.broadphase.setType(broadphase);
+
+	Replay recording;
+	recording.seed = DEFAULT_SEED;
 
 	Sprite paddle_spr;
 	paddle_spr.setImg(0, 0, 64, 16);
 
 	Sprite gem_spr;
 	gem_spr.setImg(0, 16, 16, 16);
+	Animation gem_animation;
 
-	static const int GEM_SPAWN_INTERVAL = 60*5;
-	int gem_spawn_timer = GEM_SPAWN_INTERVAL;
+	std::vector<Effect> effects;
 
 	CHECK_GL_ERROR;
 
@@ -385,75 +358,78 @@ int main() {
 	////////////////////
 	bool running = true;
 	while (running) {
-		/* Update paddle */
-		{
-			Paddle& paddle = game_state.paddle;
-
-			fixed24_8 paddle_speed(0);
-			fixed8_24 rotation = 0;
-			if (glfwGetKey(GLFW_KEY_LEFT)) {
-				paddle_speed -= PADDLE_MOVEMENT_SPEED;
-				rotation -= PADDLE_ROTATION_RATE;
-			}
-			if (glfwGetKey(GLFW_KEY_RIGHT)) {
-				paddle_speed += PADDLE_MOVEMENT_SPEED;
-				rotation += PADDLE_ROTATION_RATE;
-			}
-
-			if (rotation == 0) {
-				paddle.rotation = stepTowards(paddle.rotation, fixed8_24(0), PADDLE_ROTATION_RETURN_RATE);
-			} else {
-				paddle.rotation = clamp(-PADDLE_MAX_ROTATION, paddle.rotation + rotation, PADDLE_MAX_ROTATION);
+		texture_loader->update();
+		if (!texture_bound && texture_loader->isReady(main_texture)) {
+			glBindTexture(GL_TEXTURE_2D, texture_loader->texture(main_texture));
+			sprite_buffer.tex_width = static_cast<float>(texture_loader->width(main_texture));
+			sprite_buffer.tex_height = static_cast<float>(texture_loader->height(main_texture));
+			gem_animation.play(&texture_loader->animation(main_texture, GEM_ANIMATION), true);
+			texture_bound = true;
+		}
+		if (!texture_bound) {
+			if (texture_loader->state(main_texture) == TextureLoader::FAILED) {
+				std::cerr << "Failed to load graphics.png.\n";
+				break;
 			}
-			paddle.pos_x += paddle_speed;
+			// Nothing to draw with yet, so hold the game until there is.
+			glClear(GL_COLOR_BUFFER_BIT);
+			glfwSwapBuffers();
+			running = running && glfwGetWindowParam(GLFW_OPENED);
+			continue;
 		}
 
-		/* Spawn new gems */
-		if (--gem_spawn_timer == 0) {
-			gem_spawn_timer = GEM_SPAWN_INTERVAL;
-
-			Gem b;
-			b.pos_x = randRange(rng, WINDOW_WIDTH * 1 / 6, WINDOW_WIDTH * 5 / 6);
-			b.pos_y = -10;
-			b.vel_x = b.vel_y = 0;
-			b.score_value = Gem::INITIAL_VALUE;
+		InputState input = 0;
+		if (glfwGetKey(GLFW_KEY_LEFT))
+			input |= INPUT_LEFT;
+		if (glfwGetKey(GLFW_KEY_RIGHT))
+			input |= INPUT_RIGHT;
 
-			game_state.gems.push_back(b);
+		stepGame(game_state, input, step_context);
+		if (record_filename) {
+			recording.inputs.push_back(input);
+			recording.hashes.push_back(hashGameState(game_state));
 		}
 
-		/* Update balls */
-		for (unsigned int i = 0; i < game_state.gems.size(); ++i) {
-			Gem& ball = game_state.gems[i];
-
-			ball.vel_y += fixed16_16(0, 1, 8);
-
-			ball.pos_x += fixed24_8(ball.vel_x);
-			ball.pos_y += fixed24_8(ball.vel_y);
-
-			collideBallWithBoundary(ball);
-			for (unsigned int j = i + 1; j < game_state.gems.size(); ++j) {
-				collideBallWithBall(ball, game_state.gems[j]);
+		gem_animation.advance(FRAME_MS);
+		for (Effect& effect : effects) {
+			effect.animation.advance(FRAME_MS);
+		}
+		effects.erase(std::remove_if(effects.begin(), effects.end(), [](const Effect& effect) { return effect.animation.finished(); }), effects.end());
+		const AnimationClip& merge_clip = texture_loader->animation(main_texture, MERGE_ANIMATION);
+		if (!merge_clip.empty()) {
+			for (const GameEvent& e : step_context.events) {
+				if (e.type != GameEvent::GEMS_MERGED)
+					continue;
+				Effect effect;
+				effect.x = e.pos_x.integer();
+				effect.y = e.pos_y.integer();
+				effect.animation.play(&merge_clip, false);
+				effects.push_back(effect);
 			}
-			collideBallWithPaddle(ball, game_state.paddle);
 		}
 
-		/* Clean up dead gems */
-		remove_if(game_state.gems, [](const Gem& gem) {
-			return gem.pos_y > WINDOW_HEIGHT + 128 && gem.vel_y > 0;
-		});
-
 		/* Draw scene */
 		sprite_buffer.clear();
 		
 		paddle_spr.setPos(game_state.paddle.pos_x.integer(), game_state.paddle.pos_y.integer());
 		sprite_buffer.append(paddle_spr, game_state.paddle.getSpriteMatrix());
 
+		gem_animation.apply(gem_spr);
 		for (const Gem& gem : game_state.gems) {
-			gem_spr.setPos(gem.pos_x.integer() - gem_spr.img_w / 2, gem.pos_y.integer() - gem_spr.img_h / 2);
+			gem_spr.setPos(gem.pos_x.integer(), gem.pos_y.integer());
 			float r, g, b;
 			hsvToRgb(mapScoreToHue(gem.score_value), 1.0f, 1.0f, &r, &g, &b);
 			gem_spr.color = makeColor(uint8_t(r*255 + 0.5f), uint8_t(g*255 + 0.5f), uint8_t(b*255 + 0.5f), 255);
-			sprite_buffer.append(gem_spr);
+			// The sprite is as wide as the gem.
+			float scale = gem.radius.toFloat() * 2 / gem_spr.img_w;
+			sprite_buffer.append(gem_spr, SpriteMatrix().loadIdentity().scale(scale, scale));
+		}
+
+		for (const Effect& effect : effects) {
+			Sprite effect_spr;
+			effect.animation.apply(effect_spr);
+			effect_spr.setPos(effect.x, effect.y);
+			sprite_buffer.append(effect_spr, SpriteMatrix().loadIdentity());
 		}
 
 		// HUD
@@ -498,6 +474,10 @@ int main() {
 		CHECK_GL_ERROR;
 	}
 
+	texture_loader.reset();
 	glfwCloseWindow();
 	glfwTerminate();
+
+	if (record_filename && !saveReplay(recording, record_filename))
+		return 1;
 }
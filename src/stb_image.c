@@ -19,7 +19,8 @@
 
       - decode from memory or through FILE (define STBI_NO_STDIO to remove code)
       - decode from arbitrary I/O callbacks
-      - overridable dequantizing-IDCT, YCbCr-to-RGB conversion (define STBI_SIMD)
+      - overridable dequantizing-IDCT, YCbCr-to-RGB conversion (define STBI_SIMD;
+        always on with SSE2, which installs SSE2 versions of both)
 
    Latest revisions:
       1.33 (2011-07-14) minor fixes suggested by Dave Moore
@@ -192,6 +193,7 @@
 
 #include <stdio.h>
 #endif
+#include <stddef.h>
 
 #define STBI_VERSION 1
 
@@ -263,8 +265,7 @@ extern int      stbi_is_hdr_from_file(FILE *f);
 #endif // STBI_NO_STDIO
 
 
-// get a VERY brief reason for failure
-// NOT THREADSAFE
+// get a VERY brief reason for failure of the last call on this thread
 extern const char *stbi_failure_reason  (void); 
 
 // free the loaded image -- this is just free()
@@ -278,6 +279,19 @@ extern int      stbi_info_from_callbacks(stbi_io_callbacks const *clbk, void *us
 extern int      stbi_info            (char const *filename,     int *x, int *y, int *comp);
 extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
 
+// maps a whole file read-only, as the calls taking a filename do: its pages
+// are read in as they're touched, and nothing is copied. an empty file maps
+// with 'data' NULL and 'size' 0. returns 0 if the file can't be opened or
+// mapped, and always if STBI_NO_MMAP is defined. unmapping clears 'm'
+typedef struct
+{
+   stbi_uc *data;
+   size_t size;
+   void *file, *mapping; // windows handles
+} stbi_mapped_file;
+
+extern int      stbi_map_file        (stbi_mapped_file *m, char const *filename);
+extern void     stbi_unmap_file      (stbi_mapped_file *m);
 #endif
 
 
@@ -291,6 +305,95 @@ extern void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply
 // or just pass them through "as-is"
 extern void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 
+// limit the SIMD code used by the decoders, mainly for testing them against
+// the plain C code: 0 = plain C only, 1 = up to SSE2, 2 = up to SSSE3 (the
+// default). what the CPU doesn't support is never used either way.
+extern void stbi_set_simd_level(int level);
+
+// inflate normally decodes through tables that give a whole literal pair, or
+// a length or distance with its extra bits, per lookup. pass 0 to decode one
+// symbol at a time instead, as earlier versions did, to compare against it
+extern void stbi_set_inflate_fast_tables(int flag_true_if_should_use);
+
+// GIF normally writes each LZW string straight into the frame, backwards
+// from its end. pass 0 to write it a pixel at a time, recursing through the
+// code table, as earlier versions did, to compare against it
+extern void stbi_set_gif_direct_strings(int flag_true_if_should_use);
+
+// the calls above set options shared by every decode, so make them before
+// decoding starts. to decode with options of your own, or to keep the
+// failure reason with the call instead of the thread, fill in a context
+// with stbi_context_init, change what you like, and pass it to the _ctx
+// functions. a context can be used by one call at a time.
+
+// where a context's calls get their memory, the returned images included.
+// leave 'allocate' NULL to use malloc/realloc/free. 'reallocate' and
+// 'release' may be NULL too: growing then allocates and copies, and nothing
+// is released, so an arena can hand out memory for a whole load and be
+// reset afterwards. images from these calls aren't freed by stbi_image_free
+typedef struct
+{
+   void *(*allocate)  (void *user, size_t size);
+   void *(*reallocate)(void *user, void *p, size_t old_size, size_t new_size);
+   void  (*release)   (void *user, void *p);
+   void *user;
+} stbi_allocator;
+
+typedef struct
+{
+   int unpremultiply_on_load;
+   int convert_iphone_png_to_rgb;
+   int simd_level;
+   int inflate_fast_tables;
+   int gif_direct_strings;
+   float hdr_to_ldr_gamma, hdr_to_ldr_scale;
+   float ldr_to_hdr_gamma, ldr_to_hdr_scale;
+   stbi_allocator allocator;
+
+   // why the last call with this context failed; NULL if it didn't
+   const char *failure_reason;
+   char failure_text[32];
+} stbi_context;
+
+// copies the shared options into 'ctx'
+extern void     stbi_context_init(stbi_context *ctx);
+
+extern stbi_uc *stbi_load_from_memory_ctx   (stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
+extern stbi_uc *stbi_load_from_callbacks_ctx(stbi_context *ctx, stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp);
+extern int      stbi_info_from_memory_ctx   (stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+
+// decodes into memory you provide instead of allocating the image: rows of
+// req_comp (1-4) bytes per pixel go 'stride' bytes apart, the first at 'out',
+// and nothing outside the image's pixels is written. fails without writing
+// anything if the image is larger than out_w by out_h, so size the buffer
+// with stbi_info_from_memory first. JPEGs and plain PNGs decode straight
+// into it; other images go through the context's allocator and are copied.
+// 'ctx' may be NULL for the shared options. returns 1 on success
+extern int      stbi_load_into(stbi_context *ctx, stbi_uc const *buffer, int len, stbi_uc *out, int stride, int out_w, int out_h, int *x, int *y, int *comp, int req_comp);
+
+// decodes a PNG a row at a time, without holding the compressed data or the
+// image: each row of x pixels of req_comp (1-4) bytes is passed to 'row' as
+// soon as it's unfiltered, top to bottom, and is only valid during the call.
+// *x, *y and *comp are set before the first row. return 0 from 'row' to stop
+// decoding. interlaced and iPhone PNGs aren't supported, so fall back to the
+// other calls when this fails. 'ctx' may be NULL. returns 1 on success
+typedef int (*stbi_png_row_callback)(void *user, int y, stbi_uc const *row);
+
+extern int      stbi_png_rows_from_memory   (stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_png_row_callback row, void *user);
+extern int      stbi_png_rows_from_callbacks(stbi_context *ctx, stbi_io_callbacks const *clbk, void *io_user, int *x, int *y, int *comp, int req_comp, stbi_png_row_callback row, void *user);
+
+// the frames of an animated GIF, one at a time. each is the whole x by y
+// image, RGBA, drawn over the frames before it as the file says, and stays
+// valid until the next call. 'delay' is how long to show it for in 1/100s,
+// 0 if the file doesn't say. 'buffer' must outlive the iterator, and 'ctx'
+// (which may be NULL) is used by every call with it. next_frame returns 1
+// for a frame, 0 after the last one and -1 if the file is corrupt
+typedef struct stbi_gif_frames stbi_gif_frames;
+
+extern stbi_gif_frames *stbi_gif_frames_from_memory(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y);
+extern int              stbi_gif_next_frame(stbi_gif_frames *f, stbi_uc const **pixels, int *delay);
+extern void             stbi_gif_frames_free(stbi_gif_frames *f);
+
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -302,7 +405,11 @@ extern char *stbi_zlib_decode_noheader_malloc(const char *buffer, int len, int *
 extern int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
 
 
-// define faster low-level operations (typically SIMD support)
+// define faster low-level operations (typically SIMD support). SSE2 builds
+// always have these; the JPEG decoder puts its own SSE2 versions in them
+#if !defined(STBI_SIMD) && !defined(STBI_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STBI_SIMD
+#endif
 #ifdef STBI_SIMD
 typedef void (*stbi_idct_8x8)(stbi_uc *out, int out_stride, short data[64], unsigned short *dequantize);
 // compute an integer IDCT on "input"
@@ -341,6 +448,19 @@ extern void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func);
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
 #endif
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+   #ifdef _WIN32
+      #ifndef WIN32_LEAN_AND_MEAN
+      #define WIN32_LEAN_AND_MEAN
+      #endif
+      #include <windows.h>
+   #else
+      #include <sys/mman.h>
+      #include <sys/stat.h>
+      #include <fcntl.h>
+      #include <unistd.h>
+   #endif
+#endif
 #include <stdlib.h>
 #include <memory.h>
 #include <assert.h>
@@ -356,6 +476,12 @@ extern void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func);
    #define stbi_inline __forceinline
 #endif
 
+#ifdef _MSC_VER
+   #define STBI_THREAD_LOCAL  __declspec(thread)
+#else
+   #define STBI_THREAD_LOCAL  __thread
+#endif
+
 
 // implementation:
 typedef unsigned char  uint8;
@@ -364,6 +490,11 @@ typedef   signed short  int16;
 typedef unsigned int   uint32;
 typedef   signed int    int32;
 typedef unsigned int   uint;
+#ifdef _MSC_VER
+typedef unsigned __int64 uint64;
+#else
+typedef unsigned long long uint64;
+#endif
 
 // should produce compiler error if size is wrong
 typedef unsigned char validate_uint32[sizeof(uint32)==4 ? 1 : -1];
@@ -378,12 +509,94 @@ typedef unsigned char validate_uint32[sizeof(uint32)==4 ? 1 : -1];
 #define STBI_HAS_LROTL
 #endif
 
+// little-endian CPUs that are fine with unaligned loads, so multi-byte
+// values can be read from the stream with a single load
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define STBI_LITTLE_ENDIAN_UNALIGNED
+#endif
+
 #ifdef STBI_HAS_LROTL
    #define stbi_lrot(x,y)  _lrotl(x,y)
 #else
    #define stbi_lrot(x,y)  (((x) << (y)) | ((x) >> (32 - (y))))
 #endif
 
+// SSE2 is a compile-time choice (always there on x64); SSSE3 code is compiled
+// in as well and only used if the CPU reports it at runtime
+#if !defined(STBI_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+   #define STBI_SSE2
+   #include <emmintrin.h>
+   #include <tmmintrin.h>
+   #ifdef _MSC_VER
+      #include <intrin.h>
+      #define STBI_SSSE3_TARGET
+   #else
+      #include <cpuid.h>
+      #define STBI_SSSE3_TARGET __attribute__((target("ssse3")))
+   #endif
+#endif
+
+#ifdef _MSC_VER
+   #define STBI_ALIGN16(decl)  __declspec(align(16)) decl
+#else
+   #define STBI_ALIGN16(decl)  decl __attribute__((aligned(16)))
+#endif
+
+enum
+{
+   STBI_SIMD_NONE, STBI_SIMD_SSE2, STBI_SIMD_SSSE3
+};
+
+static int stbi_cpu_simd(void)
+{
+   int level = STBI_SIMD_NONE;
+   #ifdef STBI_SSE2
+   #ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 1);
+   level = (info[2] & (1 << 9)) ? STBI_SIMD_SSSE3 : STBI_SIMD_SSE2;
+   #else
+   unsigned int eax, ebx, ecx, edx;
+   level = STBI_SIMD_SSE2;
+   if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3))
+      level = STBI_SIMD_SSSE3;
+   #endif
+   #endif
+   return level;
+}
+
+// the options for calls without a context. decoding only reads them
+static stbi_context stbi_shared =
+{
+   0, 0, STBI_SIMD_SSSE3, 1, 1,
+   2.2f, 1.0f,
+   2.2f, 1.0f,
+   { NULL, NULL, NULL, NULL },
+   NULL, ""
+};
+
+void stbi_set_simd_level(int level)
+{
+   stbi_shared.simd_level = level;
+}
+
+void stbi_set_inflate_fast_tables(int flag_true_if_should_use)
+{
+   stbi_shared.inflate_fast_tables = flag_true_if_should_use;
+}
+
+void stbi_set_gif_direct_strings(int flag_true_if_should_use)
+{
+   stbi_shared.gif_direct_strings = flag_true_if_should_use;
+}
+
+void stbi_context_init(stbi_context *ctx)
+{
+   *ctx = stbi_shared;
+   ctx->failure_reason = NULL;
+   ctx->failure_text[0] = 0;
+}
+
 ///////////////////////////////////////////////
 //
 //  stbi struct and start_xxx functions
@@ -404,14 +617,42 @@ typedef struct
 
    uint8 *img_buffer, *img_buffer_end;
    uint8 *img_buffer_original;
+
+   stbi_context *ctx;
+   int simd; // SIMD level for this call, -1 until a decoder asks
+
+   // the caller's pixels for stbi_load_into, NULL otherwise
+   uint8 *out;
+   int out_stride, out_w, out_h, out_n;
 } stbi;
 
+static int stbi_simd_level(stbi *s)
+{
+   if (s->simd < 0) {
+      s->simd = stbi_cpu_simd();
+      if (s->simd > s->ctx->simd_level) s->simd = s->ctx->simd_level;
+   }
+   return s->simd;
+}
+
+// where a decoder producing n bytes per pixel can write the image directly,
+// or NULL if it must allocate it
+static uint8 *stbi_direct_out(stbi *s, int n)
+{
+   if (s->out && n == s->out_n && s->img_x <= (uint32) s->out_w && s->img_y <= (uint32) s->out_h)
+      return s->out;
+   return NULL;
+}
+
 
 static void refill_buffer(stbi *s);
 
 // initialize a memory-decode context
 static void start_mem(stbi *s, uint8 const *buffer, int len)
 {
+   s->ctx = &stbi_shared;
+   s->simd = -1;
+   s->out = NULL;
    s->io.read = NULL;
    s->read_from_callbacks = 0;
    s->img_buffer = s->img_buffer_original = (uint8 *) buffer;
@@ -421,6 +662,9 @@ static void start_mem(stbi *s, uint8 const *buffer, int len)
 // initialize a callback-based context
 static void start_callbacks(stbi *s, stbi_io_callbacks *c, void *user)
 {
+   s->ctx = &stbi_shared;
+   s->simd = -1;
+   s->out = NULL;
    s->io = *c;
    s->io_user_data = user;
    s->buflen = sizeof(s->buffer_start);
@@ -438,7 +682,11 @@ static int stdio_read(void *user, char *data, int size)
 
 static void stdio_skip(void *user, unsigned n)
 {
+   int ch;
    fseek((FILE*) user, n, SEEK_CUR);
+   // fseek clears the end-of-file flag, so read a byte to set it again
+   ch = fgetc((FILE*) user);
+   if (ch != EOF) ungetc(ch, (FILE*) user);
 }
 
 static int stdio_eof(void *user)
@@ -460,6 +708,93 @@ static void start_file(stbi *s, FILE *f)
 
 //static void stop_file(stbi *s) { }
 
+int stbi_map_file(stbi_mapped_file *m, char const *filename)
+{
+   #ifdef STBI_NO_MMAP
+   STBI_NOTUSED(m);
+   STBI_NOTUSED(filename);
+   return 0;
+   #elif defined(_WIN32)
+   LARGE_INTEGER size;
+   HANDLE file, mapping;
+   m->data = NULL;
+   m->size = 0;
+   m->file = m->mapping = NULL;
+   file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+   if (file == INVALID_HANDLE_VALUE) return 0;
+   if (!GetFileSizeEx(file, &size) || size.QuadPart < 0 || (uint64) size.QuadPart > (size_t) -1) {
+      CloseHandle(file);
+      return 0;
+   }
+   m->file = file;
+   m->size = (size_t) size.QuadPart;
+   if (m->size == 0) return 1; // empty files can't be mapped
+   mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+   m->data = mapping ? (uint8 *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+   if (m->data == NULL) {
+      if (mapping) CloseHandle(mapping);
+      CloseHandle(file);
+      m->size = 0;
+      m->file = NULL;
+      return 0;
+   }
+   m->mapping = mapping;
+   return 1;
+   #else
+   struct stat st;
+   void *data;
+   int fd = open(filename, O_RDONLY);
+   m->data = NULL;
+   m->size = 0;
+   m->file = m->mapping = NULL;
+   if (fd < 0) return 0;
+   if (fstat(fd, &st) != 0 || st.st_size < 0 || (uint64) st.st_size > (size_t) -1) {
+      close(fd);
+      return 0;
+   }
+   if (st.st_size == 0) { // empty files can't be mapped
+      close(fd);
+      return 1;
+   }
+   data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd); // the mapping keeps the file open
+   if (data == MAP_FAILED) return 0;
+   m->data = (uint8 *) data;
+   m->size = (size_t) st.st_size;
+   return 1;
+   #endif
+}
+
+void stbi_unmap_file(stbi_mapped_file *m)
+{
+   #ifdef STBI_NO_MMAP
+   STBI_NOTUSED(m);
+   #elif defined(_WIN32)
+   if (m->data) UnmapViewOfFile(m->data);
+   if (m->mapping) CloseHandle((HANDLE) m->mapping);
+   if (m->file) CloseHandle((HANDLE) m->file);
+   #else
+   if (m->data) munmap(m->data, m->size);
+   #endif
+   m->data = NULL;
+   m->size = 0;
+   m->file = m->mapping = NULL;
+}
+
+// the calls taking a filename map the file and read it from memory, which
+// skips stdio's buffer copies and, for stbi_info, reads only the pages
+// holding the header. files that can't be mapped, or are empty or too large
+// for an int length, are read through stdio instead
+static int map_file(stbi_mapped_file *m, char const *filename)
+{
+   if (!stbi_map_file(m, filename)) return 0;
+   if (m->size == 0 || m->size > 0x7fffffff) {
+      stbi_unmap_file(m);
+      return 0;
+   }
+   return 1;
+}
+
 #endif // !STBI_NO_STDIO
 
 static void stbi_rewind(stbi *s)
@@ -492,8 +827,10 @@ static stbi_uc *stbi_gif_load(stbi *s, int *x, int *y, int *comp, int req_comp);
 static int      stbi_gif_info(stbi *s, int *x, int *y, int *comp);
 
 
-// this is not threadsafe
-static const char *failure_reason;
+// the _ctx functions move these into their context before returning.
+// failure_text holds messages built while decoding
+static STBI_THREAD_LOCAL const char *failure_reason;
+static STBI_THREAD_LOCAL char failure_text[32];
 
 const char *stbi_failure_reason(void)
 {
@@ -526,9 +863,44 @@ void stbi_image_free(void *retval_from_stbi_load)
    free(retval_from_stbi_load);
 }
 
+// the allocator of the context this thread is decoding with, NULL for libc.
+// every allocation below goes through these
+static STBI_THREAD_LOCAL const stbi_allocator *allocator;
+
+static void *stbi_malloc(size_t size)
+{
+   if (allocator)
+      return allocator->allocate(allocator->user, size);
+   return malloc(size);
+}
+
+// unlike realloc, needs the size 'p' was allocated with
+static void *stbi_realloc(void *p, size_t old_size, size_t new_size)
+{
+   void *q;
+   if (!allocator)
+      return realloc(p, new_size);
+   if (allocator->reallocate)
+      return allocator->reallocate(allocator->user, p, old_size, new_size);
+   q = allocator->allocate(allocator->user, new_size);
+   if (q && p) {
+      memcpy(q, p, old_size < new_size ? old_size : new_size);
+      if (allocator->release) allocator->release(allocator->user, p);
+   }
+   return q;
+}
+
+static void stbi_free(void *p)
+{
+   if (!allocator)
+      free(p);
+   else if (p && allocator->release)
+      allocator->release(allocator->user, p);
+}
+
 #ifndef STBI_NO_HDR
-static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
-static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp);
+static float   *ldr_to_hdr(stbi *s, stbi_uc *data, int x, int y, int comp);
+static stbi_uc *hdr_to_ldr(stbi *s, float   *data, int x, int y, int comp);
 #endif
 
 static unsigned char *stbi_load_main(stbi *s, int *x, int *y, int *comp, int req_comp)
@@ -543,7 +915,7 @@ static unsigned char *stbi_load_main(stbi *s, int *x, int *y, int *comp, int req
    #ifndef STBI_NO_HDR
    if (stbi_hdr_test(s)) {
       float *hdr = stbi_hdr_load(s, x,y,comp,req_comp);
-      return hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
+      return hdr_to_ldr(s, hdr, *x, *y, req_comp ? req_comp : *comp);
    }
    #endif
 
@@ -556,8 +928,15 @@ static unsigned char *stbi_load_main(stbi *s, int *x, int *y, int *comp, int req
 #ifndef STBI_NO_STDIO
 unsigned char *stbi_load(char const *filename, int *x, int *y, int *comp, int req_comp)
 {
-   FILE *f = fopen(filename, "rb");
+   FILE *f;
    unsigned char *result;
+   stbi_mapped_file m;
+   if (map_file(&m, filename)) {
+      result = stbi_load_from_memory(m.data, (int) m.size, x, y, comp, req_comp);
+      stbi_unmap_file(&m);
+      return result;
+   }
+   f = fopen(filename, "rb");
    if (!f) return epuc("can't fopen", "Unable to open file");
    result = stbi_load_from_file(f,x,y,comp,req_comp);
    fclose(f);
@@ -586,6 +965,101 @@ unsigned char *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *use
    return stbi_load_main(&s,x,y,comp,req_comp);
 }
 
+// a call with a context leaves the thread's failure reason as it was, and
+// uses the context's allocator until it returns
+typedef struct
+{
+   const char *failure_reason;
+   const stbi_allocator *allocator;
+} stbi_saved;
+
+static void begin_ctx(stbi *s, stbi_context *ctx, stbi_saved *saved)
+{
+   saved->failure_reason = failure_reason;
+   saved->allocator = allocator;
+   s->ctx = ctx;
+   failure_reason = NULL;
+   allocator = ctx->allocator.allocate ? &ctx->allocator : NULL;
+}
+
+// the format tests can leave a reason behind even when the load works
+static void end_ctx(stbi_context *ctx, stbi_saved *saved, int ok)
+{
+   ctx->failure_reason = ok ? NULL : failure_reason;
+   if (ctx->failure_reason == failure_text) {
+      memcpy(ctx->failure_text, failure_text, sizeof(failure_text));
+      ctx->failure_reason = ctx->failure_text;
+   }
+   failure_reason = saved->failure_reason;
+   allocator = saved->allocator;
+}
+
+unsigned char *stbi_load_from_memory_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   unsigned char *result;
+   stbi_saved saved;
+   start_mem(&s,buffer,len);
+   begin_ctx(&s, ctx, &saved);
+   result = stbi_load_main(&s,x,y,comp,req_comp);
+   end_ctx(ctx, &saved, result != NULL);
+   return result;
+}
+
+unsigned char *stbi_load_from_callbacks_ctx(stbi_context *ctx, stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   unsigned char *result;
+   stbi_saved saved;
+   start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   begin_ctx(&s, ctx, &saved);
+   result = stbi_load_main(&s,x,y,comp,req_comp);
+   end_ctx(ctx, &saved, result != NULL);
+   return result;
+}
+
+// the decoders that can write into s->out return it; anything else is
+// copied row by row and its memory given back
+static int stbi_load_into_main(stbi *s, int *x, int *y, int *comp, int req_comp)
+{
+   uint8 *result;
+   int j, w, h;
+   if (req_comp < 1 || req_comp > 4) return e("bad req_comp", "Internal error");
+   result = stbi_load_main(s, &w, &h, comp, req_comp);
+   if (result == NULL) return 0;
+   if (result != s->out) {
+      if (w > s->out_w || h > s->out_h) {
+         stbi_free(result);
+         return e("too large", "Image larger than the buffer");
+      }
+      for (j=0; j < h; ++j)
+         memcpy(s->out + (size_t) s->out_stride * j, result + (size_t) w * req_comp * j, w * req_comp);
+      stbi_free(result);
+   }
+   *x = w;
+   *y = h;
+   return 1;
+}
+
+int stbi_load_into(stbi_context *ctx, stbi_uc const *buffer, int len, stbi_uc *out, int stride, int out_w, int out_h, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   int r;
+   stbi_saved saved;
+   start_mem(&s,buffer,len);
+   s.out = out;
+   s.out_stride = stride;
+   s.out_w = out_w;
+   s.out_h = out_h;
+   s.out_n = req_comp;
+   if (!ctx)
+      return stbi_load_into_main(&s,x,y,comp,req_comp);
+   begin_ctx(&s, ctx, &saved);
+   r = stbi_load_into_main(&s,x,y,comp,req_comp);
+   end_ctx(ctx, &saved, r);
+   return r;
+}
+
 #ifndef STBI_NO_HDR
 
 float *stbi_loadf_main(stbi *s, int *x, int *y, int *comp, int req_comp)
@@ -597,7 +1071,7 @@ float *stbi_loadf_main(stbi *s, int *x, int *y, int *comp, int req_comp)
    #endif
    data = stbi_load_main(s, x, y, comp, req_comp);
    if (data)
-      return ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp);
+      return ldr_to_hdr(s, data, *x, *y, req_comp ? req_comp : *comp);
    return epf("unknown image type", "Image not of any known type, or corrupt");
 }
 
@@ -618,8 +1092,15 @@ float *stbi_loadf_from_callbacks(stbi_io_callbacks const *clbk, void *user, int
 #ifndef STBI_NO_STDIO
 float *stbi_loadf(char const *filename, int *x, int *y, int *comp, int req_comp)
 {
-   FILE *f = fopen(filename, "rb");
+   FILE *f;
    float *result;
+   stbi_mapped_file m;
+   if (map_file(&m, filename)) {
+      result = stbi_loadf_from_memory(m.data, (int) m.size, x, y, comp, req_comp);
+      stbi_unmap_file(&m);
+      return result;
+   }
+   f = fopen(filename, "rb");
    if (!f) return epf("can't fopen", "Unable to open file");
    result = stbi_loadf_from_file(f,x,y,comp,req_comp);
    fclose(f);
@@ -656,8 +1137,15 @@ int stbi_is_hdr_from_memory(stbi_uc const *buffer, int len)
 #ifndef STBI_NO_STDIO
 extern int      stbi_is_hdr          (char const *filename)
 {
-   FILE *f = fopen(filename, "rb");
+   FILE *f;
    int result=0;
+   stbi_mapped_file m;
+   if (map_file(&m, filename)) {
+      result = stbi_is_hdr_from_memory(m.data, (int) m.size);
+      stbi_unmap_file(&m);
+      return result;
+   }
+   f = fopen(filename, "rb");
    if (f) {
       result = stbi_is_hdr_from_file(f);
       fclose(f);
@@ -689,14 +1177,11 @@ extern int      stbi_is_hdr_from_callbacks(stbi_io_callbacks const *clbk, void *
 }
 
 #ifndef STBI_NO_HDR
-static float h2l_gamma_i=1.0f/2.2f, h2l_scale_i=1.0f;
-static float l2h_gamma=2.2f, l2h_scale=1.0f;
-
-void   stbi_hdr_to_ldr_gamma(float gamma) { h2l_gamma_i = 1/gamma; }
-void   stbi_hdr_to_ldr_scale(float scale) { h2l_scale_i = 1/scale; }
+void   stbi_hdr_to_ldr_gamma(float gamma) { stbi_shared.hdr_to_ldr_gamma = gamma; }
+void   stbi_hdr_to_ldr_scale(float scale) { stbi_shared.hdr_to_ldr_scale = scale; }
 
-void   stbi_ldr_to_hdr_gamma(float gamma) { l2h_gamma = gamma; }
-void   stbi_ldr_to_hdr_scale(float scale) { l2h_scale = scale; }
+void   stbi_ldr_to_hdr_gamma(float gamma) { stbi_shared.ldr_to_hdr_gamma = gamma; }
+void   stbi_ldr_to_hdr_scale(float scale) { stbi_shared.ldr_to_hdr_scale = scale; }
 #endif
 
 
@@ -709,16 +1194,19 @@ enum
 {
    SCAN_load=0,
    SCAN_type,
-   SCAN_header
+   SCAN_header,
+   SCAN_stream  // png: up to the image data, for png_stream_rows()
 };
 
 static void refill_buffer(stbi *s)
 {
    int n = (s->io.read)(s->io_user_data,(char*)s->buffer_start,s->buflen);
    if (n == 0) {
-      // at end of file, treat same as if from memory
+      // at end of file, treat same as if from memory. img_buffer_end isn't
+      // set yet if the file was empty, so end after a single 0 byte
       s->read_from_callbacks = 0;
-      s->img_buffer = s->img_buffer_end-1;
+      s->img_buffer = s->buffer_start;
+      s->img_buffer_end = s->buffer_start+1;
       *s->img_buffer = 0;
    } else {
       s->img_buffer = s->buffer_start;
@@ -831,56 +1319,60 @@ static uint8 compute_y(int r, int g, int b)
    return (uint8) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
+// convert a row of x pixels with img_n components to one with req_comp
+// components; avoid switch per pixel, so use switch per scanline and
+// massive macros
+static void convert_row(unsigned char const *src, int img_n, unsigned char *dest, int req_comp, uint x)
+{
+   int i;
+   #define COMBO(a,b)  ((a)*8+(b))
+   #define CASE(a,b)   case COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   switch (COMBO(img_n, req_comp)) {
+      CASE(1,2) dest[0]=src[0], dest[1]=255; break;
+      CASE(1,3) dest[0]=dest[1]=dest[2]=src[0]; break;
+      CASE(1,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=255; break;
+      CASE(2,1) dest[0]=src[0]; break;
+      CASE(2,3) dest[0]=dest[1]=dest[2]=src[0]; break;
+      CASE(2,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=src[1]; break;
+      CASE(3,4) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2],dest[3]=255; break;
+      CASE(3,1) dest[0]=compute_y(src[0],src[1],src[2]); break;
+      CASE(3,2) dest[0]=compute_y(src[0],src[1],src[2]), dest[1] = 255; break;
+      CASE(4,1) dest[0]=compute_y(src[0],src[1],src[2]); break;
+      CASE(4,2) dest[0]=compute_y(src[0],src[1],src[2]), dest[1] = src[3]; break;
+      CASE(4,3) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2]; break;
+      default: assert(0);
+   }
+   #undef CASE
+}
+
 static unsigned char *convert_format(unsigned char *data, int img_n, int req_comp, uint x, uint y)
 {
-   int i,j;
+   int j;
    unsigned char *good;
 
    if (req_comp == img_n) return data;
    assert(req_comp >= 1 && req_comp <= 4);
 
-   good = (unsigned char *) malloc(req_comp * x * y);
+   good = (unsigned char *) stbi_malloc(req_comp * x * y);
    if (good == NULL) {
-      free(data);
+      stbi_free(data);
       return epuc("outofmem", "Out of memory");
    }
 
-   for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
-
-      #define COMBO(a,b)  ((a)*8+(b))
-      #define CASE(a,b)   case COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (COMBO(img_n, req_comp)) {
-         CASE(1,2) dest[0]=src[0], dest[1]=255; break;
-         CASE(1,3) dest[0]=dest[1]=dest[2]=src[0]; break;
-         CASE(1,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=255; break;
-         CASE(2,1) dest[0]=src[0]; break;
-         CASE(2,3) dest[0]=dest[1]=dest[2]=src[0]; break;
-         CASE(2,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=src[1]; break;
-         CASE(3,4) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2],dest[3]=255; break;
-         CASE(3,1) dest[0]=compute_y(src[0],src[1],src[2]); break;
-         CASE(3,2) dest[0]=compute_y(src[0],src[1],src[2]), dest[1] = 255; break;
-         CASE(4,1) dest[0]=compute_y(src[0],src[1],src[2]); break;
-         CASE(4,2) dest[0]=compute_y(src[0],src[1],src[2]), dest[1] = src[3]; break;
-         CASE(4,3) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2]; break;
-         default: assert(0);
-      }
-      #undef CASE
-   }
+   for (j=0; j < (int) y; ++j)
+      convert_row(data + j * x * img_n, img_n, good + j * x * req_comp, req_comp, x);
 
-   free(data);
+   stbi_free(data);
    return good;
 }
 
 #ifndef STBI_NO_HDR
-static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
+static float   *ldr_to_hdr(stbi *s, stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
-   float *output = (float *) malloc(x * y * comp * sizeof(float));
-   if (output == NULL) { free(data); return epf("outofmem", "Out of memory"); }
+   float l2h_gamma = s->ctx->ldr_to_hdr_gamma, l2h_scale = s->ctx->ldr_to_hdr_scale;
+   float *output = (float *) stbi_malloc(x * y * comp * sizeof(float));
+   if (output == NULL) { stbi_free(data); return epf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -889,16 +1381,17 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
       }
       if (k < comp) output[i*comp + k] = data[i*comp+k]/255.0f;
    }
-   free(data);
+   stbi_free(data);
    return output;
 }
 
 #define float2int(x)   ((int) (x))
-static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
+static stbi_uc *hdr_to_ldr(stbi *s, float   *data, int x, int y, int comp)
 {
    int i,k,n;
-   stbi_uc *output = (stbi_uc *) malloc(x * y * comp);
-   if (output == NULL) { free(data); return epuc("outofmem", "Out of memory"); }
+   float h2l_gamma_i = 1/s->ctx->hdr_to_ldr_gamma, h2l_scale_i = 1/s->ctx->hdr_to_ldr_scale;
+   stbi_uc *output = (stbi_uc *) stbi_malloc(x * y * comp);
+   if (output == NULL) { stbi_free(data); return epuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -915,7 +1408,7 @@ static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (uint8) float2int(z);
       }
    }
-   free(data);
+   stbi_free(data);
    return output;
 }
 #endif
@@ -965,6 +1458,8 @@ typedef struct
 {
    #ifdef STBI_SIMD
    unsigned short dequant2[4][64];
+   stbi_idct_8x8 idct;
+   stbi_YCbCr_to_RGB_run YCbCr;
    #endif
    stbi *s;
    huffman huff_dc[4];
@@ -1357,10 +1852,7 @@ static int parse_entropy_coded_data(jpeg *z)
    reset(z);
    if (z->scan_n == 1) {
       int i,j;
-      #ifdef STBI_SIMD
-      __declspec(align(16))
-      #endif
-      short data[64];
+      STBI_ALIGN16(short data[64]);
       int n = z->order[0];
       // non-interleaved data, we just need to process one block at a time,
       // in trivial scanline order
@@ -1372,7 +1864,7 @@ static int parse_entropy_coded_data(jpeg *z)
          for (i=0; i < w; ++i) {
             if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
             #ifdef STBI_SIMD
-            stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
+            z->idct(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
             #else
             idct_block(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
             #endif
@@ -1388,7 +1880,7 @@ static int parse_entropy_coded_data(jpeg *z)
       }
    } else { // interleaved!
       int i,j,k,x,y;
-      short data[64];
+      STBI_ALIGN16(short data[64]);
       for (j=0; j < z->img_mcu_y; ++j) {
          for (i=0; i < z->img_mcu_x; ++i) {
             // scan an interleaved mcu... process scan_n components in order
@@ -1402,7 +1894,7 @@ static int parse_entropy_coded_data(jpeg *z)
                      int y2 = (j*z->img_comp[n].v + y)*8;
                      if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
                      #ifdef STBI_SIMD
-                     stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
+                     z->idct(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
                      #else
                      idct_block(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
                      #endif
@@ -1574,10 +2066,10 @@ static int process_frame_header(jpeg *z, int scan)
       // discard the extra data until colorspace conversion
       z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
       z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-      z->img_comp[i].raw_data = malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
+      z->img_comp[i].raw_data = stbi_malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
       if (z->img_comp[i].raw_data == NULL) {
          for(--i; i >= 0; --i) {
-            free(z->img_comp[i].raw_data);
+            stbi_free(z->img_comp[i].raw_data);
             z->img_comp[i].data = NULL;
          }
          return e("outofmem", "Out of memory");
@@ -1778,6 +2270,230 @@ void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func)
 }
 #endif
 
+#ifdef STBI_SSE2
+// SSE2 versions of the IDCT, the color conversion and the 2x2 upsampler.
+// each one writes exactly the bytes the C version writes
+
+#define stbi_pair16(a,b)  _mm_setr_epi16((short) (a), (short) (b), (short) (a), (short) (b), \
+                                         (short) (a), (short) (b), (short) (a), (short) (b))
+
+// IDCT_1D for four lanes, taking the inputs as interleaved pairs (s0,s4),
+// (s2,s6), (s1,s3) and (s5,s7) so every product is one pmaddwd. the odd
+// part is IDCT_1D's multiplied out, with the constants summed the same way
+// f2f rounds them. 'bias' is the rounding the caller adds to x0..x3
+static void idct_1d_sse2(__m128i o[8], __m128i p04, __m128i p26, __m128i p13, __m128i p57, __m128i bias)
+{
+   __m128i t0,t1,t2,t3,x0,x1,x2,x3;
+   t2 = _mm_madd_epi16(p26, stbi_pair16(f2f(0.5411961f), f2f(0.5411961f) + f2f(-1.847759065f)));
+   t3 = _mm_madd_epi16(p26, stbi_pair16(f2f(0.5411961f) + f2f( 0.765366865f), f2f(0.5411961f)));
+   t0 = _mm_add_epi32(_mm_madd_epi16(p04, stbi_pair16(fsh(1),  fsh(1))), bias);
+   t1 = _mm_add_epi32(_mm_madd_epi16(p04, stbi_pair16(fsh(1), -fsh(1))), bias);
+   x0 = _mm_add_epi32(t0, t3);
+   x3 = _mm_sub_epi32(t0, t3);
+   x1 = _mm_add_epi32(t1, t2);
+   x2 = _mm_sub_epi32(t1, t2);
+   t3 = _mm_add_epi32(
+      _mm_madd_epi16(p13, stbi_pair16(f2f( 1.501321110f) + f2f(1.175875602f) + f2f(-0.899976223f) + f2f(-0.390180644f),
+                                      f2f( 1.175875602f))),
+      _mm_madd_epi16(p57, stbi_pair16(f2f( 1.175875602f) + f2f(-0.390180644f),
+                                      f2f( 1.175875602f) + f2f(-0.899976223f))));
+   t2 = _mm_add_epi32(
+      _mm_madd_epi16(p13, stbi_pair16(f2f( 1.175875602f),
+                                      f2f( 3.072711026f) + f2f(1.175875602f) + f2f(-2.562915447f) + f2f(-1.961570560f))),
+      _mm_madd_epi16(p57, stbi_pair16(f2f( 1.175875602f) + f2f(-2.562915447f),
+                                      f2f( 1.175875602f) + f2f(-1.961570560f))));
+   t1 = _mm_add_epi32(
+      _mm_madd_epi16(p13, stbi_pair16(f2f( 1.175875602f) + f2f(-0.390180644f),
+                                      f2f( 1.175875602f) + f2f(-2.562915447f))),
+      _mm_madd_epi16(p57, stbi_pair16(f2f( 2.053119869f) + f2f(1.175875602f) + f2f(-2.562915447f) + f2f(-0.390180644f),
+                                      f2f( 1.175875602f))));
+   t0 = _mm_add_epi32(
+      _mm_madd_epi16(p13, stbi_pair16(f2f( 1.175875602f) + f2f(-0.899976223f),
+                                      f2f( 1.175875602f) + f2f(-1.961570560f))),
+      _mm_madd_epi16(p57, stbi_pair16(f2f( 1.175875602f),
+                                      f2f( 0.298631336f) + f2f(1.175875602f) + f2f(-0.899976223f) + f2f(-1.961570560f))));
+   o[0] = _mm_add_epi32(x0, t3);
+   o[7] = _mm_sub_epi32(x0, t3);
+   o[1] = _mm_add_epi32(x1, t2);
+   o[6] = _mm_sub_epi32(x1, t2);
+   o[2] = _mm_add_epi32(x2, t1);
+   o[5] = _mm_sub_epi32(x2, t1);
+   o[3] = _mm_add_epi32(x3, t0);
+   o[4] = _mm_sub_epi32(x3, t0);
+}
+
+// IDCT_1D on all eight lanes of s[0..7], shifted down and packed back to
+// 16 bits. returns the lanes OR'd together as "v ^ (v >> 31)", which is
+// below 1<<15 exactly when nothing saturated
+static __m128i idct_pass_sse2(__m128i s[8], __m128i bias, int shift)
+{
+   __m128i lo[8], hi[8], range = _mm_setzero_si128();
+   int i;
+   idct_1d_sse2(lo, _mm_unpacklo_epi16(s[0], s[4]), _mm_unpacklo_epi16(s[2], s[6]),
+                    _mm_unpacklo_epi16(s[1], s[3]), _mm_unpacklo_epi16(s[5], s[7]), bias);
+   idct_1d_sse2(hi, _mm_unpackhi_epi16(s[0], s[4]), _mm_unpackhi_epi16(s[2], s[6]),
+                    _mm_unpackhi_epi16(s[1], s[3]), _mm_unpackhi_epi16(s[5], s[7]), bias);
+   for (i=0; i < 8; ++i) {
+      __m128i l = _mm_sra_epi32(lo[i], _mm_cvtsi32_si128(shift));
+      __m128i h = _mm_sra_epi32(hi[i], _mm_cvtsi32_si128(shift));
+      range = _mm_or_si128(range, _mm_xor_si128(l, _mm_srai_epi32(l, 31)));
+      range = _mm_or_si128(range, _mm_xor_si128(h, _mm_srai_epi32(h, 31)));
+      s[i] = _mm_packs_epi32(l, h);
+   }
+   return range;
+}
+
+static void transpose_8x8_sse2(__m128i r[8])
+{
+   __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+   __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+   __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+   __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+   __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+   __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+   __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+   __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+   r[0] = _mm_unpacklo_epi64(b0, b4); r[1] = _mm_unpackhi_epi64(b0, b4);
+   r[2] = _mm_unpacklo_epi64(b1, b5); r[3] = _mm_unpackhi_epi64(b1, b5);
+   r[4] = _mm_unpacklo_epi64(b2, b6); r[5] = _mm_unpackhi_epi64(b2, b6);
+   r[6] = _mm_unpacklo_epi64(b3, b7); r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// the columns pass runs on the rows as loaded, each lane one column; the
+// rows pass runs on the transpose. all of it is in 16 bits between the
+// passes, so blocks that need the C version's 32 bits (only corrupt or
+// hand-made files have them) are handed to it
+static void idct_block_sse2(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   __m128i s[8], wide = _mm_setzero_si128();
+   int i;
+   for (i=0; i < 8; ++i) {
+      __m128i d = _mm_loadu_si128((__m128i *) (data + i*8));
+      __m128i q = _mm_loadu_si128((__m128i *) (dequantize + i*8));
+      s[i] = _mm_mullo_epi16(d, q);
+      wide = _mm_or_si128(wide, _mm_xor_si128(_mm_mulhi_epi16(d, q), _mm_srai_epi16(s[i], 15)));
+   }
+   if (_mm_movemask_epi8(_mm_cmpeq_epi16(wide, _mm_setzero_si128())) != 0xffff) {
+      idct_block(out, out_stride, data, dequantize);
+      return;
+   }
+
+   // same rounding and scaling as idct_block
+   wide = idct_pass_sse2(s, _mm_set1_epi32(512), 10);
+   if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(wide, 15), _mm_setzero_si128())) != 0xffff) {
+      idct_block(out, out_stride, data, dequantize);
+      return;
+   }
+   transpose_8x8_sse2(s);
+   idct_pass_sse2(s, _mm_set1_epi32(65536 + (128<<17)), 17);
+   transpose_8x8_sse2(s);
+
+   for (i=0; i < 8; i += 2, out += 2*out_stride) {
+      __m128i rows = _mm_packus_epi16(s[i], s[i+1]);
+      _mm_storel_epi64((__m128i *) out, rows);
+      _mm_storel_epi64((__m128i *) (out + out_stride), _mm_srli_si128(rows, 8));
+   }
+}
+
+// the multiplies are split so each constant fits in 16 bits: with
+// c = k*65536 + c', (x*c + 32768) >> 16 is x*k + ((x*c' + 32768) >> 16).
+// the rounding 32768 comes in as 2*16384 through the same pmaddwd
+static void YCbCr_to_RGB_sse2(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step)
+{
+   int i = 0;
+   __m128i zero = _mm_setzero_si128();
+   __m128i bias = _mm_set1_epi16(128), two = _mm_set1_epi16(2), round = _mm_set1_epi32(32768);
+   __m128i kr = stbi_pair16(float2fixed(1.40200f) - 65536, 16384);
+   __m128i kg = stbi_pair16(65536 - float2fixed(0.71414f), -float2fixed(0.34414f));
+   __m128i kb = stbi_pair16(float2fixed(1.77200f) - 131072, 16384);
+   for (; i+8 <= count; i += 8, out += 8*step) {
+      __m128i yy = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (y + i)), zero);
+      __m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (pcb + i)), zero), bias);
+      __m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (pcr + i)), zero), bias);
+      __m128i r = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cr, two), kr), 16),
+                                  _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cr, two), kr), 16));
+      __m128i g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cr, cb), kg), round), 16),
+                                  _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cr, cb), kg), round), 16));
+      __m128i b = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, two), kb), 16),
+                                  _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, two), kb), 16));
+      __m128i rb, ga, rgba0, rgba1;
+      r = _mm_add_epi16(_mm_add_epi16(yy, cr), r);
+      g = _mm_add_epi16(_mm_sub_epi16(yy, cr), g);
+      b = _mm_add_epi16(_mm_add_epi16(yy, _mm_add_epi16(cb, cb)), b);
+      rb = _mm_packus_epi16(r, b);
+      ga = _mm_packus_epi16(g, _mm_set1_epi16(255));
+      rgba0 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(rb, ga), _mm_unpackhi_epi8(rb, ga));
+      rgba1 = _mm_unpackhi_epi16(_mm_unpacklo_epi8(rb, ga), _mm_unpackhi_epi8(rb, ga));
+      if (step == 4) {
+         _mm_storeu_si128((__m128i *) out, rgba0);
+         _mm_storeu_si128((__m128i *) (out + 16), rgba1);
+      } else {
+         // 4-byte stores 3 apart, in order so each 255 lands under the next
+         // pixel; like the C version, the last one puts it after the group
+         int k;
+         for (k=0; k < 8; ++k) {
+            uint32 p = (uint32) _mm_cvtsi128_si32(rgba0);
+            memcpy(out + 3*k, &p, 4);
+            rgba0 = _mm_srli_si128(rgba0, 4);
+            if (k == 3) rgba0 = rgba1;
+         }
+      }
+   }
+   YCbCr_to_RGB_row(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+
+static uint8 *resample_row_hv_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i=1,t0,t1;
+   __m128i zero = _mm_setzero_si128(), eight = _mm_set1_epi16(8);
+   if (w == 1) return resample_row_hv_2(out, in_near, in_far, w, hs);
+
+   t1 = 3*in_near[0] + in_far[0];
+   out[0] = div4(t1+2);
+   // the column sums at i-1.. and at i.. give eight odd/even output pairs
+   // starting at out[i*2-1]
+   for (; i+8 <= w; i += 8) {
+      __m128i np = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (in_near + i-1)), zero);
+      __m128i fp = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (in_far  + i-1)), zero);
+      __m128i nc = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (in_near + i  )), zero);
+      __m128i fc = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (in_far  + i  )), zero);
+      __m128i prev = _mm_add_epi16(_mm_add_epi16(np, _mm_add_epi16(np, np)), fp);
+      __m128i cur  = _mm_add_epi16(_mm_add_epi16(nc, _mm_add_epi16(nc, nc)), fc);
+      __m128i sum  = _mm_add_epi16(_mm_add_epi16(prev, cur), eight);
+      __m128i odd  = _mm_srli_epi16(_mm_add_epi16(sum, _mm_add_epi16(prev, prev)), 4);
+      __m128i even = _mm_srli_epi16(_mm_add_epi16(sum, _mm_add_epi16(cur, cur)), 4);
+      __m128i both = _mm_packus_epi16(odd, even);
+      _mm_storeu_si128((__m128i *) (out + i*2-1), _mm_unpacklo_epi8(both, _mm_srli_si128(both, 8)));
+   }
+   t1 = 3*in_near[i-1] + in_far[i-1];
+   for (; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+   return out;
+}
+#endif // STBI_SSE2
+
+// the SSE2 functions stand in for the C defaults, but not for anything
+// installed with stbi_install_idct/_YCbCr_to_RGB. picked for each image, so
+// the installed hooks are only ever written by the user
+static void jpeg_select_simd(jpeg *z)
+{
+   #ifdef STBI_SIMD
+   z->idct = stbi_idct_installed;
+   z->YCbCr = stbi_YCbCr_installed;
+   #ifdef STBI_SSE2
+   if (stbi_simd_level(z->s) >= STBI_SIMD_SSE2) {
+      if (z->idct == idct_block) z->idct = idct_block_sse2;
+      if (z->YCbCr == YCbCr_to_RGB_row) z->YCbCr = YCbCr_to_RGB_sse2;
+   }
+   #endif
+   #endif
+}
+
 
 // clean up the temporary component buffers
 static void cleanup_jpeg(jpeg *j)
@@ -1785,11 +2501,11 @@ static void cleanup_jpeg(jpeg *j)
    int i;
    for (i=0; i < j->s->img_n; ++i) {
       if (j->img_comp[i].data) {
-         free(j->img_comp[i].raw_data);
+         stbi_free(j->img_comp[i].raw_data);
          j->img_comp[i].data = NULL;
       }
       if (j->img_comp[i].linebuf) {
-         free(j->img_comp[i].linebuf);
+         stbi_free(j->img_comp[i].linebuf);
          j->img_comp[i].linebuf = NULL;
       }
    }
@@ -1812,6 +2528,8 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
    if (req_comp < 0 || req_comp > 4) return epuc("bad req_comp", "Internal error");
    z->s->img_n = 0;
 
+   jpeg_select_simd(z);
+
    // load a jpeg image from whichever source
    if (!decode_jpeg_image(z)) { cleanup_jpeg(z); return NULL; }
 
@@ -1826,8 +2544,8 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
    // resample and color-convert
    {
       int k;
-      uint i,j;
-      uint8 *output;
+      uint i,j,stride;
+      uint8 *output, *row = NULL;
       uint8 *coutput[4];
 
       stbi_resample res_comp[4];
@@ -1837,7 +2555,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
 
          // allocate line buffer big enough for upsampling off the edges
          // with upsample factor of 4
-         z->img_comp[k].linebuf = (uint8 *) malloc(z->s->img_x + 3);
+         z->img_comp[k].linebuf = (uint8 *) stbi_malloc(z->s->img_x + 3);
          if (!z->img_comp[k].linebuf) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
          r->hs      = z->img_h_max / z->img_comp[k].h;
@@ -1852,15 +2570,31 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
          else if (r->hs == 2 && r->vs == 1) r->resample = resample_row_h_2;
          else if (r->hs == 2 && r->vs == 2) r->resample = resample_row_hv_2;
          else                               r->resample = resample_row_generic;
+         #ifdef STBI_SSE2
+         if (r->resample == resample_row_hv_2 && stbi_simd_level(z->s) >= STBI_SIMD_SSE2)
+            r->resample = resample_row_hv_2_sse2;
+         #endif
       }
 
-      // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s->img_x * z->s->img_y + 1);
-      if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+      output = stbi_direct_out(z->s, n);
+      if (output) {
+         stride = z->s->out_stride;
+         // 3 byte pixels are written 4 bytes at a time, so convert those in
+         // a spare row rather than touch memory after the caller's rows
+         if (n == 3) {
+            row = (uint8 *) stbi_malloc(n * z->s->img_x + 1);
+            if (!row) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+         }
+      } else {
+         // can't error after this so, this is safe
+         stride = n * z->s->img_x;
+         output = (uint8 *) stbi_malloc(n * z->s->img_x * z->s->img_y + 1);
+         if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+      }
 
       // now go ahead and resample
       for (j=0; j < z->s->img_y; ++j) {
-         uint8 *out = output + n * z->s->img_x * j;
+         uint8 *out = row ? row : output + stride * j;
          for (k=0; k < decode_n; ++k) {
             stbi_resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -1879,7 +2613,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
             uint8 *y = coutput[0];
             if (z->s->img_n == 3) {
                #ifdef STBI_SIMD
-               stbi_YCbCr_installed(out, y, coutput[1], coutput[2], z->s.img_x, n);
+               z->YCbCr(out, y, coutput[1], coutput[2], z->s->img_x, n);
                #else
                YCbCr_to_RGB_row(out, y, coutput[1], coutput[2], z->s->img_x, n);
                #endif
@@ -1896,7 +2630,10 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
             else
                for (i=0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
          }
+         if (row)
+            memcpy(output + stride * j, row, n * z->s->img_x);
       }
+      stbi_free(row);
       cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -1949,7 +2686,7 @@ static int stbi_jpeg_info(stbi *s, int *x, int *y, int *comp)
 //      - fast huffman
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define ZFAST_BITS  9 // accelerate all cases in default tables
+#define ZFAST_BITS  10 // accelerate all cases in default tables, and pairs of short literals
 #define ZFAST_MASK  ((1 << ZFAST_BITS) - 1)
 
 // zlib-style huffman encoding
@@ -1981,7 +2718,7 @@ stbi_inline static int bit_reverse(int v, int bits)
    return bitreverse16(v) >> (16-bits);
 }
 
-static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
+static int zbuild_huffman(zhuffman *z, const uint8 *sizelist, int num)
 {
    int i,k=0;
    int code, next_code[16], sizes[17];
@@ -1993,7 +2730,8 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
       ++sizes[sizelist[i]];
    sizes[0] = 0;
    for (i=1; i < 16; ++i)
-      assert(sizes[i] <= (1 << i));
+      if (sizes[i] > (1 << i))
+         return e("bad sizes","Corrupt PNG");
    code = 0;
    for (i=1; i < 16; ++i) {
       next_code[i] = code;
@@ -2031,41 +2769,75 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
 //    we require PNG read all the IDATs and combine them into a single
 //    memory buffer
+//
+//    streaming PNG decoding is the exception: zlib pulls each piece of
+//    input from PNG as it needs it, and hands its output over whenever
+//    the buffer fills, keeping only the window matches can reach back to
 
 typedef struct
 {
    uint8 *zbuffer, *zbuffer_end;
    int num_bits;
-   uint32 code_buffer;
+   // bits past num_bits may hold bytes read ahead, so always mask
+   uint64 code_buffer;
 
    char *zout;
    char *zout_start;
    char *zout_end;
    int   z_expandable;
 
+   // for streaming, NULL otherwise. 'more' points zbuffer at the next input
+   // once it runs out, returning 0 at the end of it; 'flush' is given the
+   // output from zflushed on before the buffer is reused
+   int (*more)(void *user, uint8 **data, uint8 **data_end);
+   int (*flush)(void *user, uint8 const *data, int len);
+   void *stream_user;
+   char *zflushed;
+
    zhuffman z_length, z_distance;
+   int fast_tables; // see stbi_set_inflate_fast_tables()
+   // ZFAST_BITS lookups into the two trees, see zbuild_fast_tables()
+   uint32 length_fast[1 << ZFAST_BITS];
+   uint32 distance_fast[1 << ZFAST_BITS];
 } zbuf;
 
+static int zmore(zbuf *z)
+{
+   return z->more && z->more(z->stream_user, &z->zbuffer, &z->zbuffer_end);
+}
+
 stbi_inline static int zget8(zbuf *z)
 {
-   if (z->zbuffer >= z->zbuffer_end) return 0;
+   if (z->zbuffer >= z->zbuffer_end && !zmore(z)) return 0;
    return *z->zbuffer++;
 }
 
+// tops the bit buffer up to at least 56 bits
 static void fill_bits(zbuf *z)
 {
+   #ifdef STBI_LITTLE_ENDIAN_UNALIGNED
+   if (z->zbuffer_end - z->zbuffer >= 8) {
+      // load 8 bytes but only count the whole bytes that fit; the rest gets
+      // loaded again next time, into the same bit positions
+      uint64 v;
+      memcpy(&v, z->zbuffer, 8);
+      z->code_buffer |= v << z->num_bits;
+      z->zbuffer += (63 - z->num_bits) >> 3;
+      z->num_bits |= 56;
+      return;
+   }
+   #endif
    do {
-      assert(z->code_buffer < (1U << z->num_bits));
-      z->code_buffer |= zget8(z) << z->num_bits;
+      z->code_buffer |= (uint64) zget8(z) << z->num_bits;
       z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   } while (z->num_bits <= 56);
 }
 
 stbi_inline static unsigned int zreceive(zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;   
@@ -2085,7 +2857,7 @@ stbi_inline static int zhuffman_decode(zbuf *a, zhuffman *z)
 
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = bit_reverse(a->code_buffer, 16);
+   k = bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -2098,16 +2870,35 @@ stbi_inline static int zhuffman_decode(zbuf *a, zhuffman *z)
    return z->value[b];
 }
 
+// the most a match can reach back, and so what a streaming decode keeps
+#define ZWINDOW  32768
+
+// streaming output: hands over what's new and moves the last ZWINDOW bytes
+// to the start. the buffer is twice that, so there's always room for a match
+static int zflush(zbuf *z)
+{
+   int keep = (int) (z->zout - z->zout_start);
+   if (z->zout > z->zflushed)
+      if (!z->flush(z->stream_user, (uint8 *) z->zflushed, (int) (z->zout - z->zflushed))) return 0;
+   if (keep > ZWINDOW) keep = ZWINDOW;
+   memmove(z->zout_start, z->zout - keep, keep);
+   z->zout = z->zflushed = z->zout_start + keep;
+   return 1;
+}
+
 static int expand(zbuf *z, int n)  // need to make room for n bytes
 {
    char *q;
-   int cur, limit;
+   int cur, old_limit, limit;
+   if (z->flush) return zflush(z); // room for at least a match, maybe not n
    if (!z->z_expandable) return e("output buffer limit","Corrupt PNG");
    cur   = (int) (z->zout     - z->zout_start);
-   limit = (int) (z->zout_end - z->zout_start);
-   while (cur + n > limit)
+   limit = old_limit = (int) (z->zout_end - z->zout_start);
+   while (cur + n > limit) {
+      if (limit > 0x3fffffff) return e("outofmem", "Out of memory");
       limit *= 2;
-   q = (char *) realloc(z->zout_start, limit);
+   }
+   q = (char *) stbi_realloc(z->zout_start, old_limit, limit);
    if (q == NULL) return e("outofmem", "Out of memory");
    z->zout_start = q;
    z->zout       = q + cur;
@@ -2129,7 +2920,156 @@ static int dist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
 static int dist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// fast table entries say what a code means, not just which symbol it is:
+//    bits 0-3    number of bits to consume, 0 for entries from the slow path
+//    bits 4-6    ZFAST_* kind
+//    literals    bits 8-15 the literal, 16-23 the second one for ZFAST_LITERAL2
+//    lengths and distances   bits 8-11 extra bits, 16-31 base value
+// an all-zero entry means the code is longer than ZFAST_BITS
+enum
+{
+   ZFAST_SLOW, ZFAST_LITERAL, ZFAST_LITERAL2, ZFAST_LENGTH, ZFAST_DISTANCE, ZFAST_END, ZFAST_INVALID
+};
+
+static uint32 zlength_entry(int sym, int size)
+{
+   if (sym < 256)  return size | (ZFAST_LITERAL << 4) | (sym << 8);
+   if (sym == 256) return size | (ZFAST_END << 4);
+   if (sym >= 286) return ZFAST_INVALID << 4;
+   sym -= 257;
+   return size | (ZFAST_LENGTH << 4) | (length_extra[sym] << 8) | ((uint32) length_base[sym] << 16);
+}
+
+static uint32 zdistance_entry(int sym, int size)
+{
+   if (sym >= 30) return ZFAST_INVALID << 4;
+   return size | (ZFAST_DISTANCE << 4) | (dist_extra[sym] << 8) | ((uint32) dist_base[sym] << 16);
+}
+
+static void zbuild_fast_tables(zbuf *a)
+{
+   zhuffman *z = &a->z_length;
+   int k;
+   for (k=0; k < (1 << ZFAST_BITS); ++k) {
+      int c = z->fast[k];
+      uint32 entry = 0;
+      if (c < 0xffff) {
+         int s = z->size[c];
+         entry = zlength_entry(z->value[c], s);
+         if (z->value[c] < 256) {
+            // if the next code is a literal too and fits in the bits left
+            // over, one lookup gives both
+            int c2 = z->fast[k >> s];
+            if (c2 < 0xffff && z->value[c2] < 256 && s + z->size[c2] <= ZFAST_BITS)
+               entry = (s + z->size[c2]) | (ZFAST_LITERAL2 << 4) | (z->value[c] << 8) | (z->value[c2] << 16);
+         }
+      }
+      a->length_fast[k] = entry;
+   }
+
+   z = &a->z_distance;
+   for (k=0; k < (1 << ZFAST_BITS); ++k) {
+      int c = z->fast[k];
+      a->distance_fast[k] = c < 0xffff ? zdistance_entry(z->value[c], z->size[c]) : 0;
+   }
+}
+
+// copy a match; if it overlaps what it's writing (dist < len), the copied
+// bytes repeat, so only go a word at a time when each word is complete
+stbi_inline static void zcopy_match(char *out, int dist, int len)
+{
+   char *p = out - dist;
+   if (dist == 1) {
+      memset(out, *p, len);
+      return;
+   }
+   if (dist >= 8) {
+      for (; len >= 8; len -= 8, out += 8, p += 8)
+         memcpy(out, p, 8);
+   }
+   while (len--)
+      *out++ = *p++;
+}
+
 static int parse_huffman_block(zbuf *a)
+{
+   // kept in a local, since writes through char pointers would otherwise
+   // force it to be reloaded from a after every byte
+   char *zout = a->zout;
+   for(;;) {
+      uint32 entry;
+      int z, len, dist;
+      // enough for a length and distance with their extra bits
+      if (a->num_bits < 48) fill_bits(a);
+
+      entry = a->length_fast[a->code_buffer & ZFAST_MASK];
+      if (entry == 0) {
+         z = zhuffman_decode(a, &a->z_length);
+         if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
+         entry = zlength_entry(z, 0);
+      }
+      a->code_buffer >>= entry & 15;
+      a->num_bits -= entry & 15;
+
+      switch ((entry >> 4) & 7) {
+         case ZFAST_LITERAL:
+            if (zout >= a->zout_end) {
+               a->zout = zout;
+               if (!expand(a, 1)) return 0;
+               zout = a->zout;
+            }
+            *zout++ = (char) (entry >> 8);
+            break;
+
+         case ZFAST_LITERAL2:
+            if (zout + 2 > a->zout_end) {
+               a->zout = zout;
+               if (!expand(a, 2)) return 0;
+               zout = a->zout;
+            }
+            zout[0] = (char) (entry >> 8);
+            zout[1] = (char) (entry >> 16);
+            zout += 2;
+            break;
+
+         case ZFAST_LENGTH:
+            len = entry >> 16;
+            if ((entry >> 8) & 15) len += zreceive(a, (entry >> 8) & 15);
+
+            entry = a->distance_fast[a->code_buffer & ZFAST_MASK];
+            if (entry == 0) {
+               z = zhuffman_decode(a, &a->z_distance);
+               if (z < 0) return e("bad huffman code","Corrupt PNG");
+               entry = zdistance_entry(z, 0);
+            }
+            a->code_buffer >>= entry & 15;
+            a->num_bits -= entry & 15;
+            if (((entry >> 4) & 7) != ZFAST_DISTANCE) return e("bad huffman code","Corrupt PNG");
+            dist = entry >> 16;
+            if ((entry >> 8) & 15) dist += zreceive(a, (entry >> 8) & 15);
+
+            if (zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
+            if (zout + len > a->zout_end) {
+               a->zout = zout;
+               if (!expand(a, len)) return 0;
+               zout = a->zout;
+            }
+            zcopy_match(zout, dist, len);
+            zout += len;
+            break;
+
+         case ZFAST_END:
+            a->zout = zout;
+            return 1;
+
+         default:
+            return e("bad huffman code","Corrupt PNG");
+      }
+   }
+}
+
+// one symbol per lookup, and matches copied a byte at a time
+static int parse_huffman_block_symbols(zbuf *a)
 {
    for(;;) {
       int z = zhuffman_decode(a, &a->z_length);
@@ -2138,19 +3078,20 @@ static int parse_huffman_block(zbuf *a)
          if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
          *a->zout++ = (char) z;
       } else {
-         uint8 *p;
+         char *p;
          int len,dist;
          if (z == 256) return 1;
+         if (z >= 286) return e("bad huffman code","Corrupt PNG");
          z -= 257;
          len = length_base[z];
          if (length_extra[z]) len += zreceive(a, length_extra[z]);
          z = zhuffman_decode(a, &a->z_distance);
-         if (z < 0) return e("bad huffman code","Corrupt PNG");
+         if (z < 0 || z >= 30) return e("bad huffman code","Corrupt PNG");
          dist = dist_base[z];
          if (dist_extra[z]) dist += zreceive(a, dist_extra[z]);
          if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
          if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
-         p = (uint8 *) (a->zout - dist);
+         p = a->zout - dist;
          while (len--)
             *a->zout++ = *p++;
       }
@@ -2161,7 +3102,7 @@ static int compute_huffman_codes(zbuf *a)
 {
    static uint8 length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
    zhuffman z_codelength;
-   uint8 lencodes[286+32+137];//padding for maximum single op
+   uint8 lencodes[288+32+137];//padding for maximum single op
    uint8 codelength_sizes[19];
    int i,n;
 
@@ -2179,10 +3120,11 @@ static int compute_huffman_codes(zbuf *a)
    n = 0;
    while (n < hlit + hdist) {
       int c = zhuffman_decode(a, &z_codelength);
-      assert(c >= 0 && c < 19);
+      if (c < 0 || c >= 19) return e("bad codelengths","Corrupt PNG");
       if (c < 16)
          lencodes[n++] = (uint8) c;
       else if (c == 16) {
+         if (n == 0) return e("bad codelengths","Corrupt PNG");
          c = zreceive(a,2)+3;
          memset(lencodes+n, lencodes[n-1], c);
          n += c;
@@ -2211,24 +3153,49 @@ static int parse_uncompressed_block(zbuf *a)
       zreceive(a, a->num_bits & 7); // discard
    // drain the bit-packed data into header
    k = 0;
-   while (a->num_bits > 0) {
+   while (a->num_bits > 0 && k < 4) {
       header[k++] = (uint8) (a->code_buffer & 255); // wtf this warns?
       a->code_buffer >>= 8;
       a->num_bits -= 8;
    }
-   assert(a->num_bits == 0);
    // now fill header the normal way
+   if (a->num_bits == 0)
+      a->code_buffer = 0; // drop bytes fill_bits() read ahead
    while (k < 4)
       header[k++] = (uint8) zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return e("zlib corrupt","Corrupt PNG");
-   if (a->zbuffer + len > a->zbuffer_end) return e("read past buffer","Corrupt PNG");
-   if (a->zout + len > a->zout_end)
-      if (!expand(a, len)) return 0;
-   memcpy(a->zout, a->zbuffer, len);
-   a->zbuffer += len;
-   a->zout += len;
+   // a streaming decode may only make room for part of it at a time
+   while (len > 0) {
+      int n;
+      if (a->zout == a->zout_end)
+         if (!expand(a, len)) return 0;
+      n = (int) (a->zout_end - a->zout);
+      if (n > len) n = len;
+      len -= n;
+      // the bit buffer can hold the first few bytes of data, too
+      while (a->num_bits > 0 && n > 0) {
+         *a->zout++ = (char) (a->code_buffer & 255);
+         a->code_buffer >>= 8;
+         a->num_bits -= 8;
+         --n;
+      }
+      if (a->num_bits == 0)
+         a->code_buffer = 0;
+      while (n > 0) {
+         k = (int) (a->zbuffer_end - a->zbuffer);
+         if (k == 0) {
+            if (!zmore(a)) return e("read past buffer","Corrupt PNG");
+            continue;
+         }
+         if (k > n) k = n;
+         memcpy(a->zout, a->zbuffer, k);
+         a->zbuffer += k;
+         a->zout += k;
+         n -= k;
+      }
+   }
    return 1;
 }
 
@@ -2245,20 +3212,21 @@ static int parse_zlib_header(zbuf *a)
    return 1;
 }
 
-// @TODO: should statically initialize these for optimal thread safety
-static uint8 default_length[288], default_distance[32];
-static void init_defaults(void)
+// the fixed code lengths: 0..143 are 8 bits, 144..255 9, 256..279 7 and
+// 280..287 8; all distances are 5
+#define ZLEN8(n)   n,n,n,n,n,n,n,n
+#define ZLEN16(n)  ZLEN8(n),ZLEN8(n)
+static const uint8 default_length[288] =
 {
-   int i;   // use <= to match clearly with spec
-   for (i=0; i <= 143; ++i)     default_length[i]   = 8;
-   for (   ; i <= 255; ++i)     default_length[i]   = 9;
-   for (   ; i <= 279; ++i)     default_length[i]   = 7;
-   for (   ; i <= 287; ++i)     default_length[i]   = 8;
-
-   for (i=0; i <=  31; ++i)     default_distance[i] = 5;
-}
+   ZLEN16(8),ZLEN16(8),ZLEN16(8),ZLEN16(8),ZLEN16(8),ZLEN16(8),ZLEN16(8),ZLEN16(8),ZLEN16(8),
+   ZLEN16(9),ZLEN16(9),ZLEN16(9),ZLEN16(9),ZLEN16(9),ZLEN16(9),ZLEN16(9),
+   ZLEN16(7),ZLEN8(7),
+   ZLEN8(8)
+};
+static const uint8 default_distance[32] = { ZLEN16(5),ZLEN16(5) };
+#undef ZLEN16
+#undef ZLEN8
 
-int stbi_png_partial; // a quick hack to only allow decoding some of a PNG... I should implement real streaming support instead
 static int parse_zlib(zbuf *a, int parse_header)
 {
    int final, type;
@@ -2276,26 +3244,31 @@ static int parse_zlib(zbuf *a, int parse_header)
       } else {
          if (type == 1) {
             // use fixed code lengths
-            if (!default_distance[31]) init_defaults();
             if (!zbuild_huffman(&a->z_length  , default_length  , 288)) return 0;
             if (!zbuild_huffman(&a->z_distance, default_distance,  32)) return 0;
          } else {
             if (!compute_huffman_codes(a)) return 0;
          }
-         if (!parse_huffman_block(a)) return 0;
+         if (a->fast_tables) {
+            zbuild_fast_tables(a);
+            if (!parse_huffman_block(a)) return 0;
+         } else {
+            if (!parse_huffman_block_symbols(a)) return 0;
+         }
       }
-      if (stbi_png_partial && a->zout - a->zout_start > 65536)
-         break;
    } while (!final);
    return 1;
 }
 
-static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
+static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header, stbi_context *ctx)
 {
    a->zout_start = obuf;
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->more = NULL;
+   a->flush = NULL;
+   a->fast_tables = ctx->inflate_fast_tables;
 
    return parse_zlib(a, parse_header);
 }
@@ -2303,15 +3276,15 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
 char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) stbi_malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
-   if (do_zlib(&a, p, initial_size, 1, 1)) {
+   if (do_zlib(&a, p, initial_size, 1, 1, &stbi_shared)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -2324,15 +3297,15 @@ char *stbi_zlib_decode_malloc(char const *buffer, int len, int *outlen)
 char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) stbi_malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
-   if (do_zlib(&a, p, initial_size, 1, parse_header)) {
+   if (do_zlib(&a, p, initial_size, 1, parse_header, &stbi_shared)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -2342,7 +3315,7 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
    zbuf a;
    a.zbuffer = (uint8 *) ibuffer;
    a.zbuffer_end = (uint8 *) ibuffer + ilen;
-   if (do_zlib(&a, obuffer, olen, 0, 1))
+   if (do_zlib(&a, obuffer, olen, 0, 1, &stbi_shared))
       return (int) (a.zout - a.zout_start);
    else
       return -1;
@@ -2351,15 +3324,15 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
 char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(16384);
+   char *p = (char *) stbi_malloc(16384);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer+len;
-   if (do_zlib(&a, p, 16384, 1, 0)) {
+   if (do_zlib(&a, p, 16384, 1, 0, &stbi_shared)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -2369,7 +3342,7 @@ int stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffe
    zbuf a;
    a.zbuffer = (uint8 *) ibuffer;
    a.zbuffer_end = (uint8 *) ibuffer + ilen;
-   if (do_zlib(&a, obuffer, olen, 0, 0))
+   if (do_zlib(&a, obuffer, olen, 0, 0, &stbi_shared))
       return (int) (a.zout - a.zout_start);
    else
       return -1;
@@ -2415,6 +3388,11 @@ typedef struct
 {
    stbi *s;
    uint8 *idata, *expanded, *out;
+   int direct; // out is stbi_load_into's buffer
+
+   // for SCAN_stream, what the chunks before the image data said
+   uint8 palette[1024], pal_img_n, has_trans, tc[3];
+   uint32 idat_left; // of the IDAT chunk the scan stopped in
 } png;
 
 
@@ -2439,6 +3417,198 @@ static int paeth(int a, int b, int c)
    return c;
 }
 
+#ifdef STBI_SSE2
+// SIMD versions of the filters for 3 and 4 bytes per pixel, working on whole
+// rows of n bytes. the first row is done against an all-zero prior row, which
+// gives the same results as the *_first filters. Sub, Avg and Paeth depend on
+// the pixel to the left, so apart from Sub they go one pixel at a time.
+typedef void (*png_unfilter_row)(uint8 *cur, uint8 const *raw, uint8 const *prior, uint32 n, int bpp);
+
+// 3-byte pixels are put together in registers; going through a 4-byte
+// temporary in memory stalls on store forwarding
+static stbi_inline __m128i png_load_pixel(uint8 const *p, int bpp)
+{
+   uint32 v;
+   if (bpp == 4) memcpy(&v, p, 4);
+   else          v = p[0] | (p[1] << 8) | ((uint32) p[2] << 16);
+   return _mm_cvtsi32_si128((int) v);
+}
+
+static stbi_inline void png_store_pixel(uint8 *p, __m128i v, int bpp)
+{
+   uint32 x = (uint32) _mm_cvtsi128_si32(v);
+   if (bpp == 4) {
+      memcpy(p, &x, 4);
+   } else {
+      p[0] = (uint8) x;
+      p[1] = (uint8) (x >> 8);
+      p[2] = (uint8) (x >> 16);
+   }
+}
+
+static void png_unfilter_none(uint8 *cur, uint8 const *raw, uint8 const *prior, uint32 n, int bpp)
+{
+   STBI_NOTUSED(prior);
+   STBI_NOTUSED(bpp);
+   memcpy(cur, raw, n);
+}
+
+static void png_unfilter_sub_sse2(uint8 *cur, uint8 const *raw, uint8 const *prior, uint32 n, int bpp)
+{
+   // prefix sums of 4 pixels at a time, plus the last pixel of the previous
+   // group spread over all of them. groups are 12 bytes for bpp 3, but loads
+   // and stores are 16 bytes, so stop while 16 are left
+   __m128i left = _mm_setzero_si128();
+   uint32 i = 0;
+   STBI_NOTUSED(prior);
+   if (bpp == 4) {
+      for (; i+16 <= n; i += 16) {
+         __m128i x = _mm_loadu_si128((__m128i const *) (raw+i));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+         x = _mm_add_epi8(x, left);
+         _mm_storeu_si128((__m128i *) (cur+i), x);
+         left = _mm_shuffle_epi32(x, _MM_SHUFFLE(3,3,3,3));
+      }
+   } else {
+      __m128i mask = _mm_cvtsi32_si128(0xffffff);
+      for (; i+16 <= n; i += 12) {
+         __m128i x = _mm_loadu_si128((__m128i const *) (raw+i));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+         x = _mm_add_epi8(x, left);
+         _mm_storeu_si128((__m128i *) (cur+i), x);
+         left = _mm_and_si128(_mm_srli_si128(x, 9), mask);
+         left = _mm_or_si128(left, _mm_slli_si128(left, 3));
+         left = _mm_or_si128(left, _mm_slli_si128(left, 6));
+      }
+   }
+   for (; i < n; ++i)
+      cur[i] = raw[i] + (i >= (uint32) bpp ? cur[i-bpp] : 0);
+}
+
+static void png_unfilter_up_sse2(uint8 *cur, uint8 const *raw, uint8 const *prior, uint32 n, int bpp)
+{
+   uint32 i = 0;
+   STBI_NOTUSED(bpp);
+   for (; i+16 <= n; i += 16) {
+      __m128i x = _mm_loadu_si128((__m128i const *) (raw+i));
+      __m128i b = _mm_loadu_si128((__m128i const *) (prior+i));
+      _mm_storeu_si128((__m128i *) (cur+i), _mm_add_epi8(x, b));
+   }
+   for (; i < n; ++i)
+      cur[i] = raw[i] + prior[i];
+}
+
+static void png_unfilter_avg_sse2(uint8 *cur, uint8 const *raw, uint8 const *prior, uint32 n, int bpp)
+{
+   // _mm_avg_epu8 rounds up; taking off the low bit of a^b rounds down
+   __m128i ones = _mm_set1_epi8(1);
+   __m128i a = _mm_setzero_si128();
+   uint32 i;
+   for (i=0; i < n; i += bpp) {
+      __m128i b = png_load_pixel(prior+i, bpp);
+      __m128i x = png_load_pixel(raw+i, bpp);
+      __m128i avg = _mm_avg_epu8(a, b);
+      avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), ones));
+      a = _mm_add_epi8(x, avg);
+      png_store_pixel(cur+i, a, bpp);
+   }
+}
+
+// paeth() on 16-bit lanes. with p = a+b-c, |p-a| = |b-c|, |p-b| = |a-c| and
+// |p-c| = |(b-c) + (a-c)|; ties go to a, then b, as in paeth()
+#define PNG_PAETH_SIMD(name, target, abs_epi16)                                     \
+target static void name(uint8 *cur, uint8 const *raw, uint8 const *prior, uint32 n, int bpp) \
+{                                                                                   \
+   __m128i zero = _mm_setzero_si128();                                              \
+   __m128i a = zero, c = zero;                                                      \
+   uint32 i;                                                                        \
+   for (i=0; i < n; i += bpp) {                                                     \
+      __m128i b = _mm_unpacklo_epi8(png_load_pixel(prior+i, bpp), zero);            \
+      __m128i x = _mm_unpacklo_epi8(png_load_pixel(raw+i, bpp), zero);              \
+      __m128i pa = _mm_sub_epi16(b, c);                                             \
+      __m128i pb = _mm_sub_epi16(a, c);                                             \
+      __m128i pc = _mm_add_epi16(pa, pb);                                           \
+      __m128i smallest, use_a, use_b, nearest;                                      \
+      pa = abs_epi16(pa);                                                           \
+      pb = abs_epi16(pb);                                                           \
+      pc = abs_epi16(pc);                                                           \
+      smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));                          \
+      use_a = _mm_cmpeq_epi16(smallest, pa);                                        \
+      use_b = _mm_andnot_si128(use_a, _mm_cmpeq_epi16(smallest, pb));               \
+      nearest = _mm_or_si128(_mm_and_si128(use_a, a), _mm_and_si128(use_b, b));    \
+      nearest = _mm_or_si128(nearest, _mm_andnot_si128(_mm_or_si128(use_a, use_b), c)); \
+      a = _mm_and_si128(_mm_add_epi16(x, nearest), _mm_set1_epi16(0xff));           \
+      png_store_pixel(cur+i, _mm_packus_epi16(a, a), bpp);                          \
+      c = b;                                                                        \
+   }                                                                                \
+}
+
+static stbi_inline __m128i png_abs_epi16_sse2(__m128i x)
+{
+   return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+PNG_PAETH_SIMD(png_unfilter_paeth_sse2, , png_abs_epi16_sse2)
+PNG_PAETH_SIMD(png_unfilter_paeth_ssse3, STBI_SSSE3_TARGET, _mm_abs_epi16)
+#undef PNG_PAETH_SIMD
+
+static void png_simd_unfilters(stbi *s, png_unfilter_row unfilter[5])
+{
+   unfilter[F_none] = png_unfilter_none;
+   unfilter[F_sub] = png_unfilter_sub_sse2;
+   unfilter[F_up] = png_unfilter_up_sse2;
+   unfilter[F_avg] = png_unfilter_avg_sse2;
+   unfilter[F_paeth] = stbi_simd_level(s) >= STBI_SIMD_SSSE3 ? png_unfilter_paeth_ssse3 : png_unfilter_paeth_sse2;
+}
+
+// unfilters all rows of an image with 3 or 4 bytes per pixel into rows
+// 'stride' bytes apart. filtered rows of img_n bytes per pixel go straight
+// into the output if out_n matches, otherwise into a scratch row that is
+// then expanded with alpha 255
+static int create_png_image_simd(png *a, uint8 *raw, int out_n, uint32 x, uint32 y, uint32 stride)
+{
+   png_unfilter_row unfilter[5];
+   int img_n = a->s->img_n;
+   uint32 i, j, n = x * img_n;
+   uint8 *rows, *zero_row, *prior, *cur;
+
+   png_simd_unfilters(a->s, unfilter);
+
+   rows = (uint8 *) stbi_malloc(img_n == out_n ? n : 3*n);
+   if (!rows) return e("outofmem", "Out of memory");
+   zero_row = rows;
+   memset(zero_row, 0, n);
+   prior = zero_row;
+
+   for (j=0; j < y; ++j) {
+      int filter = *raw++;
+      if (filter > 4) { stbi_free(rows); return e("invalid filter","Corrupt PNG"); }
+      if (img_n == out_n)
+         cur = a->out + stride*j;
+      else
+         cur = rows + n + (j & 1)*n;
+      unfilter[filter](cur, raw, prior, n, img_n);
+      raw += n;
+      prior = cur;
+
+      if (img_n != out_n) {
+         // only RGB gets an alpha channel added
+         uint8 *out = a->out + stride*j;
+         for (i=0; i < x; ++i, out += 4, cur += 3) {
+            out[0] = cur[0];
+            out[1] = cur[1];
+            out[2] = cur[2];
+            out[3] = 255;
+         }
+      }
+   }
+   stbi_free(rows);
+   return 1;
+}
+#endif // STBI_SSE2
+
 // create the png data from post-deflated data
 static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, uint32 x, uint32 y)
 {
@@ -2447,16 +3617,22 @@ static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, u
    int k;
    int img_n = s->img_n; // copy it into a local for later
    assert(out_n == s->img_n || out_n == s->img_n+1);
-   if (stbi_png_partial) y = 1;
-   a->out = (uint8 *) malloc(x * y * out_n);
-   if (!a->out) return e("outofmem", "Out of memory");
-   if (!stbi_png_partial) {
-      if (s->img_x == x && s->img_y == y) {
-         if (raw_len != (img_n * x + 1) * y) return e("not enough pixels","Corrupt PNG");
-      } else { // interlaced:
-         if (raw_len < (img_n * x + 1) * y) return e("not enough pixels","Corrupt PNG");
-      }
+   if (a->direct) {
+      a->out = s->out;
+      stride = s->out_stride;
+   } else {
+      a->out = (uint8 *) stbi_malloc(x * y * out_n);
+      if (!a->out) return e("outofmem", "Out of memory");
+   }
+   if (s->img_x == x && s->img_y == y) {
+      if (raw_len != (img_n * x + 1) * y) return e("not enough pixels","Corrupt PNG");
+   } else { // interlaced:
+      if (raw_len < (img_n * x + 1) * y) return e("not enough pixels","Corrupt PNG");
    }
+   #ifdef STBI_SSE2
+   if ((img_n == 3 || img_n == 4) && stbi_simd_level(s) >= STBI_SIMD_SSE2)
+      return create_png_image_simd(a, raw, out_n, x, y, stride);
+   #endif
    for (j=0; j < y; ++j) {
       uint8 *cur = a->out + stride*j;
       uint8 *prior = cur - stride;
@@ -2517,44 +3693,63 @@ static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, u
    return 1;
 }
 
+// Adam7 passes
+static int png_pass_xorig[] = { 0,4,0,2,0,1,0 };
+static int png_pass_yorig[] = { 0,0,4,0,2,0,1 };
+static int png_pass_xspc[]  = { 8,8,4,4,2,2,1 };
+static int png_pass_yspc[]  = { 8,8,8,4,4,2,2 };
+
+// size of the decompressed image data: a filter byte plus img_n bytes per
+// pixel for every row of every pass. 0 if that doesn't fit in an int
+static int png_raw_size(stbi *s, int interlaced)
+{
+   uint64 size = 0;
+   int p;
+   if (!interlaced)
+      size = ((uint64) s->img_n * s->img_x + 1) * s->img_y;
+   else {
+      for (p=0; p < 7; ++p) {
+         uint64 x = (s->img_x - png_pass_xorig[p] + png_pass_xspc[p]-1) / png_pass_xspc[p];
+         uint64 y = (s->img_y - png_pass_yorig[p] + png_pass_yspc[p]-1) / png_pass_yspc[p];
+         if (x && y)
+            size += (s->img_n * x + 1) * y;
+      }
+   }
+   return size <= 0x7fffffff ? (int) size : 0;
+}
+
 static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int interlaced)
 {
    uint8 *final;
    int p;
-   int save;
    if (!interlaced)
       return create_png_image_raw(a, raw, raw_len, out_n, a->s->img_x, a->s->img_y);
-   save = stbi_png_partial;
-   stbi_png_partial = 0;
 
    // de-interlacing
-   final = (uint8 *) malloc(a->s->img_x * a->s->img_y * out_n);
+   final = (uint8 *) stbi_malloc(a->s->img_x * a->s->img_y * out_n);
    for (p=0; p < 7; ++p) {
-      int xorig[] = { 0,4,0,2,0,1,0 };
-      int yorig[] = { 0,0,4,0,2,0,1 };
-      int xspc[]  = { 8,8,4,4,2,2,1 };
-      int yspc[]  = { 8,8,8,4,4,2,2 };
+      int *xorig = png_pass_xorig, *yorig = png_pass_yorig;
+      int *xspc = png_pass_xspc, *yspc = png_pass_yspc;
       int i,j,x,y;
       // pass1_x[4] = 0, pass1_x[5] = 1, pass1_x[12] = 1
       x = (a->s->img_x - xorig[p] + xspc[p]-1) / xspc[p];
       y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
       if (x && y) {
          if (!create_png_image_raw(a, raw, raw_len, out_n, x, y)) {
-            free(final);
+            stbi_free(final);
             return 0;
          }
          for (j=0; j < y; ++j)
             for (i=0; i < x; ++i)
                memcpy(final + (j*yspc[p]+yorig[p])*a->s->img_x*out_n + (i*xspc[p]+xorig[p])*out_n,
                       a->out + (j*x+i)*out_n, out_n);
-         free(a->out);
+         stbi_free(a->out);
          raw += (x*out_n+1)*y;
          raw_len -= (x*out_n+1)*y;
       }
    }
    a->out = final;
 
-   stbi_png_partial = save;
    return 1;
 }
 
@@ -2588,10 +3783,10 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
    uint32 i, pixel_count = a->s->img_x * a->s->img_y;
    uint8 *p, *temp_out, *orig = a->out;
 
-   p = (uint8 *) malloc(pixel_count * pal_img_n);
+   p = (uint8 *) stbi_malloc(pixel_count * pal_img_n);
    if (p == NULL) return e("outofmem", "Out of memory");
 
-   // between here and free(out) below, exitting would leak
+   // between here and stbi_free(out) below, exitting would leak
    temp_out = p;
 
    if (pal_img_n == 3) {
@@ -2612,7 +3807,7 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
          p += 4;
       }
    }
-   free(a->out);
+   stbi_free(a->out);
    a->out = temp_out;
 
    STBI_NOTUSED(len);
@@ -2620,16 +3815,13 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
    return 1;
 }
 
-static int stbi_unpremultiply_on_load = 0;
-static int stbi_de_iphone_flag = 0;
-
 void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
 {
-   stbi_unpremultiply_on_load = flag_true_if_should_unpremultiply;
+   stbi_shared.unpremultiply_on_load = flag_true_if_should_unpremultiply;
 }
 void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
 {
-   stbi_de_iphone_flag = flag_true_if_should_convert;
+   stbi_shared.convert_iphone_png_to_rgb = flag_true_if_should_convert;
 }
 
 static void stbi_de_iphone(png *z)
@@ -2647,7 +3839,7 @@ static void stbi_de_iphone(png *z)
       }
    } else {
       assert(s->img_out_n == 4);
-      if (stbi_unpremultiply_on_load) {
+      if (s->ctx->unpremultiply_on_load) {
          // convert bgr to rgb and unpremultiply
          for (i=0; i < pixel_count; ++i) {
             uint8 a = p[3];
@@ -2685,6 +3877,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
    z->expanded = NULL;
    z->idata = NULL;
    z->out = NULL;
+   z->direct = 0;
 
    if (!check_png_header(s)) return 0;
 
@@ -2694,7 +3887,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
       chunk c = get_chunk_header(s);
       switch (c.type) {
          case PNG_TYPE('C','g','B','I'):
-            iphone = stbi_de_iphone_flag;
+            iphone = s->ctx->convert_iphone_png_to_rgb;
             skip(s, c.length);
             break;
          case PNG_TYPE('I','H','D','R'): {
@@ -2763,12 +3956,23 @@ static int parse_png_file(png *z, int scan, int req_comp)
             if (first) return e("first not IHDR", "Corrupt PNG");
             if (pal_img_n && !pal_len) return e("no PLTE","Corrupt PNG");
             if (scan == SCAN_header) { s->img_n = pal_img_n; return 1; }
+            if (scan == SCAN_stream) {
+               if (interlace) return e("interlaced","PNG not supported: can't stream interlaced");
+               if (iphone) return e("iphone","PNG not supported: can't stream iPhone");
+               memcpy(z->palette, palette, pal_len * 4);
+               z->pal_img_n = pal_img_n;
+               z->has_trans = has_trans;
+               memcpy(z->tc, tc, sizeof(tc));
+               z->idat_left = c.length;
+               return 1;
+            }
             if (ioff + c.length > idata_limit) {
                uint8 *p;
+               uint32 old_limit = idata_limit;
                if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
-               p = (uint8 *) realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
+               p = (uint8 *) stbi_realloc(z->idata, old_limit, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!getn(s, z->idata+ioff,c.length)) return e("outofdata","Corrupt PNG");
@@ -2778,16 +3982,30 @@ static int parse_png_file(png *z, int scan, int req_comp)
 
          case PNG_TYPE('I','E','N','D'): {
             uint32 raw_len;
+            int raw_size;
+            zbuf zb;
             if (first) return e("first not IHDR", "Corrupt PNG");
             if (scan != SCAN_load) return 1;
             if (z->idata == NULL) return e("no IDAT","Corrupt PNG");
-            z->expanded = (uint8 *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, 16384, (int *) &raw_len, !iphone);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            free(z->idata); z->idata = NULL;
+            // valid data fills exactly raw_size bytes, so anything that
+            // needs more is corrupt
+            raw_size = png_raw_size(s, interlace);
+            if (!raw_size) return e("too large","Corrupt PNG");
+            z->expanded = (uint8 *) stbi_malloc(raw_size);
+            if (z->expanded == NULL) return e("outofmem", "Out of memory");
+            zb.zbuffer = z->idata;
+            zb.zbuffer_end = z->idata + ioff;
+            if (!do_zlib(&zb, (char *) z->expanded, raw_size, 0, !iphone, s->ctx)) return 0;
+            raw_len = (uint32) (zb.zout - zb.zout_start);
+            stbi_free(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
+            // nothing is done to a plain image after unfiltering, so it can
+            // go straight into the caller's buffer
+            if (!interlace && !has_trans && !iphone && !pal_img_n && req_comp == s->img_out_n)
+               z->direct = stbi_direct_out(s, s->img_out_n) != NULL;
             if (!create_png_image(z, z->expanded, raw_len, s->img_out_n, interlace)) return 0;
             if (has_trans)
                if (!compute_transparency(z, tc, s->img_out_n)) return 0;
@@ -2801,7 +4019,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
                if (!expand_palette(z, palette, pal_len, s->img_out_n))
                   return 0;
             }
-            free(z->expanded); z->expanded = NULL;
+            stbi_free(z->expanded); z->expanded = NULL;
             return 1;
          }
 
@@ -2810,8 +4028,8 @@ static int parse_png_file(png *z, int scan, int req_comp)
             if (first) return e("first not IHDR", "Corrupt PNG");
             if ((c.type & (1 << 29)) == 0) {
                #ifndef STBI_NO_FAILURE_STRINGS
-               // not threadsafe
-               static char invalid_chunk[] = "XXXX chunk not known";
+               char *invalid_chunk = failure_text;
+               strcpy(invalid_chunk, "XXXX chunk not known");
                invalid_chunk[0] = (uint8) (c.type >> 24);
                invalid_chunk[1] = (uint8) (c.type >> 16);
                invalid_chunk[2] = (uint8) (c.type >>  8);
@@ -2843,9 +4061,10 @@ static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   free(p->out);      p->out      = NULL;
-   free(p->expanded); p->expanded = NULL;
-   free(p->idata);    p->idata    = NULL;
+   if (!p->direct) stbi_free(p->out);
+   p->out = NULL;
+   stbi_free(p->expanded); p->expanded = NULL;
+   stbi_free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -2884,6 +4103,256 @@ static int      stbi_png_info(stbi *s, int *x, int *y, int *comp)
    return stbi_png_info_raw(&p, x, y, comp);
 }
 
+// streaming PNG decoder
+//    reads the file up to the image data with parse_png_file, then inflates
+//    with the IDAT chunks as input, a piece at a time, and a ZWINDOW*2 byte
+//    output buffer. rows are put together from the output as it's flushed,
+//    unfiltered against the previous row, brought to req_comp components
+//    and handed to the caller; so memory is a few rows plus the window,
+//    however large the image is
+
+typedef struct
+{
+   png p;
+   zbuf z;
+   uint8 input[4096]; // IDAT data, when not reading from memory
+   int req_comp;
+   uint32 row_bytes; // filtered, without the filter byte
+   uint32 have;      // bytes of the next filtered row in 'raw'
+   uint32 row;
+   uint8 *raw, *cur, *prior, *expanded, *out;
+   #ifdef STBI_SSE2
+   png_unfilter_row unfilter[5]; // for 3 and 4 byte pixels
+   int simd;
+   #endif
+   stbi_png_row_callback callback;
+   void *user;
+} png_stream;
+
+// plain C unfiltering of one row of n bytes; the first row is done against
+// an all-zero prior row, which gives the same results as the *_first filters
+static void png_unfilter_row_c(uint8 *cur, uint8 const *raw, uint8 const *prior, int filter, uint32 n, int bpp)
+{
+   uint32 i;
+   switch (filter) {
+      case F_none:
+         memcpy(cur, raw, n);
+         break;
+      case F_sub:
+         memcpy(cur, raw, bpp);
+         for (i=bpp; i < n; ++i) cur[i] = raw[i] + cur[i-bpp];
+         break;
+      case F_up:
+         for (i=0; i < n; ++i) cur[i] = raw[i] + prior[i];
+         break;
+      case F_avg:
+         for (i=0; i < (uint32) bpp; ++i) cur[i] = raw[i] + (prior[i] >> 1);
+         for (   ; i < n; ++i) cur[i] = raw[i] + ((prior[i] + cur[i-bpp]) >> 1);
+         break;
+      case F_paeth:
+         for (i=0; i < (uint32) bpp; ++i) cur[i] = raw[i] + prior[i];
+         for (   ; i < n; ++i) cur[i] = (uint8) (raw[i] + paeth(cur[i-bpp], prior[i], prior[i-bpp]));
+         break;
+   }
+}
+
+// 'raw' is a filter byte and row_bytes of filtered data
+static int png_stream_row(png_stream *z, uint8 const *raw)
+{
+   stbi *s = z->p.s;
+   uint8 *row = z->cur, *t;
+   int filter = raw[0], n = z->p.pal_img_n ? 1 : s->img_n;
+   uint32 i;
+   if (filter > 4) return e("invalid filter","Corrupt PNG");
+   if (z->row >= s->img_y) return e("too many pixels","Corrupt PNG");
+
+   #ifdef STBI_SSE2
+   if (z->simd)
+      z->unfilter[filter](z->cur, raw+1, z->prior, z->row_bytes, n);
+   else
+   #endif
+      png_unfilter_row_c(z->cur, raw+1, z->prior, filter, z->row_bytes, n);
+
+   // the same steps as a whole image goes through after create_png_image
+   if (z->p.pal_img_n) {
+      int pal_n = z->req_comp >= 3 ? z->req_comp : z->p.pal_img_n;
+      uint8 *p = z->expanded;
+      for (i=0; i < s->img_x; ++i, p += pal_n)
+         memcpy(p, z->p.palette + z->cur[i]*4, pal_n);
+      row = z->expanded;
+      n = pal_n;
+   } else if (z->p.has_trans) {
+      uint8 *p = z->expanded;
+      uint8 const *c = z->cur;
+      for (i=0; i < s->img_x; ++i, c += n, p += n+1) {
+         memcpy(p, c, n);
+         p[n] = 255;
+         if (n == 1) {
+            if (c[0] == z->p.tc[0]) p[1] = 0;
+         } else {
+            if (c[0] == z->p.tc[0] && c[1] == z->p.tc[1] && c[2] == z->p.tc[2]) p[3] = 0;
+         }
+      }
+      row = z->expanded;
+      n += 1;
+   }
+   if (n != z->req_comp) {
+      convert_row(row, n, z->out, z->req_comp, s->img_x);
+      row = z->out;
+   }
+   if (!z->callback(z->user, (int) z->row, row)) return e("stopped","Row callback stopped decoding");
+
+   t = z->prior; z->prior = z->cur; z->cur = t;
+   ++z->row;
+   return 1;
+}
+
+// zbuf's 'flush': takes inflated data, which can end anywhere in a row.
+// whole rows are used where they are; the rest is put together in 'raw'
+static int png_stream_flush(void *user, uint8 const *data, int len)
+{
+   png_stream *z = (png_stream *) user;
+   uint32 size = z->row_bytes + 1;
+   while (len > 0) {
+      if (z->have == 0 && (uint32) len >= size) {
+         if (!png_stream_row(z, data)) return 0;
+         data += size;
+         len -= size;
+      } else {
+         uint32 n = size - z->have;
+         if (n > (uint32) len) n = len;
+         memcpy(z->raw + z->have, data, n);
+         z->have += n;
+         data += n;
+         len -= n;
+         if (z->have == size) {
+            z->have = 0;
+            if (!png_stream_row(z, z->raw)) return 0;
+         }
+      }
+   }
+   return 1;
+}
+
+// zbuf's 'more': the next piece of IDAT data, moving on to the next chunk
+// when one runs out. in memory it's used where it is
+static int png_stream_more(void *user, uint8 **data, uint8 **data_end)
+{
+   png_stream *z = (png_stream *) user;
+   stbi *s = z->p.s;
+   uint32 n;
+   while (z->p.idat_left == 0) {
+      chunk c;
+      get32(s); // CRC
+      c = get_chunk_header(s);
+      if (c.type != PNG_TYPE('I','D','A','T')) return 0;
+      z->p.idat_left = c.length;
+   }
+   if (s->io.read == NULL) {
+      n = (uint32) (s->img_buffer_end - s->img_buffer);
+      if (n > z->p.idat_left) n = z->p.idat_left;
+      if (n == 0) return 0;
+      *data = s->img_buffer;
+      s->img_buffer += n;
+   } else {
+      n = z->p.idat_left < sizeof(z->input) ? z->p.idat_left : sizeof(z->input);
+      if (!getn(s, z->input, n)) return 0;
+      *data = z->input;
+   }
+   *data_end = *data + n;
+   z->p.idat_left -= n;
+   return 1;
+}
+
+static int png_stream_rows(png_stream *z, int *x, int *y, int *comp)
+{
+   stbi *s = z->p.s;
+   uint32 x4;
+   uint8 *rows, *window;
+   int ok;
+   if (z->req_comp < 1 || z->req_comp > 4) return e("bad req_comp", "Internal error");
+   if (!parse_png_file(&z->p, SCAN_stream, z->req_comp)) return 0;
+   *x = s->img_x;
+   *y = s->img_y;
+   if (comp) *comp = z->p.pal_img_n ? z->p.pal_img_n : s->img_n;
+
+   // raw, cur and prior rows of filtered bytes; expanded and out rows of up
+   // to 4 bytes a pixel
+   z->row_bytes = s->img_x * (z->p.pal_img_n ? 1 : s->img_n);
+   x4 = s->img_x * 4;
+   rows = (uint8 *) stbi_malloc(3 * z->row_bytes + 1 + 2 * x4);
+   window = (uint8 *) stbi_malloc(2 * ZWINDOW);
+   if (!rows || !window) {
+      stbi_free(rows);
+      stbi_free(window);
+      return e("outofmem", "Out of memory");
+   }
+   z->raw = rows;
+   z->cur = z->raw + z->row_bytes + 1;
+   z->prior = z->cur + z->row_bytes;
+   z->expanded = z->prior + z->row_bytes;
+   z->out = z->expanded + x4;
+   memset(z->prior, 0, z->row_bytes);
+   z->have = z->row = 0;
+   #ifdef STBI_SSE2
+   z->simd = !z->p.pal_img_n && (s->img_n == 3 || s->img_n == 4) && stbi_simd_level(s) >= STBI_SIMD_SSE2;
+   if (z->simd) png_simd_unfilters(s, z->unfilter);
+   #endif
+
+   z->z.zbuffer = z->z.zbuffer_end = NULL;
+   z->z.zout_start = z->z.zout = z->z.zflushed = (char *) window;
+   z->z.zout_end = (char *) window + 2 * ZWINDOW;
+   z->z.z_expandable = 0;
+   z->z.more = png_stream_more;
+   z->z.flush = png_stream_flush;
+   z->z.stream_user = z;
+   z->z.fast_tables = s->ctx->inflate_fast_tables;
+   ok = parse_zlib(&z->z, 1) && zflush(&z->z);
+   if (ok && (z->row != s->img_y || z->have)) ok = e("not enough pixels","Corrupt PNG");
+
+   stbi_free(window);
+   stbi_free(rows);
+   return ok;
+}
+
+static int stbi_png_rows_main(stbi *s, int *x, int *y, int *comp, int req_comp, stbi_png_row_callback row, void *user)
+{
+   png_stream z;
+   z.p.s = s;
+   z.req_comp = req_comp;
+   z.callback = row;
+   z.user = user;
+   return png_stream_rows(&z, x, y, comp);
+}
+
+int stbi_png_rows_from_memory(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_png_row_callback row, void *user)
+{
+   stbi s;
+   int r;
+   stbi_saved saved;
+   start_mem(&s,buffer,len);
+   if (!ctx)
+      return stbi_png_rows_main(&s,x,y,comp,req_comp,row,user);
+   begin_ctx(&s, ctx, &saved);
+   r = stbi_png_rows_main(&s,x,y,comp,req_comp,row,user);
+   end_ctx(ctx, &saved, r);
+   return r;
+}
+
+int stbi_png_rows_from_callbacks(stbi_context *ctx, stbi_io_callbacks const *clbk, void *io_user, int *x, int *y, int *comp, int req_comp, stbi_png_row_callback row, void *user)
+{
+   stbi s;
+   int r;
+   stbi_saved saved;
+   start_callbacks(&s, (stbi_io_callbacks *) clbk, io_user);
+   if (!ctx)
+      return stbi_png_rows_main(&s,x,y,comp,req_comp,row,user);
+   begin_ctx(&s, ctx, &saved);
+   r = stbi_png_rows_main(&s,x,y,comp,req_comp,row,user);
+   end_ctx(ctx, &saved, r);
+   return r;
+}
+
 // Microsoft/Windows BMP image
 
 static int bmp_test(stbi *s)
@@ -3036,11 +4505,11 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       target = req_comp;
    else
       target = s->img_n; // if they want monochrome, we'll post-convert
-   out = (stbi_uc *) malloc(target * s->img_x * s->img_y);
+   out = (stbi_uc *) stbi_malloc(target * s->img_x * s->img_y);
    if (!out) return epuc("outofmem", "Out of memory");
    if (bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { free(out); return epuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi_free(out); return epuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = get8u(s);
          pal[i][1] = get8u(s);
@@ -3051,7 +4520,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       skip(s, offset - 14 - hsz - psize * (hsz == 12 ? 3 : 4));
       if (bpp == 4) width = (s->img_x + 1) >> 1;
       else if (bpp == 8) width = s->img_x;
-      else { free(out); return epuc("bad bpp", "Corrupt BMP"); }
+      else { stbi_free(out); return epuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       for (j=0; j < (int) s->img_y; ++j) {
          for (i=0; i < (int) s->img_x; i += 2) {
@@ -3089,7 +4558,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { free(out); return epuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { stbi_free(out); return epuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = high_bit(mr)-7; rcount = bitcount(mr);
          gshift = high_bit(mg)-7; gcount = bitcount(mr);
@@ -3286,7 +4755,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       //   force a new number of components
       *comp = tga_bits_per_pixel/8;
    }
-   tga_data = (unsigned char*)malloc( tga_width * tga_height * req_comp );
+   tga_data = (unsigned char*)stbi_malloc( tga_width * tga_height * req_comp );
    if (!tga_data) return epuc("outofmem", "Out of memory");
 
    //   skip to the data's starting position (offset usually = 0)
@@ -3297,11 +4766,11 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       //   any data to skip? (offset usually = 0)
       skip(s, tga_palette_start );
       //   load the palette
-      tga_palette = (unsigned char*)malloc( tga_palette_len * tga_palette_bits / 8 );
+      tga_palette = (unsigned char*)stbi_malloc( tga_palette_len * tga_palette_bits / 8 );
       if (!tga_palette) return epuc("outofmem", "Out of memory");
       if (!getn(s, tga_palette, tga_palette_len * tga_palette_bits / 8 )) {
-         free(tga_data);
-         free(tga_palette);
+         stbi_free(tga_data);
+         stbi_free(tga_palette);
          return epuc("bad palette", "Corrupt TGA");
       }
    }
@@ -3437,7 +4906,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    //   clear my palette, if I had one
    if ( tga_palette != NULL )
    {
-      free( tga_palette );
+      stbi_free( tga_palette );
    }
    //   the things I do to get rid of an error message, and yet keep
    //   Microsoft's C compilers happy... [8^(
@@ -3532,7 +5001,7 @@ static stbi_uc *psd_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       return epuc("bad compression", "PSD has an unknown compression format");
 
    // Create the destination image.
-   out = (stbi_uc *) malloc(4 * w*h);
+   out = (stbi_uc *) stbi_malloc(4 * w*h);
    if (!out) return epuc("outofmem", "Out of memory");
    pixelCount = w*h;
 
@@ -3822,11 +5291,11 @@ static stbi_uc *pic_load(stbi *s,int *px,int *py,int *comp,int req_comp)
    get16(s); //skip `pad'
 
    // intermediate buffer is RGBA
-   result = (stbi_uc *) malloc(x*y*4);
+   result = (stbi_uc *) stbi_malloc(x*y*4);
    memset(result, 0xff, x*y*4);
 
    if (!pic_load2(s,x,y,comp, result)) {
-      free(result);
+      stbi_free(result);
       result=0;
    }
    *px = x;
@@ -3855,17 +5324,20 @@ typedef struct stbi_gif_lzw_struct {
    int16 prefix;
    uint8 first;
    uint8 suffix;
+   uint16 length; // of the string, in pixels
 } stbi_gif_lzw;
 
 typedef struct stbi_gif_struct
 {
    int w,h;
    stbi_uc *out;                 // output buffer (always 4 components)
+   stbi_uc *history;             // out before the last frame, if it's to be restored
    int flags, bgindex, ratio, transparent, eflags;
-   uint8  pal[256][4];
+   int delay;                    // of the last frame, in 1/100s
+   uint8  pal[256][4];           // RGBA
    uint8 lpal[256][4];
    stbi_gif_lzw codes[4096];
-   uint8 *color_table;
+   uint8 (*color_table)[4];
    int parse, step;
    int lflags;
    int start_x, start_y;
@@ -3895,10 +5367,10 @@ static void stbi_gif_parse_colortable(stbi *s, uint8 pal[256][4], int num_entrie
 {
    int i;
    for (i=0; i < num_entries; ++i) {
-      pal[i][2] = get8u(s);
-      pal[i][1] = get8u(s);
       pal[i][0] = get8u(s);
-      pal[i][3] = transp ? 0 : 255;
+      pal[i][1] = get8u(s);
+      pal[i][2] = get8u(s);
+      pal[i][3] = transp == i ? 0 : 255;
    }   
 }
 
@@ -3942,38 +5414,86 @@ static int stbi_gif_info_raw(stbi *s, int *x, int *y, int *comp)
    return 1;
 }
 
-static void stbi_out_gif_code(stbi_gif *g, uint16 code)
+static void stbi_gif_next_row(stbi_gif *g)
 {
-   uint8 *p, *c;
+   g->cur_x = g->start_x;
+   g->cur_y += g->step;
 
-   // recurse to decode the prefixes, since the linked-list is backwards,
-   // and working backwards through an interleaved image would be nasty
-   if (g->codes[code].prefix >= 0)
-      stbi_out_gif_code(g, g->codes[code].prefix);
+   while (g->cur_y >= g->max_y && g->parse > 0) {
+      g->step = (1 << g->parse) * g->line_size;
+      g->cur_y = g->start_y + (g->step >> 1);
+      --g->parse;
+   }
+}
 
-   if (g->cur_y >= g->max_y) return;
-  
-   p = &g->out[g->cur_x + g->cur_y];
-   c = &g->color_table[g->codes[code].suffix * 4];
+// writes a string that runs past the end of the row: its pixels come out of
+// the code table last first, so it's collected first, then written a row at
+// a time
+static void stbi_out_gif_string(stbi_gif *g, int code)
+{
+   uint8 string[4096], *p, *c;
+   int i = 4096, run, k;
 
-   if (c[3] >= 128) {
-      p[0] = c[2];
-      p[1] = c[1];
-      p[2] = c[0];
-      p[3] = c[3];
+   do {
+      string[--i] = g->codes[code].suffix;
+      code = g->codes[code].prefix;
+   } while (code >= 0);
+
+   while (i < 4096 && g->cur_y < g->max_y) {
+      run = (g->max_x - g->cur_x) >> 2;
+      if (run > 4096 - i) run = 4096 - i;
+      p = &g->out[g->cur_x + g->cur_y];
+      for (k=0; k < run; ++k, p += 4) {
+         c = g->color_table[string[i+k]];
+         if (c[3] >= 128)
+            memcpy(p, c, 4);
+      }
+      i += run;
+      g->cur_x += run * 4;
+      if (g->cur_x >= g->max_x)
+         stbi_gif_next_row(g);
    }
-   g->cur_x += 4;
+}
 
-   if (g->cur_x >= g->max_x) {
-      g->cur_x = g->start_x;
-      g->cur_y += g->step;
+// writes the string for 'code' to the frame. most fit in the row, and are
+// written from their end backwards, the order the code table gives them in
+stbi_inline static void stbi_out_gif_code(stbi_gif *g, int code)
+{
+   uint8 *p, *c;
+   int len = g->codes[code].length;
 
-      while (g->cur_y >= g->max_y && g->parse > 0) {
-         g->step = (1 << g->parse) * g->line_size;
-         g->cur_y = g->start_y + (g->step >> 1);
-         --g->parse;
-      }
+   if (g->cur_y >= g->max_y) return;
+   if (g->cur_x + len * 4 > g->max_x) {
+      stbi_out_gif_string(g, code);
+      return;
    }
+
+   p = &g->out[g->cur_x + g->cur_y + len * 4];
+   do {
+      p -= 4;
+      c = g->color_table[g->codes[code].suffix];
+      if (c[3] >= 128)
+         memcpy(p, c, 4);
+      code = g->codes[code].prefix;
+   } while (code >= 0);
+   g->cur_x += len * 4;
+   if (g->cur_x >= g->max_x)
+      stbi_gif_next_row(g);
+}
+
+// writes the string for 'code' a pixel at a time, first pixel first
+static void stbi_out_gif_code_recursive(stbi_gif *g, int code)
+{
+   uint8 *c;
+   if (g->codes[code].prefix >= 0)
+      stbi_out_gif_code_recursive(g, g->codes[code].prefix);
+   if (g->cur_y >= g->max_y) return;
+   c = g->color_table[g->codes[code].suffix];
+   if (c[3] >= 128)
+      memcpy(&g->out[g->cur_x + g->cur_y], c, 4);
+   g->cur_x += 4;
+   if (g->cur_x >= g->max_x)
+      stbi_gif_next_row(g);
 }
 
 static uint8 *stbi_process_gif_raster(stbi *s, stbi_gif *g)
@@ -3983,8 +5503,10 @@ static uint8 *stbi_process_gif_raster(stbi *s, stbi_gif *g)
    uint32 first;
    int32 codesize, codemask, avail, oldcode, bits, valid_bits, clear;
    stbi_gif_lzw *p;
+   int direct = s->ctx->gif_direct_strings;
 
    lzw_cs = get8u(s);
+   if (lzw_cs > 12) return epuc("bad code size","Corrupt GIF");
    clear = 1 << lzw_cs;
    first = 1;
    codesize = lzw_cs + 1;
@@ -3995,6 +5517,7 @@ static uint8 *stbi_process_gif_raster(stbi *s, stbi_gif *g)
       g->codes[code].prefix = -1;
       g->codes[code].first = (uint8) code;
       g->codes[code].suffix = (uint8) code;
+      g->codes[code].length = 1;
    }
 
    // support no starting clear code
@@ -4037,10 +5560,14 @@ static uint8 *stbi_process_gif_raster(stbi *s, stbi_gif *g)
                p->prefix = (int16) oldcode;
                p->first = g->codes[oldcode].first;
                p->suffix = (code == avail) ? p->first : g->codes[code].first;
+               p->length = g->codes[oldcode].length + 1;
             } else if (code == avail)
                return epuc("illegal code in raster", "Corrupt GIF");
 
-            stbi_out_gif_code(g, (uint16) code);
+            if (direct)
+               stbi_out_gif_code(g, code);
+            else
+               stbi_out_gif_code_recursive(g, code);
 
             if ((avail & codemask) == 0 && avail <= 0x0FFF) {
                codesize++;
@@ -4055,39 +5582,48 @@ static uint8 *stbi_process_gif_raster(stbi *s, stbi_gif *g)
    }
 }
 
-static void stbi_fill_gif_background(stbi_gif *g)
+// clears [x0,x1) by [y0,y1), in the byte offsets start_x and start_y use.
+// the canvas is transparent, as browsers show it; only the color channels
+// take the background color
+static void stbi_fill_gif_background(stbi_gif *g, int x0, int y0, int x1, int y1)
 {
-   int i;
-   uint8 *c = g->pal[g->bgindex];
-   // @OPTIMIZE: write a dword at a time
-   for (i = 0; i < g->w * g->h * 4; i += 4) {
-      uint8 *p  = &g->out[i];
-      p[0] = c[2];
-      p[1] = c[1];
-      p[2] = c[0];
-      p[3] = c[3];
-   }
+   int x, y;
+   uint8 c[4];
+   memcpy(c, g->pal[g->bgindex], 3);
+   c[3] = 0;
+   for (y = y0; y < y1; y += 4 * g->w)
+      for (x = x0; x < x1; x += 4)
+         memcpy(&g->out[y + x], c, 4);
 }
 
-// this function is designed to support animated gifs, although stb_image doesn't support it
-static uint8 *stbi_gif_load_next(stbi *s, stbi_gif *g, int *comp, int req_comp)
+static int stbi_gif_start(stbi *s, stbi_gif *g, int *comp)
+{
+   if (!stbi_gif_header(s, g, comp,0))     return 0; // failure_reason set by stbi_gif_header
+   g->out = (uint8 *) stbi_malloc(4 * g->w * g->h);
+   if (g->out == 0)                      return e("outofmem", "Out of memory");
+   stbi_fill_gif_background(g, 0, 0, 4 * g->w, 4 * g->w * g->h);
+   return 1;
+}
+
+// decodes the next frame onto g->out, which always has 4 components.
+// returns it, NULL on failure, or 1 after the last frame
+static uint8 *stbi_gif_load_next(stbi *s, stbi_gif *g, int *comp)
 {
    int i;
-   uint8 *old_out = 0;
 
    if (g->out == 0) {
-      if (!stbi_gif_header(s, g, comp,0))     return 0; // failure_reason set by stbi_gif_header
-      g->out = (uint8 *) malloc(4 * g->w * g->h);
-      if (g->out == 0)                      return epuc("outofmem", "Out of memory");
-      stbi_fill_gif_background(g);
+      if (!stbi_gif_start(s, g, comp)) return 0;
    } else {
-      // animated-gif-only path
-      if (((g->eflags & 0x1C) >> 2) == 3) {
-         old_out = g->out;
-         g->out = (uint8 *) malloc(4 * g->w * g->h);
-         if (g->out == 0)                   return epuc("outofmem", "Out of memory");
-         memcpy(g->out, old_out, g->w*g->h*4);
-      }
+      // the previous frame goes away as its graphic control extension says:
+      // 2 clears its area, 3 puts back what was there before
+      int dispose = (g->eflags & 0x1C) >> 2;
+      if (dispose == 2)
+         stbi_fill_gif_background(g, g->start_x, g->start_y, g->max_x, g->max_y);
+      else if (dispose == 3 && g->history)
+         memcpy(g->out, g->history, 4 * g->w * g->h);
+      // the extension only applied to that frame
+      g->eflags = 0;
+      g->delay = 0;
    }
     
    for (;;) {
@@ -4124,21 +5660,26 @@ static uint8 *stbi_gif_load_next(stbi *s, stbi_gif *g, int *comp, int req_comp)
 
             if (g->lflags & 0x80) {
                stbi_gif_parse_colortable(s,g->lpal, 2 << (g->lflags & 7), g->eflags & 0x01 ? g->transparent : -1);
-               g->color_table = (uint8 *) g->lpal;       
+               g->color_table = g->lpal;
             } else if (g->flags & 0x80) {
                for (i=0; i < 256; ++i)  // @OPTIMIZE: reset only the previous transparent
                   g->pal[i][3] = 255; 
                if (g->transparent >= 0 && (g->eflags & 0x01))
                   g->pal[g->transparent][3] = 0;
-               g->color_table = (uint8 *) g->pal;
+               g->color_table = g->pal;
             } else
                return epuc("missing color table", "Corrupt GIF");
+
+            if (((g->eflags & 0x1C) >> 2) == 3) {
+               if (g->history == 0) {
+                  g->history = (uint8 *) stbi_malloc(4 * g->w * g->h);
+                  if (g->history == 0)       return epuc("outofmem", "Out of memory");
+               }
+               memcpy(g->history, g->out, 4 * g->w * g->h);
+            }
    
             o = stbi_process_gif_raster(s, g);
             if (o == NULL) return NULL;
-
-            if (req_comp && req_comp != 4)
-               o = convert_format(o, 4, req_comp, g->w, g->h);
             return o;
          }
 
@@ -4149,7 +5690,7 @@ static uint8 *stbi_gif_load_next(stbi *s, stbi_gif *g, int *comp, int req_comp)
                len = get8(s);
                if (len == 4) {
                   g->eflags = get8(s);
-                  get16le(s); // delay
+                  g->delay = get16le(s);
                   g->transparent = get8(s);
                } else {
                   skip(s, len);
@@ -4175,16 +5716,92 @@ static stbi_uc *stbi_gif_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    uint8 *u = 0;
    stbi_gif g={0};
 
-   u = stbi_gif_load_next(s, &g, comp, req_comp);
+   u = stbi_gif_load_next(s, &g, comp);
    if (u == (void *) 1) u = 0;  // end of animated gif marker
    if (u) {
       *x = g.w;
       *y = g.h;
-   }
+      if (req_comp && req_comp != 4)
+         u = convert_format(u, 4, req_comp, g.w, g.h);
+   } else
+      stbi_free(g.out);
+   stbi_free(g.history);
 
    return u;
 }
 
+struct stbi_gif_frames
+{
+   stbi s;
+   stbi_gif g;
+   stbi_context *ctx;
+};
+
+static stbi_gif_frames *stbi_gif_frames_main(stbi *s, stbi_context *ctx, int *x, int *y)
+{
+   stbi_gif_frames *f = (stbi_gif_frames *) stbi_malloc(sizeof(*f));
+   if (f == NULL) return (stbi_gif_frames *) epuc("outofmem", "Out of memory");
+   memset(&f->g, 0, sizeof(f->g));
+   f->s = *s;
+   f->ctx = ctx;
+   if (!stbi_gif_start(&f->s, &f->g, NULL)) {
+      stbi_free(f->g.out);
+      stbi_free(f);
+      return NULL;
+   }
+   *x = f->g.w;
+   *y = f->g.h;
+   return f;
+}
+
+stbi_gif_frames *stbi_gif_frames_from_memory(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi s;
+   stbi_gif_frames *f;
+   stbi_saved saved;
+   start_mem(&s,buffer,len);
+   if (!ctx)
+      return stbi_gif_frames_main(&s,ctx,x,y);
+   begin_ctx(&s, ctx, &saved);
+   f = stbi_gif_frames_main(&s,ctx,x,y);
+   end_ctx(ctx, &saved, f != NULL);
+   return f;
+}
+
+static int stbi_gif_next_frame_main(stbi_gif_frames *f, stbi_uc const **pixels, int *delay)
+{
+   uint8 *u = stbi_gif_load_next(&f->s, &f->g, NULL);
+   if (u == NULL) return -1;
+   if (u == (void *) 1) return 0;
+   *pixels = u;
+   if (delay) *delay = f->g.delay;
+   return 1;
+}
+
+int stbi_gif_next_frame(stbi_gif_frames *f, stbi_uc const **pixels, int *delay)
+{
+   int r;
+   stbi_saved saved;
+   if (!f->ctx)
+      return stbi_gif_next_frame_main(f,pixels,delay);
+   begin_ctx(&f->s, f->ctx, &saved);
+   r = stbi_gif_next_frame_main(f,pixels,delay);
+   end_ctx(f->ctx, &saved, r >= 0);
+   return r;
+}
+
+// only needs the context's allocator, and leaves its failure reason alone
+void stbi_gif_frames_free(stbi_gif_frames *f)
+{
+   const stbi_allocator *saved = allocator;
+   if (f->ctx)
+      allocator = f->ctx->allocator.allocate ? &f->ctx->allocator : NULL;
+   stbi_free(f->g.out);
+   stbi_free(f->g.history);
+   stbi_free(f);
+   allocator = saved;
+}
+
 static int stbi_gif_info(stbi *s, int *x, int *y, int *comp)
 {
    return stbi_gif_info_raw(s,x,y,comp);
@@ -4306,7 +5923,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    if (req_comp == 0) req_comp = 3;
 
    // Read data
-   hdr_data = (float *) malloc(height * width * req_comp * sizeof(float));
+   hdr_data = (float *) stbi_malloc(height * width * req_comp * sizeof(float));
 
    // Load image data
    // image data is stored as some number of sca
@@ -4339,13 +5956,13 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            free(scanline);
+            stbi_free(scanline);
             goto main_decode_loop; // yes, this makes no sense
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(hdr_data); free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) scanline = (stbi_uc *) malloc(width * 4);
+         if (len != width) { stbi_free(hdr_data); stbi_free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
+         if (scanline == NULL) scanline = (stbi_uc *) stbi_malloc(width * 4);
             
          for (k = 0; k < 4; ++k) {
             i = 0;
@@ -4367,7 +5984,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          for (i=0; i < width; ++i)
             hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
       }
-      free(scanline);
+      stbi_free(scanline);
    }
 
    return hdr_data;
@@ -4549,8 +6166,15 @@ static int stbi_info_main(stbi *s, int *x, int *y, int *comp)
 #ifndef STBI_NO_STDIO
 int stbi_info(char const *filename, int *x, int *y, int *comp)
 {
-    FILE *f = fopen(filename, "rb");
+    FILE *f;
     int result;
+    stbi_mapped_file m;
+    if (map_file(&m, filename)) {
+       result = stbi_info_from_memory(m.data, (int) m.size, x, y, comp);
+       stbi_unmap_file(&m);
+       return result;
+    }
+    f = fopen(filename, "rb");
     if (!f) return e("can't fopen", "Unable to open file");
     result = stbi_info_from_file(f, x, y, comp);
     fclose(f);
@@ -4576,6 +6200,18 @@ int stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *c
    return stbi_info_main(&s,x,y,comp);
 }
 
+int stbi_info_from_memory_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   stbi s;
+   int r;
+   stbi_saved saved;
+   start_mem(&s,buffer,len);
+   begin_ctx(&s, ctx, &saved);
+   r = stbi_info_main(&s,x,y,comp);
+   end_ctx(ctx, &saved, r);
+   return r;
+}
+
 int stbi_info_from_callbacks(stbi_io_callbacks const *c, void *user, int *x, int *y, int *comp)
 {
    stbi s;
@@ -1,7 +1,7 @@
 #pragma once
 
-#include <random>
 #include <algorithm>
+#include <cstdint>
 
 template <typename T>
 T stepTowards(T initial, T target, T step) {
@@ -32,16 +32,112 @@ void remove_if(C& container, const F& predicate) {
 	container.erase(std::remove_if(container.begin(), container.end(), predicate), container.end());
 }
 
-typedef std::mt19937 RandomGenerator;
+/**
+ * PCG32 random number engine (XSH RR variant, 64-bit state).
+ *
+ * The whole state is two 64-bit words, so game states holding one are cheap
+ * to copy, hash and snapshot. Each odd increment selects an independent
+ * stream, which is what split() uses to hand out generators for parallel
+ * work. Satisfies the standard UniformRandomBitGenerator requirements.
+ */
+class Pcg32 {
+public:
+	typedef uint32_t result_type;
+	static const uint64_t DEFAULT_STREAM = 0xDA3E39CB94B95BDBull;
 
-int randRange(RandomGenerator& r, int min, int max) {
-	return std::uniform_int_distribution<>(min, max)(r);
+	Pcg32() { seed(0x853C49E6748FEA9Bull); }
+	explicit Pcg32(uint64_t init_state, uint64_t stream = DEFAULT_STREAM) { seed(init_state, stream); }
+
+	void seed(uint64_t init_state, uint64_t stream = DEFAULT_STREAM) {
+		state = 0;
+		inc = (stream << 1) | 1;
+		step();
+		state += init_state;
+		step();
+	}
+
+	uint32_t operator()() {
+		uint64_t old_state = state;
+		step();
+		uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+		uint32_t rot = static_cast<uint32_t>(old_state >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+	// Returns a uniformly distributed number in [0, range), without the bias
+	// of a plain modulo. Uses Lemire's multiply-and-reject method, which only
+	// divides in the rare case a rejection is possible.
+	uint32_t bounded(uint32_t range) {
+		uint64_t m = uint64_t((*this)()) * range;
+		uint32_t low = static_cast<uint32_t>(m);
+		if (low < range) {
+			uint32_t threshold = (0u - range) % range;
+			while (low < threshold) {
+				m = uint64_t((*this)()) * range;
+				low = static_cast<uint32_t>(m);
+			}
+		}
+		return static_cast<uint32_t>(m >> 32);
+	}
+
+	// Skips ahead delta outputs in O(log delta) steps.
+	void advance(uint64_t delta) {
+		uint64_t acc_mult = 1, acc_plus = 0;
+		uint64_t cur_mult = MULTIPLIER, cur_plus = inc;
+		while (delta > 0) {
+			if (delta & 1) {
+				acc_mult *= cur_mult;
+				acc_plus = acc_plus * cur_mult + cur_plus;
+			}
+			cur_plus = (cur_mult + 1) * cur_plus;
+			cur_mult *= cur_mult;
+			delta >>= 1;
+		}
+		state = acc_mult * state + acc_plus;
+	}
+
+	// Returns a new generator on a different stream, seeded from this one.
+	Pcg32 split() {
+		// One call per statement: the order of two calls in one expression
+		// is unspecified, and would make the result compiler dependent.
+		uint32_t state_hi = (*this)();
+		uint32_t state_lo = (*this)();
+		uint32_t stream_hi = (*this)();
+		uint32_t stream_lo = (*this)();
+		return Pcg32((uint64_t(state_hi) << 32) | state_lo, (uint64_t(stream_hi) << 32) | stream_lo);
+	}
+
+	static uint32_t min() { return 0; }
+	static uint32_t max() { return 0xFFFFFFFFu; }
+
+	bool operator ==(const Pcg32& o) const { return state == o.state && inc == o.inc; }
+	bool operator !=(const Pcg32& o) const { return !(*this == o); }
+
+private:
+	static const uint64_t MULTIPLIER = 6364136223846793005ull;
+
+	void step() {
+		state = state * MULTIPLIER + inc;
+	}
+
+	uint64_t state;
+	uint64_t inc;
+};
+
+typedef Pcg32 RandomGenerator;
+
+// Returns a number in [min, max], inclusive.
+inline int randRange(RandomGenerator& r, int min, int max) {
+	uint32_t range = static_cast<uint32_t>(max) - static_cast<uint32_t>(min) + 1;
+	if (range == 0)
+		return static_cast<int>(r());
+	return static_cast<int>(static_cast<uint32_t>(min) + r.bounded(range));
 }
 
-int randRange(RandomGenerator& r, int max) {
+inline int randRange(RandomGenerator& r, int max) {
 	return randRange(r, 0, max);
 }
 
-bool randBool(RandomGenerator& r) {
+inline bool randBool(RandomGenerator& r) {
 	return randRange(r, 1) == 1;
 }